@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdint.h>
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#include "mapped_file.h"
+#include "base64_simple.h"
+#include "content_hash.h"
+#include "smt_binary.h"
+
+// Sender side rasterization of an asset into SMT_DATA_QOI
+struct AssetRasterParams {
+  bool enabled = false;
+  int width = 0;      // 0 = native size
+  int height = 0;
+};
+
+// "native" or a list of <width>x<height>, e.g. "288x108,192x72"
+__inline bool parseAssetRasterSizes(const std::string &_spec, std::vector<AssetRasterParams> &_sizes) {
+  std::stringstream entries(_spec);
+  std::string entry;
+  while(std::getline(entries, entry, ',')) {
+    AssetRasterParams size;
+    size.enabled = true;
+    if(entry != "native" && (sscanf(entry.c_str(), "%dx%d", &size.width, &size.height) != 2 || size.width <= 0 || size.height <= 0)) {
+      return false;
+    }
+    _sizes.push_back(size);
+  }
+  return !_sizes.empty();
+}
+
+// Decodes, premultiplies and scales an asset into an SMT_DATA_QOI payload (rasterizeOverlayAsset in
+// overlay_rasterizer.h, which needs FFmpeg; passed in so that the registry itself doesn't)
+typedef bool (*AssetRasterizer)(const uint8_t *_data, size_t _size, uint8_t _dataType, const AssetRasterParams &_params, std::vector<uint8_t> &_payload, int &_width, int &_height);
+
+// Overlay asset loaded once at startup: mapped, hashed, and base64 encoded for the JSON encoding
+struct OverlayAsset {
+  std::string name;
+  std::string path;
+  uint8_t dataType = SMT_DATA_NONE;
+  uint64_t hash = 0;
+  MappedFile file;          // mapped for the lifetime of the asset, binary emissions copy straight from it
+  int width = 0;            // rasterized assets only
+  int height = 0;
+  std::vector<uint8_t> raster;   // SMT_DATA_QOI payload, when rasterized
+  // base64 asset bytes for the JSON encoding
+  std::string encodedData;
+
+  // Asset bytes as sent: the raster when rasterized, the mapped file otherwise
+  const uint8_t *data() const {
+    return raster.empty() ? file.data() : raster.data();
+  }
+
+  size_t size() const {
+    return raster.empty() ? file.size() : raster.size();
+  }
+};
+
+__inline uint8_t smtDataTypeFromPath(const std::string &_path) {
+  size_t dot = _path.find_last_of('.');
+  std::string ext = (dot == std::string::npos) ? "" : _path.substr(dot + 1);
+  for(char &c : ext) {
+    c = (char) tolower((unsigned char) c);
+  }
+  if(ext == "jpg" || ext == "jpeg") return SMT_DATA_JPEG;
+  if(ext == "png") return SMT_DATA_PNG;
+  return SMT_DATA_NONE;
+}
+
+// Named overlay assets. Files are mapped, hashed and encoded once in load(), so emitting
+// an asset later costs a memcpy from the mapping: no disk I/O and no re-encoding on the trigger path.
+// Rasterized assets are decoded and scaled here, once, instead of on every receiver.
+// The registry is read-only after startup and safe to share between threads.
+class AssetRegistry {
+public:
+  AssetRegistry(AssetRasterizer _rasterizer = nullptr)
+  :rasterizer_(_rasterizer)
+  {
+  }
+
+  bool load(const std::string &_name, const std::string &_path, const std::string &_encoding, const AssetRasterParams &_raster = AssetRasterParams()) {
+    std::unique_ptr<OverlayAsset> asset(new OverlayAsset());
+    asset->name = _name;
+    asset->path = _path;
+    asset->dataType = smtDataTypeFromPath(_path);
+    if(asset->dataType == SMT_DATA_NONE) {
+      std::cerr << "Error: Unsupported asset type " << _path << std::endl;
+      return false;
+    }
+    if(!asset->file.open(_path)) {
+      return false;
+    }
+    if(_raster.enabled) {
+      if(!rasterizer_ || !rasterizer_(asset->file.data(), asset->file.size(), asset->dataType, _raster, asset->raster, asset->width, asset->height) || asset->raster.empty()) {
+        std::cerr << "Error: Couldn't rasterize asset " << _path << std::endl;
+        return false;
+      }
+      asset->dataType = SMT_DATA_QOI;
+      asset->file.close();
+    }
+    const uint8_t *data = asset->data();
+    size_t size = asset->size();
+    asset->hash = contentHash(data, size);
+
+    if(_encoding != SMT_ENCODING_BINARY) {
+      asset->encodedData.resize(base64_encoded_size(size));
+      base64_encode(data, size, &asset->encodedData[0]);
+    }
+
+    std::cout << "Asset " << _name << ": " << _path << " (" << size << " bytes";
+    if(asset->dataType == SMT_DATA_QOI) {
+      std::cout << ", rasterized " << asset->width << "x" << asset->height;
+    }
+    std::cout << ", hash " << contentHashToString(asset->hash) << ")" << std::endl;
+    assets_[_name] = std::move(asset);
+    return true;
+  }
+
+  const OverlayAsset *find(const std::string &_name) const {
+    auto it = assets_.find(_name);
+    return (it != assets_.end()) ? it->second.get() : nullptr;
+  }
+
+  std::vector<std::string> names() const {
+    std::vector<std::string> names;
+    for(auto &entry : assets_) {
+      names.push_back(entry.first);
+    }
+    return names;
+  }
+
+protected:
+  AssetRasterizer rasterizer_ = nullptr;
+  std::map<std::string, std::unique_ptr<OverlayAsset>> assets_;
+};
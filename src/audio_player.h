@@ -0,0 +1,244 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+extern "C" {
+  #include <libavcodec/avcodec.h>
+  #include <libswresample/swresample.h>
+}
+#include "essence_block.h"
+#include "queue_thread_safe.h"
+#include "ring_buffer_spsc.h"
+#include "sdl_audio_sink.h"
+#include "null_audio_sink.h"
+#include "thread_placement.h"
+
+#define AUDIO_CLOCK_RATE 90000
+
+struct AudioPlayerParams {
+  int sampleRate = 48000;
+  int channels = 2;
+  int bufferFrames = 256;       // device buffer, ~5 ms at 48 kHz
+  int maxLatencyMs = 40;        // upper bound for decoded audio waiting in the ring plus the device buffer
+  std::string sink = "sdl";     // "sdl", "null" or path to a .wav file
+};
+
+// Audio decoder and player. Blocks are decoded on a dedicated thread, resampled once to the
+// output format (interleaved S16) and handed to the sink through a lock-free ring.
+// The played position is exposed as the master clock for A/V sync.
+class AudioPlayer {
+public:
+  AudioPlayer(const AudioPlayerParams &_params = AudioPlayerParams())
+  :params_(_params)
+  ,ring_((size_t) std::max(_params.sampleRate * _params.maxLatencyMs / 1000, _params.bufferFrames) * _params.channels)
+  {
+  }
+
+  ~AudioPlayer() {
+    close();
+  }
+
+  // _codecpar (optional) carries the full announced parameters, extradata included
+  bool open(const std::string &_codecName, int _sampleRate, int _channels, const AVCodecParameters *_codecpar = nullptr) {
+    const AVCodec *codec = avcodec_find_decoder_by_name(_codecName.c_str());
+    if(!codec) {
+      std::cerr << "Error: Audio decoder not found: " << _codecName << std::endl;
+      return false;
+    }
+
+    codecCtx_ = avcodec_alloc_context3(codec);
+    if(!codecCtx_) {
+      return false;
+    }
+    if(_codecpar && avcodec_parameters_to_context(codecCtx_, _codecpar) < 0) {
+      std::cerr << "Error: Invalid audio codec parameters" << std::endl;
+    }
+    codecCtx_->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    codecCtx_->pkt_timebase = av_make_q(1, AUDIO_CLOCK_RATE);
+    if(!_codecpar) {
+      codecCtx_->sample_rate = _sampleRate;
+      av_channel_layout_default(&codecCtx_->ch_layout, _channels);
+    }
+    if(avcodec_open2(codecCtx_, codec, nullptr) < 0) {
+      std::cerr << "Error: Couldn't open audio decoder: " << _codecName << std::endl;
+      avcodec_free_context(&codecCtx_);
+      return false;
+    }
+
+    // sink
+    if(params_.sink == "sdl") {
+      sink_.reset(new SDLAudioSink());
+      if(!sink_->open(&ring_, params_.sampleRate, params_.channels, params_.bufferFrames)) {
+        std::cerr << "Falling back to null audio sink" << std::endl;
+        sink_.reset();
+      }
+    }
+    if(!sink_) {
+      sink_.reset(new NullAudioSink(params_.sink == "sdl" || params_.sink == "null" ? "" : params_.sink));
+      sink_->open(&ring_, params_.sampleRate, params_.channels, params_.bufferFrames);
+    }
+
+    // keep the ring below maxLatencyMs once the device buffer is accounted for
+    targetFrames_ = (int64_t) params_.sampleRate * params_.maxLatencyMs / 1000 - sink_->latencyFrames();
+    if(targetFrames_ < params_.bufferFrames) {
+      targetFrames_ = params_.bufferFrames;
+    }
+
+    decoderThread_ = std::thread(&AudioPlayer::decodeLoop, this);
+
+    return true;
+  }
+
+  void close() {
+    if(decoderThread_.joinable()) {
+      queue_.push(nullptr);
+      decoderThread_.join();
+    }
+    while(!queue_.empty()) {
+      EssenceBlock *block = queue_.pop();
+      destroyEssenceBlock(&block);
+    }
+
+    if(sink_) {
+      sink_->close();
+      sink_.reset();
+    }
+    if(swrCtx_) {
+      swr_free(&swrCtx_);
+    }
+    avcodec_free_context(&codecCtx_);
+    ptsEnd_ = -1;
+  }
+
+  bool isOpen() const {
+    return codecCtx_ != nullptr;
+  }
+
+  // Queue an audio block, played at _timestamp (90 kHz). The block is copied, the caller keeps ownership of _block
+  void push(const EssenceBlock *_block, int64_t _timestamp) {
+    // decoders may read past the payload end, so keep AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes
+    EssenceBlock *block = createEssenceBlock(_block->payload_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    memcpy(block, _block, _block->size + _block->payload_size);
+    block->timestamp = (uint64_t) _timestamp;
+    queue_.push(block);
+  }
+
+  // Timestamp (90 kHz, the domain of the push() timestamps) of the sample being played right now
+  bool getClock(int64_t &_clock) {
+    int64_t ptsEnd = ptsEnd_.load(std::memory_order_acquire);
+    if(ptsEnd < 0 || !sink_) {
+      return false;
+    }
+    int64_t bufferedFrames = (int64_t) (ring_.size() / params_.channels) + sink_->latencyFrames();
+    _clock = ptsEnd - bufferedFrames * AUDIO_CLOCK_RATE / params_.sampleRate;
+    return true;
+  }
+
+  uint64_t droppedFrames() const {
+    return droppedFrames_.load(std::memory_order_relaxed);
+  }
+
+protected:
+  void decodeLoop() {
+    placeThread(THREAD_ROLE_AUDIO);
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+
+    while(true) {
+      EssenceBlock *block = queue_.pop();
+      if(!block) {
+        break;
+      }
+
+      packet->data = (uint8_t *) (block + 1);
+      packet->size = block->payload_size;
+      packet->pts = block->timestamp;
+
+      if(avcodec_send_packet(codecCtx_, packet) >= 0) {
+        while(avcodec_receive_frame(codecCtx_, frame) == 0) {
+          writeFrame(frame);
+          av_frame_unref(frame);
+        }
+      }
+
+      destroyEssenceBlock(&block);
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+  }
+
+  void writeFrame(AVFrame *_frame) {
+    // (re)build the resampler when the decoded format changes
+    if(!swrCtx_ || _frame->format != inFormat_ || _frame->sample_rate != inSampleRate_ || _frame->ch_layout.nb_channels != inChannels_) {
+      if(swrCtx_) {
+        swr_free(&swrCtx_);
+      }
+      AVChannelLayout outLayout;
+      av_channel_layout_default(&outLayout, params_.channels);
+      if(swr_alloc_set_opts2(&swrCtx_, &outLayout, AV_SAMPLE_FMT_S16, params_.sampleRate, &_frame->ch_layout, (AVSampleFormat) _frame->format, _frame->sample_rate, 0, nullptr) < 0 || swr_init(swrCtx_) < 0) {
+        std::cerr << "Error: Couldn't initialize audio resampler" << std::endl;
+        swr_free(&swrCtx_);
+        return;
+      }
+      inFormat_ = _frame->format;
+      inSampleRate_ = _frame->sample_rate;
+      inChannels_ = _frame->ch_layout.nb_channels;
+    }
+
+    int outFrames = swr_get_out_samples(swrCtx_, _frame->nb_samples);
+    if(resampled_.size() < (size_t) outFrames * params_.channels) {
+      resampled_.resize((size_t) outFrames * params_.channels);
+    }
+    uint8_t *out = (uint8_t *) resampled_.data();
+    int converted = swr_convert(swrCtx_, &out, outFrames, (const uint8_t **) _frame->extended_data, _frame->nb_samples);
+    if(converted <= 0) {
+      return;
+    }
+
+    int64_t pts = (_frame->best_effort_timestamp != AV_NOPTS_VALUE) ? _frame->best_effort_timestamp : nextPts_;
+    int64_t ptsEnd = pts + (int64_t) _frame->nb_samples * AUDIO_CLOCK_RATE / _frame->sample_rate;
+
+    // latency bound: drop the oldest samples of this frame instead of letting the ring grow
+    const int16_t *samples = resampled_.data();
+    size_t count = (size_t) converted * params_.channels;
+    size_t queued = ring_.size();
+    size_t target = (size_t) targetFrames_ * params_.channels;
+    if(queued + count > target) {
+      size_t drop = queued + count - target;
+      if(drop > count) {
+        drop = count;
+      }
+      drop -= drop % params_.channels;
+      samples += drop;
+      count -= drop;
+      droppedFrames_.fetch_add(drop / params_.channels, std::memory_order_relaxed);
+    }
+    ring_.write(samples, count);
+
+    nextPts_ = ptsEnd;
+    ptsEnd_.store(ptsEnd, std::memory_order_release);
+  }
+
+protected:
+  AudioPlayerParams params_;
+  SPSCRingBuffer<int16_t> ring_;
+  std::unique_ptr<AudioSinkBase> sink_;
+  ThreadSafeQueue<EssenceBlock *> queue_;
+  std::thread decoderThread_;
+  AVCodecContext *codecCtx_ = nullptr;
+  SwrContext *swrCtx_ = nullptr;
+  int inFormat_ = -1;
+  int inSampleRate_ = 0;
+  int inChannels_ = 0;
+  std::vector<int16_t> resampled_;
+  int64_t targetFrames_ = 0;
+  int64_t nextPts_ = 0;
+  std::atomic<int64_t> ptsEnd_ = -1;
+  std::atomic<uint64_t> droppedFrames_ = 0;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include "ring_buffer_spsc.h"
+
+// Audio output. Sinks pull interleaved S16 samples from the ring filled by the audio decoder
+class AudioSinkBase {
+public:
+  virtual ~AudioSinkBase() = default;
+  virtual bool open(SPSCRingBuffer<int16_t> *_ring, int _sampleRate, int _channels, int _bufferFrames) = 0;
+  virtual bool close() = 0;
+  // Frames already pulled from the ring but not played yet (device buffer)
+  virtual int latencyFrames() = 0;
+  // Times the sink found the ring empty
+  virtual uint64_t underruns() = 0;
+};
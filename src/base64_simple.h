@@ -1,56 +1,474 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
-static const std::string base64_chars =
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define BASE64_X86 1
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define BASE64_TARGET_SSSE3
+    #define BASE64_TARGET_AVX2
+  #else
+    #define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+    #define BASE64_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+#endif
+
+// Table driven base64 codec (RFC 4648, standard alphabet, padded).
+// Encoders/decoders write into presized buffers: see base64_encoded_size() / base64_decoded_max_size().
+// Decoding is strict: length must be a multiple of 4, padding only at the end, alphabet only,
+// and unused trailing bits must be zero. x86 builds pick an AVX2 or SSSE3 bulk loop at runtime.
+
+static const char base64_chars[] =
 "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 "abcdefghijklmnopqrstuvwxyz"
 "0123456789+/";
 
-std::string base64_encode(const std::vector<uint8_t>& data) {
-  std::string encoded;
-  size_t i = 0;
-  uint32_t val = 0;
-  int valb = -6;
+__inline size_t base64_encoded_size(size_t _size) {
+  return (_size + 2) / 3 * 4;
+}
+
+__inline size_t base64_decoded_max_size(size_t _size) {
+  return _size / 4 * 3;
+}
+
+namespace base64_detail {
 
-  for(uint8_t c : data) {
-    val = (val << 8) + c;
-    valb += 8;
-    while(valb >= 0) {
-      encoded.push_back(base64_chars[(val >> valb) & 0x3F]);
-      valb -= 6;
+#define BASE64_INVALID 0xff
+
+struct DecodeTable {
+  uint8_t values[256];
+  DecodeTable() {
+    memset(values, BASE64_INVALID, sizeof(values));
+    for(int i = 0; i < 64; i++) {
+      values[(uint8_t) base64_chars[i]] = (uint8_t) i;
     }
   }
-  if(valb > -6) {
-    encoded.push_back(base64_chars[((val << 8) >> (valb + 8)) & 0x3F]);
+};
+
+__inline const uint8_t *decodeTable() {
+  static const DecodeTable table;
+  return table.values;
+}
+
+// Encode whole 3 byte groups. Returns bytes consumed
+__inline size_t encodeScalar(const uint8_t *_data, size_t _size, char *_out) {
+  size_t i = 0;
+  for(; i + 3 <= _size; i += 3) {
+    uint32_t v = ((uint32_t) _data[i] << 16) | ((uint32_t) _data[i + 1] << 8) | _data[i + 2];
+    _out[0] = base64_chars[(v >> 18) & 0x3f];
+    _out[1] = base64_chars[(v >> 12) & 0x3f];
+    _out[2] = base64_chars[(v >> 6) & 0x3f];
+    _out[3] = base64_chars[v & 0x3f];
+    _out += 4;
+  }
+  return i;
+}
+
+// Decode whole quartets without padding. Returns false on any character outside the alphabet
+__inline bool decodeScalar(const char *_in, size_t _size, uint8_t *_out) {
+  const uint8_t *table = decodeTable();
+  uint8_t error = 0;
+  for(size_t i = 0; i < _size; i += 4) {
+    uint8_t a = table[(uint8_t) _in[i]];
+    uint8_t b = table[(uint8_t) _in[i + 1]];
+    uint8_t c = table[(uint8_t) _in[i + 2]];
+    uint8_t d = table[(uint8_t) _in[i + 3]];
+    error |= a | b | c | d;
+    uint32_t v = ((uint32_t) a << 18) | ((uint32_t) b << 12) | ((uint32_t) c << 6) | d;
+    _out[0] = (uint8_t) (v >> 16);
+    _out[1] = (uint8_t) (v >> 8);
+    _out[2] = (uint8_t) v;
+    _out += 3;
+  }
+  return (error & 0x80) == 0;
+}
+
+#ifdef BASE64_X86
+
+// 6-bit indices to ASCII (W. Mula, "pshufb improved" lookup)
+BASE64_TARGET_SSSE3 __inline __m128i encodeLookupSSSE3(__m128i _indices) {
+  const __m128i shiftLUT = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i result = _mm_subs_epu8(_indices, _mm_set1_epi8(51));
+  const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), _indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  result = _mm_shuffle_epi8(shiftLUT, result);
+  return _mm_add_epi8(result, _indices);
+}
+
+// 12 input bytes (in a 16 byte load) to 16 6-bit indices
+BASE64_TARGET_SSSE3 __inline __m128i encodeSplitSSSE3(__m128i _in) {
+  _in = _mm_shuffle_epi8(_in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  const __m128i t0 = _mm_and_si128(_in, _mm_set1_epi32(0x0fc0fc00));
+  const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  const __m128i t2 = _mm_and_si128(_in, _mm_set1_epi32(0x003f03f0));
+  const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+BASE64_TARGET_SSSE3 __inline size_t encodeSSSE3(const uint8_t *_data, size_t _size, char *_out) {
+  size_t i = 0;
+  // 16 byte loads, 12 bytes used
+  for(; i + 16 <= _size; i += 12) {
+    __m128i in = _mm_loadu_si128((const __m128i *) (_data + i));
+    _mm_storeu_si128((__m128i *) _out, encodeLookupSSSE3(encodeSplitSSSE3(in)));
+    _out += 16;
+  }
+  return i;
+}
+
+// ASCII to 6-bit values; sets _error when a byte is outside the alphabet (aklomp/base64 tables)
+BASE64_TARGET_SSSE3 __inline __m128i decodeLookupSSSE3(__m128i _in, __m128i &_error) {
+  const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask = _mm_set1_epi8(0x0f);
+
+  const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(_in, 4), mask);
+  const __m128i loNibbles = _mm_and_si128(_in, mask);
+  const __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+  const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+  _error = _mm_or_si128(_error, _mm_and_si128(lo, hi));
+
+  const __m128i eq2F = _mm_cmpeq_epi8(_in, _mm_set1_epi8('/'));
+  const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+  return _mm_add_epi8(_in, roll);
+}
+
+// 16 6-bit values to 12 bytes (in the low 12 bytes)
+BASE64_TARGET_SSSE3 __inline __m128i decodePackSSSE3(__m128i _values) {
+  const __m128i mergeAB = _mm_maddubs_epi16(_values, _mm_set1_epi32(0x01400140));
+  const __m128i merged = _mm_madd_epi16(mergeAB, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+// Bulk decode. Returns characters consumed (a multiple of 16); the tail is left to the scalar path.
+// Stops 8 characters early so the 16 byte stores never run past the decoded size
+BASE64_TARGET_SSSE3 __inline size_t decodeSSSE3(const char *_in, size_t _size, uint8_t *_out, bool &_valid) {
+  size_t i = 0;
+  __m128i error = _mm_setzero_si128();
+  for(; i + 24 <= _size; i += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *) (_in + i));
+    _mm_storeu_si128((__m128i *) _out, decodePackSSSE3(decodeLookupSSSE3(in, error)));
+    _out += 12;
   }
-  while(encoded.size() % 4) {
-    encoded.push_back('=');
+  _valid = _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff;
+  return i;
+}
+
+BASE64_TARGET_AVX2 __inline size_t encodeAVX2(const uint8_t *_data, size_t _size, char *_out) {
+  const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                          10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i shiftLUT = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  // two 12 byte groups per iteration, one per 128-bit lane
+  for(; i + 28 <= _size; i += 24) {
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (_data + i))), _mm_loadu_si128((const __m128i *) (_data + i + 12)), 1);
+    in = _mm256_shuffle_epi8(in, shuffle);
+    const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t1, t3);
+
+    __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_shuffle_epi8(shiftLUT, result);
+    _mm256_storeu_si256((__m256i *) _out, _mm256_add_epi8(result, indices));
+    _out += 32;
   }
+  return i;
+}
+
+BASE64_TARGET_AVX2 __inline size_t decodeAVX2(const char *_in, size_t _size, uint8_t *_out, bool &_valid) {
+  const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                         0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                           0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  __m256i error = _mm256_setzero_si256();
+
+  size_t i = 0;
+  // 32 characters to 24 bytes per iteration; 32 byte stores need 8 bytes of slack after them
+  for(; i + 44 <= _size; i += 32) {
+    __m256i in = _mm256_loadu_si256((const __m256i *) (_in + i));
+    const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask);
+    const __m256i loNibbles = _mm256_and_si256(in, mask);
+    const __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+    const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+    error = _mm256_or_si256(error, _mm256_and_si256(lo, hi));
+
+    const __m256i eq2F = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+    const __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+    const __m256i values = _mm256_add_epi8(in, roll);
+
+    const __m256i mergeAB = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i merged = _mm256_madd_epi16(mergeAB, _mm256_set1_epi32(0x00011000));
+    merged = _mm256_shuffle_epi8(merged, pack);
+    merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+    _mm256_storeu_si256((__m256i *) _out, merged);
+    _out += 24;
+  }
+  _valid = _mm256_movemask_epi8(_mm256_cmpeq_epi8(error, _mm256_setzero_si256())) == -1;
+  return i;
+}
+
+enum SimdLevel {
+  SIMD_NONE = 0,
+  SIMD_SSSE3 = 1,
+  SIMD_AVX2 = 2,
+};
+
+__inline SimdLevel detectSimdLevel() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  __cpuid(info, 1);
+  bool ssse3 = (info[2] & (1 << 9)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  bool avx2 = false;
+  if(maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+  }
+  return avx2 ? SIMD_AVX2 : ssse3 ? SIMD_SSSE3 : SIMD_NONE;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : __builtin_cpu_supports("ssse3") ? SIMD_SSSE3 : SIMD_NONE;
+#endif
+}
+
+__inline SimdLevel simdLevel() {
+  static const SimdLevel level = detectSimdLevel();
+  return level;
+}
+
+#endif // BASE64_X86
+
+// Bulk encode of whole groups with the best available implementation. Returns bytes consumed
+__inline size_t encodeBulk(const uint8_t *_data, size_t _size, char *_out) {
+  size_t done = 0;
+#ifdef BASE64_X86
+  if(simdLevel() == SIMD_AVX2) {
+    done = encodeAVX2(_data, _size, _out);
+  }
+  else if(simdLevel() == SIMD_SSSE3) {
+    done = encodeSSSE3(_data, _size, _out);
+  }
+#endif
+  return done + encodeScalar(_data + done, _size - done, _out + done / 3 * 4);
+}
+
+// Bulk decode of unpadded quartets with the best available implementation
+__inline bool decodeBulk(const char *_in, size_t _size, uint8_t *_out) {
+  size_t done = 0;
+  bool valid = true;
+#ifdef BASE64_X86
+  if(simdLevel() == SIMD_AVX2) {
+    done = decodeAVX2(_in, _size, _out, valid);
+  }
+  else if(simdLevel() == SIMD_SSSE3) {
+    done = decodeSSSE3(_in, _size, _out, valid);
+  }
+#endif
+  return decodeScalar(_in + done, _size - done, _out + done / 4 * 3) && valid;
+}
+
+// Decode a final quartet that may carry padding. Returns bytes written, or -1 if invalid
+__inline int decodeLastQuartet(const char *_in, uint8_t *_out) {
+  const uint8_t *table = decodeTable();
+  int padding = (_in[3] == '=') ? ((_in[2] == '=') ? 2 : 1) : 0;
+  uint8_t a = table[(uint8_t) _in[0]];
+  uint8_t b = table[(uint8_t) _in[1]];
+  uint8_t c = (padding >= 2) ? 0 : table[(uint8_t) _in[2]];
+  uint8_t d = (padding >= 1) ? 0 : table[(uint8_t) _in[3]];
+  if((a | b | c | d) & 0x80) {
+    return -1;
+  }
+  // canonical encoding: bits dropped by the padding must be zero
+  if((padding == 2 && (b & 0x0f)) || (padding == 1 && (c & 0x03))) {
+    return -1;
+  }
+  uint32_t v = ((uint32_t) a << 18) | ((uint32_t) b << 12) | ((uint32_t) c << 6) | d;
+  _out[0] = (uint8_t) (v >> 16);
+  if(padding < 2) _out[1] = (uint8_t) (v >> 8);
+  if(padding < 1) _out[2] = (uint8_t) v;
+  return 3 - padding;
+}
+
+} // namespace base64_detail
+
+// Encode _size bytes into _out (base64_encoded_size(_size) chars, not null terminated). Returns chars written
+__inline size_t base64_encode(const uint8_t *_data, size_t _size, char *_out) {
+  size_t done = base64_detail::encodeBulk(_data, _size, _out);
+  char *out = _out + done / 3 * 4;
+  size_t remaining = _size - done;
+  if(remaining == 1) {
+    uint32_t v = (uint32_t) _data[done] << 16;
+    out[0] = base64_chars[(v >> 18) & 0x3f];
+    out[1] = base64_chars[(v >> 12) & 0x3f];
+    out[2] = '=';
+    out[3] = '=';
+  }
+  else if(remaining == 2) {
+    uint32_t v = ((uint32_t) _data[done] << 16) | ((uint32_t) _data[done + 1] << 8);
+    out[0] = base64_chars[(v >> 18) & 0x3f];
+    out[1] = base64_chars[(v >> 12) & 0x3f];
+    out[2] = base64_chars[(v >> 6) & 0x3f];
+    out[3] = '=';
+  }
+  return base64_encoded_size(_size);
+}
+
+// Decode _size chars into _out (at least base64_decoded_max_size(_size) bytes).
+// Returns false if the input is not strictly valid base64
+__inline bool base64_decode(const char *_in, size_t _size, uint8_t *_out, size_t *_outSize) {
+  *_outSize = 0;
+  if(_size % 4 != 0) {
+    return false;
+  }
+  if(_size == 0) {
+    return true;
+  }
+  size_t bulk = _size - 4;
+  if(!base64_detail::decodeBulk(_in, bulk, _out)) {
+    return false;
+  }
+  int last = base64_detail::decodeLastQuartet(_in + bulk, _out + bulk / 4 * 3);
+  if(last < 0) {
+    return false;
+  }
+  *_outSize = bulk / 4 * 3 + last;
+  return true;
+}
+
+__inline std::string base64_encode(const std::vector<uint8_t>& data) {
+  std::string encoded(base64_encoded_size(data.size()), '\0');
+  base64_encode(data.data(), data.size(), &encoded[0]);
   return encoded;
 }
 
-inline bool is_base64(unsigned char c) {
-  return std::isalnum(c) || (c == '+') || (c == '/');
+// Empty result on invalid input
+__inline std::string base64_decode(const std::string& encoded) {
+  std::string decoded(base64_decoded_max_size(encoded.size()), '\0');
+  size_t size = 0;
+  if(!base64_decode(encoded.data(), encoded.size(), (uint8_t *) &decoded[0], &size)) {
+    return std::string();
+  }
+  decoded.resize(size);
+  return decoded;
 }
 
-std::string base64_decode(const std::string& encoded) {
-  std::string decoded;
-  int val = 0;
-  int valb = -8;
-  for(unsigned char c : encoded) {
-    if(!is_base64(c) && c != '=') {
-      return decoded;
+// Incremental decoder for base64 text that arrives in chunks of any size.
+// Each update() decodes all complete quartets; up to 3 characters are carried to the next call
+class Base64StreamDecoder {
+public:
+  // Output needed by update() for an _size char chunk
+  static size_t maxOutputSize(size_t _size) {
+    return base64_decoded_max_size(_size + 3);
+  }
+
+  bool update(const char *_in, size_t _size, uint8_t *_out, size_t *_outSize) {
+    *_outSize = 0;
+    if(_size == 0) {
+      return !failed_;
+    }
+    if(failed_ || finished_) {
+      failed_ = true;
+      return false;
+    }
+
+    // complete the quartet carried from the previous chunk
+    while(pendingSize_ > 0 && pendingSize_ < 4 && _size > 0) {
+      pending_[pendingSize_++] = *_in++;
+      _size--;
+    }
+    if(pendingSize_ == 4) {
+      pendingSize_ = 0;
+      if(!decodeQuartets(pending_, 4, _out, _outSize, _size == 0)) {
+        return false;
+      }
+      if(finished_ && _size > 0) {
+        failed_ = true;
+        return false;
+      }
+    }
+    if(pendingSize_ > 0) {
+      return true;
+    }
+
+    // whole quartets of this chunk; padding is only accepted in the last one and ends the stream
+    size_t whole = _size / 4 * 4;
+    if(whole > 0) {
+      size_t written = 0;
+      if(!decodeQuartets(_in, whole, _out + *_outSize, &written, true)) {
+        return false;
+      }
+      *_outSize += written;
+      if(finished_ && whole < _size) {
+        failed_ = true;
+        return false;
+      }
     }
-    if(c == '=') break;
-    val = (val << 6) + (int) base64_chars.find(c);
-    valb += 6;
-    if(valb >= 0) {
-      decoded.push_back((val >> valb) & 0xFF);
-      valb -= 8;
+
+    memcpy(pending_, _in + whole, _size - whole);
+    pendingSize_ = _size - whole;
+    return true;
+  }
+
+  // Validates that the stream ended on a quartet boundary
+  bool finish() {
+    if(pendingSize_ != 0) {
+      failed_ = true;
     }
+    return !failed_;
+  }
+
+  void reset() {
+    pendingSize_ = 0;
+    finished_ = false;
+    failed_ = false;
+  }
+
+protected:
+  bool decodeQuartets(const char *_in, size_t _size, uint8_t *_out, size_t *_outSize, bool _mayBeLast) {
+    size_t bulk = _mayBeLast ? _size - 4 : _size;
+    if(!base64_detail::decodeBulk(_in, bulk, _out)) {
+      failed_ = true;
+      return false;
+    }
+    *_outSize = bulk / 4 * 3;
+    if(_mayBeLast) {
+      int last = base64_detail::decodeLastQuartet(_in + bulk, _out + *_outSize);
+      if(last < 0) {
+        failed_ = true;
+        return false;
+      }
+      *_outSize += last;
+      finished_ = last < 3;
+    }
+    return true;
   }
-  return decoded;
-}
 
+protected:
+  char pending_[4];
+  size_t pendingSize_ = 0;
+  bool finished_ = false;
+  bool failed_ = false;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+struct BenchParams {
+  int minTimeMs = 200;          // each round runs at least this long
+  int rounds = 5;               // reported figure is the median round
+  std::string output;           // JSON file, empty = stdout
+};
+
+struct BenchResult {
+  std::string name;
+  size_t bytes = 0;             // bytes processed per operation, 0 if not meaningful
+  uint64_t iterations = 0;      // iterations per round
+  double nsPerOp = 0;
+  double mbPerSec = 0;
+};
+
+// Keeps the optimizer from discarding a benchmarked result
+template<typename T>
+__inline void benchKeep(const T &_value) {
+  static const void *volatile sink;
+  sink = &_value;
+  (void) sink;
+}
+
+// Minimal microbenchmark harness. Iteration count is calibrated per case so every round lasts
+// at least minTimeMs; results are collected and written as one JSON document
+class BenchHarness {
+public:
+  BenchHarness(const BenchParams &_params = BenchParams())
+  :params_(_params)
+  {
+  }
+
+  // _fn performs _opsPerCall operations (batched cases, e.g. multi threaded queues); results are per operation
+  template<typename F>
+  const BenchResult &run(const std::string &_name, size_t _bytes, F _fn, uint64_t _opsPerCall = 1) {
+    typedef std::chrono::steady_clock clock;
+
+    // calibrate
+    uint64_t iterations = 1;
+    while(true) {
+      auto start = clock::now();
+      for(uint64_t i = 0; i < iterations; i++) {
+        _fn();
+      }
+      int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+      if(elapsed >= params_.minTimeMs || iterations >= (1ull << 40)) {
+        break;
+      }
+      iterations *= (elapsed > 0) ? std::max<uint64_t>(2, (uint64_t) params_.minTimeMs / elapsed + 1) : 10;
+    }
+
+    std::vector<double> samples;
+    for(int round = 0; round < params_.rounds; round++) {
+      auto start = clock::now();
+      for(uint64_t i = 0; i < iterations; i++) {
+        _fn();
+      }
+      double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+      samples.push_back(ns / (iterations * _opsPerCall));
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    result.name = _name;
+    result.bytes = _bytes;
+    result.iterations = iterations * _opsPerCall;
+    result.nsPerOp = samples[samples.size() / 2];
+    result.mbPerSec = (_bytes && result.nsPerOp > 0) ? (_bytes / (1024.0 * 1024.0)) / (result.nsPerOp * 1e-9) : 0;
+    results_.push_back(result);
+
+    std::cerr << _name << ": " << result.nsPerOp << " ns/op";
+    if(_bytes) {
+      std::cerr << ", " << result.mbPerSec << " MB/s";
+    }
+    std::cerr << std::endl;
+    return results_.back();
+  }
+
+  const BenchResult *find(const std::string &_name) const {
+    for(const BenchResult &result : results_) {
+      if(result.name == _name) {
+        return &result;
+      }
+    }
+    return nullptr;
+  }
+
+  json toJson() const {
+    json root;
+    root["min_time_ms"] = params_.minTimeMs;
+    root["rounds"] = params_.rounds;
+    root["results"] = json::array();
+    for(const BenchResult &result : results_) {
+      json entry;
+      entry["name"] = result.name;
+      entry["bytes"] = result.bytes;
+      entry["iterations"] = result.iterations;
+      entry["ns_per_op"] = result.nsPerOp;
+      entry["mb_per_sec"] = result.mbPerSec;
+      root["results"].push_back(entry);
+    }
+    return root;
+  }
+
+  bool write() const {
+    std::string dump = toJson().dump(2);
+    if(params_.output.empty()) {
+      std::cout << dump << std::endl;
+      return true;
+    }
+    std::ofstream file(params_.output);
+    if(!file) {
+      std::cerr << "Error: Couldn't open " << params_.output << std::endl;
+      return false;
+    }
+    file << dump << std::endl;
+    return true;
+  }
+
+protected:
+  BenchParams params_;
+  std::vector<BenchResult> results_;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+#include "essence_block.h"
+#include "parser_base.h"
+#include "metrics_registry.h"
+
+#define MAX_AV_PACKET_SIZE 1024 * 1024 * 4
+#define RECEIVE_BUFFER_PREFAULT 1024 * 1024
+
+// Rebuilds essence blocks from a byte stream cut into datagrams and hands them to the parser.
+// A block is framed by the length its header declares (header size + payload size, the same in
+// every header version), so a payload may contain the sync word. Senders coalesce blocks into
+// datagrams: a lost datagram can take the tail of one block with the start of the next, so a block
+// that is not followed by a sync word (when the bytes after it have arrived) is dropped as spliced.
+// After a bad header or a spliced block, bytes are skipped up to the next sync word.
+// Independent of the transport, so it can be fed synthetic datagrams
+class BlockReassembler {
+public:
+  BlockReassembler(ParserBase *_parser)
+  :parser_(_parser)
+  {
+  }
+
+  // One datagram. _receivedAt (traceNow()) times the reassembly stage
+  void consume(const uint8_t *_data, size_t _size, uint64_t _receivedAt) {
+    if(accumulatedData_.empty()) {
+      blockStart_ = _receivedAt;
+    }
+    accumulatedData_.insert(accumulatedData_.end(), _data, _data + _size);
+
+    size_t offset = 0;
+    while(accumulatedData_.size() - offset >= sizeof(uint32_t)) {
+      size_t available = accumulatedData_.size() - offset;
+      const EssenceBlock *header = (const EssenceBlock *) (accumulatedData_.data() + offset);
+      if(header->sync != SYNC_MAGIC_NUMBER) {
+        offset = resync(offset);
+        continue;
+      }
+      if(available < ESSENCE_BLOCK_HEADER_SIZE_V0) {
+        break;
+      }
+      uint64_t length = (uint64_t) header->size + header->payload_size;
+      if(header->size < ESSENCE_BLOCK_HEADER_SIZE_V0 || length > MAX_AV_PACKET_SIZE) {
+        invalidBlocks_++;
+        offset = resync(offset);
+        continue;
+      }
+      if(available < length) {
+        break;
+      }
+      // data lost in between: what follows this block's length is not the next block
+      if(available >= length + sizeof(uint32_t) && *(const uint32_t *) (accumulatedData_.data() + offset + length) != SYNC_MAGIC_NUMBER) {
+        misframedBlocks_++;
+        offset = resync(offset);
+        continue;
+      }
+
+      EssenceBlock *block = readEssenceBlock(accumulatedData_.data() + offset, (size_t) length, legacyBlock_);
+      if(block) {
+        uint64_t parseStart = traceNow();
+        reassemblyLatency_.record(parseStart - blockStart_);
+        parser_->parse(block);
+        parseLatency_.record(traceNow() - parseStart);
+        blocks_++;
+        bytes_ += block->size + block->payload_size;
+      }
+      else {
+        invalidBlocks_++;
+      }
+      offset += (size_t) length;
+      // the next block starts in this datagram
+      blockStart_ = _receivedAt;
+    }
+    accumulatedData_.erase(accumulatedData_.begin(), accumulatedData_.begin() + offset);
+  }
+
+  // Touch _bytes of accumulation buffer from the calling thread (the one that will consume), so
+  // its pages are on that thread's NUMA node instead of wherever the first large block lands
+  void prefault(size_t _bytes) {
+    accumulatedData_.resize(_bytes);
+    accumulatedData_.clear();
+  }
+
+protected:
+  // Offset of the next sync word after _offset, or of the bytes that may start one
+  size_t resync(size_t _offset) {
+    size_t last = accumulatedData_.size() - sizeof(uint32_t);
+    size_t next = _offset + 1;
+    while(next <= last && *(const uint32_t *) (accumulatedData_.data() + next) != SYNC_MAGIC_NUMBER) {
+      next++;
+    }
+    overflowBytes_ += next - _offset;
+    return next;
+  }
+
+  ParserBase *parser_ = nullptr;
+  std::vector<uint8_t> accumulatedData_;
+  std::vector<uint8_t> legacyBlock_;
+  uint64_t blockStart_ = 0;
+  // metrics
+  LatencyHistogram &reassemblyLatency_ = globalMetrics().histogram("receiver_stage_seconds", "stage=\"reassembly\"", "Time spent in receiver stages");
+  LatencyHistogram &parseLatency_ = globalMetrics().histogram("receiver_stage_seconds", "stage=\"parse\"");
+  Counter &blocks_ = globalMetrics().counter("receiver_blocks_total", "", "Blocks reassembled");
+  Counter &bytes_ = globalMetrics().counter("receiver_bytes_total", "", "Block bytes reassembled");
+  Counter &invalidBlocks_ = globalMetrics().counter("receiver_invalid_blocks_total", "", "Truncated or corrupt blocks dropped");
+  Counter &misframedBlocks_ = globalMetrics().counter("receiver_misframed_blocks_total", "", "Blocks dropped as their length didn't match the next sync word");
+  Counter &overflowBytes_ = globalMetrics().counter("receiver_overflow_bytes_total", "", "Bytes dropped without a sync word");
+};
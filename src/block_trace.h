@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include "latency_histogram.h"
+
+// Sender stage boundaries of an essence block
+enum TraceStage {
+  TRACE_STAGE_DEMUX = 0,     // packet demuxed, block being built
+  TRACE_STAGE_ENQUEUE,       // pushed to the muxer queue
+  TRACE_STAGE_MUX,           // popped by the muxer
+  TRACE_STAGE_SEND,          // written to the network
+  TRACE_STAGES
+};
+
+// Stage timestamps of a block, steady clock ns, 0 = not stamped. Lives in memory in front of the
+// block header (see createEssenceBlock) and never goes on the wire
+struct BlockTrace {
+  uint64_t stamps[TRACE_STAGES];
+};
+
+__inline uint64_t traceNow() {
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Record the time between two stamps of a block, if both were taken
+__inline void traceRecord(const BlockTrace &_trace, TraceStage _from, TraceStage _to, LatencyHistogram &_histogram) {
+  uint64_t from = _trace.stamps[_from];
+  uint64_t to = _trace.stamps[_to];
+  if(from && to >= from) {
+    _histogram.record(to - from);
+  }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <nlohmann/json.hpp>
+extern "C" {
+  #include <libavcodec/avcodec.h>
+}
+#include "base64_simple.h"
+
+// Full codec parameters for the Essence Announcement, so a receiver can open its decoder
+// (extradata included) as soon as it joins instead of waiting for in-band parameter sets.
+__inline nlohmann::json codecParametersToJson(const AVCodecParameters *_par, AVRational _timeBase) {
+  nlohmann::json par;
+  par["codec_tag"] = _par->codec_tag;
+  par["format"] = _par->format;
+  par["bit_rate"] = _par->bit_rate;
+  par["bits_per_coded_sample"] = _par->bits_per_coded_sample;
+  par["bits_per_raw_sample"] = _par->bits_per_raw_sample;
+  par["profile"] = _par->profile;
+  par["level"] = _par->level;
+  par["time_base"] = { _timeBase.num, _timeBase.den };
+  if(_par->codec_type == AVMEDIA_TYPE_VIDEO) {
+    par["width"] = _par->width;
+    par["height"] = _par->height;
+    par["sample_aspect_ratio"] = { _par->sample_aspect_ratio.num, _par->sample_aspect_ratio.den };
+    par["field_order"] = _par->field_order;
+    par["color_range"] = _par->color_range;
+    par["color_primaries"] = _par->color_primaries;
+    par["color_trc"] = _par->color_trc;
+    par["color_space"] = _par->color_space;
+    par["chroma_location"] = _par->chroma_location;
+    par["video_delay"] = _par->video_delay;
+  }
+  else if(_par->codec_type == AVMEDIA_TYPE_AUDIO) {
+    par["sample_rate"] = _par->sample_rate;
+    par["channels"] = _par->ch_layout.nb_channels;
+    par["block_align"] = _par->block_align;
+    par["frame_size"] = _par->frame_size;
+    par["initial_padding"] = _par->initial_padding;
+    par["seek_preroll"] = _par->seek_preroll;
+  }
+  if(_par->extradata_size > 0) {
+    std::string extradata(base64_encoded_size(_par->extradata_size), '\0');
+    base64_encode(_par->extradata, _par->extradata_size, &extradata[0]);
+    par["extradata"] = extradata;
+  }
+  return par;
+}
+
+// Stream time_base of codecParametersToJson() output, 0/1 if not announced
+__inline AVRational codecTimeBaseFromJson(const nlohmann::json &_json) {
+  if(!_json.contains("time_base") || _json["time_base"].size() != 2) {
+    return av_make_q(0, 1);
+  }
+  return av_make_q(_json["time_base"][0], _json["time_base"][1]);
+}
+
+// Fills _par (allocated by the caller) from codecParametersToJson() output. _codec sets codec id and type
+__inline bool codecParametersFromJson(const nlohmann::json &_json, const AVCodec *_codec, AVCodecParameters *_par) {
+  try {
+    _par->codec_type = _codec->type;
+    _par->codec_id = _codec->id;
+    _par->codec_tag = _json.value("codec_tag", 0u);
+    _par->format = _json.value("format", -1);
+    _par->bit_rate = _json.value("bit_rate", (int64_t) 0);
+    _par->bits_per_coded_sample = _json.value("bits_per_coded_sample", 0);
+    _par->bits_per_raw_sample = _json.value("bits_per_raw_sample", 0);
+    _par->profile = _json.value("profile", (int) FF_PROFILE_UNKNOWN);
+    _par->level = _json.value("level", (int) FF_LEVEL_UNKNOWN);
+    if(_codec->type == AVMEDIA_TYPE_VIDEO) {
+      _par->width = _json.value("width", 0);
+      _par->height = _json.value("height", 0);
+      if(_json.contains("sample_aspect_ratio")) {
+        _par->sample_aspect_ratio = av_make_q(_json["sample_aspect_ratio"][0], _json["sample_aspect_ratio"][1]);
+      }
+      _par->field_order = (AVFieldOrder) _json.value("field_order", (int) AV_FIELD_UNKNOWN);
+      _par->color_range = (AVColorRange) _json.value("color_range", (int) AVCOL_RANGE_UNSPECIFIED);
+      _par->color_primaries = (AVColorPrimaries) _json.value("color_primaries", (int) AVCOL_PRI_UNSPECIFIED);
+      _par->color_trc = (AVColorTransferCharacteristic) _json.value("color_trc", (int) AVCOL_TRC_UNSPECIFIED);
+      _par->color_space = (AVColorSpace) _json.value("color_space", (int) AVCOL_SPC_UNSPECIFIED);
+      _par->chroma_location = (AVChromaLocation) _json.value("chroma_location", (int) AVCHROMA_LOC_UNSPECIFIED);
+      _par->video_delay = _json.value("video_delay", 0);
+    }
+    else if(_codec->type == AVMEDIA_TYPE_AUDIO) {
+      _par->sample_rate = _json.value("sample_rate", 0);
+      av_channel_layout_uninit(&_par->ch_layout);
+      av_channel_layout_default(&_par->ch_layout, _json.value("channels", 2));
+      _par->block_align = _json.value("block_align", 0);
+      _par->frame_size = _json.value("frame_size", 0);
+      _par->initial_padding = _json.value("initial_padding", 0);
+      _par->seek_preroll = _json.value("seek_preroll", 0);
+    }
+
+    if(_json.contains("extradata")) {
+      std::string encoded = _json["extradata"];
+      av_freep(&_par->extradata);
+      _par->extradata_size = 0;
+      _par->extradata = (uint8_t *) av_mallocz(base64_decoded_max_size(encoded.size()) + AV_INPUT_BUFFER_PADDING_SIZE);
+      if(!_par->extradata) {
+        return false;
+      }
+      size_t size = 0;
+      if(!base64_decode(encoded.data(), encoded.size(), _par->extradata, &size)) {
+        std::cerr << "Invalid extradata in Essence Announcement" << std::endl;
+        av_freep(&_par->extradata);
+        return false;
+      }
+      _par->extradata_size = (int) size;
+    }
+  }
+  catch(const nlohmann::json::exception &_e) {
+    std::cerr << "Invalid codec parameters: " << _e.what() << std::endl;
+    return false;
+  }
+  return true;
+}
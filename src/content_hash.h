@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+// 64-bit FNV-1a. Cheap content fingerprint used to detect unchanged overlay assets
+__inline uint64_t contentHash(const uint8_t *_data, size_t _size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for(size_t i = 0; i < _size; i++) {
+    hash ^= _data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Hash as it travels in SMT actions ("asset_hash"): 16 lowercase hex digits
+__inline std::string contentHashToString(uint64_t _hash) {
+  char text[17];
+  snprintf(text, sizeof(text), "%016llx", (unsigned long long) _hash);
+  return text;
+}
+
+__inline uint64_t contentHashFromString(const std::string &_text) {
+  return (uint64_t) strtoull(_text.c_str(), nullptr, 16);
+}
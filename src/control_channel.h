@@ -0,0 +1,348 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#ifdef _WIN32
+  #include <winsock2.h>
+  #include <afunix.h>
+  #pragma comment(lib, "ws2_32.lib")
+#else
+  #include <unistd.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+#endif
+#include "queue_thread_safe.h"
+#include "asset_registry.h"
+#include "smt_action.h"
+#include "gop_cache.h"
+
+#ifdef _WIN32
+typedef SOCKET ControlSocket;
+#define INVALID_CONTROL_SOCKET INVALID_SOCKET
+#define CONTROL_SHUTDOWN_BOTH SD_BOTH
+#else
+typedef int ControlSocket;
+#define INVALID_CONTROL_SOCKET -1
+#define CONTROL_SHUTDOWN_BOTH SHUT_RDWR
+#endif
+
+// Operator command for the SMT producer
+struct SMTCommand {
+  SMTAction action;             // type, id, fields, placement, visible
+  std::string asset;            // ADD_IMAGE only
+  int delayMs = 0;              // on top of the producer lead time
+};
+
+// Local control interface of the SMT producer: an AF_UNIX stream socket (also available on Windows 10+)
+// taking line-delimited commands, one reply line per command:
+//   show <asset> [id=<n>] [x=<%>] [y=<%>] [w=<%>] [h=<%>] [z=<n>] [opacity=<0..1>] [delay=<ms>]
+//   update <id> [x=<%>] [y=<%>] [w=<%>] [h=<%>] [z=<n>] [opacity=<0..1>] [visible=<0|1>] [delay=<ms>]
+//   text [id=<n>] [font=<n>] [color=<[AA]RRGGBB>] [scroll=<%/s>] [placement options] -- <text>
+//   update_text <id> [font=<n>] [color=<[AA]RRGGBB>] [scroll=<%/s>] [placement options] [-- <text>]
+//   hide <id> [delay=<ms>]      removes an image or text layer
+//   join [<program>]          join burst from the GOP cache of one program, or of all of them
+//   list
+// Replies are "ok [...]" or "error <reason>". Parsed commands are pushed to the producer queue;
+// the trigger path never touches the disk.
+class ControlChannel {
+public:
+  ControlChannel(const std::string &_path, const AssetRegistry &_assets, ThreadSafeQueue<SMTCommand> &_commands, JoinBurstRequests *_joinRequests = nullptr)
+  :path_(_path)
+  ,assets_(_assets)
+  ,commands_(_commands)
+  ,joinRequests_(_joinRequests)
+  {
+  }
+
+  ~ControlChannel() {
+    close();
+  }
+
+  bool open() {
+    listenfd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenfd_ == INVALID_CONTROL_SOCKET) {
+      std::cerr << "Error creating control socket" << std::endl;
+      return false;
+    }
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if(path_.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "Control socket path too long: " << path_ << std::endl;
+      return false;
+    }
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+
+    // stale socket file from a previous run
+#ifdef _WIN32
+    DeleteFileA(path_.c_str());
+#else
+    unlink(path_.c_str());
+#endif
+    if(bind(listenfd_, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listenfd_, 4) != 0) {
+      std::cerr << "Couldn't listen on control socket " << path_ << std::endl;
+      closeSocket(listenfd_);
+      return false;
+    }
+
+    running_ = true;
+    thread_ = std::thread(&ControlChannel::acceptLoop, this);
+    std::cout << "SMT control channel listening on " << path_ << std::endl;
+    return true;
+  }
+
+  void close() {
+    if(!running_) {
+      return;
+    }
+    running_ = false;
+    // wake the accept up; the listening socket is only closed once the thread is done with it
+#ifdef _WIN32
+    wakeAccept();
+#else
+    shutdown(listenfd_, SHUT_RDWR);
+#endif
+    // a connected client may be idle: wake the recv serving it
+    {
+      std::lock_guard<std::mutex> lock(clientMutex_);
+      if(clientfd_ != INVALID_CONTROL_SOCKET) {
+        shutdown(clientfd_, CONTROL_SHUTDOWN_BOTH);
+      }
+    }
+    if(thread_.joinable()) {
+      thread_.join();
+    }
+    closeSocket(listenfd_);
+#ifdef _WIN32
+    DeleteFileA(path_.c_str());
+#else
+    unlink(path_.c_str());
+#endif
+  }
+
+protected:
+  static void closeSocket(ControlSocket &_socket) {
+    if(_socket == INVALID_CONTROL_SOCKET) {
+      return;
+    }
+#ifdef _WIN32
+    closesocket(_socket);
+#else
+    ::close(_socket);
+#endif
+    _socket = INVALID_CONTROL_SOCKET;
+  }
+
+#ifdef _WIN32
+  // shutdown doesn't interrupt accept on Windows: a connection of our own does
+  void wakeAccept() {
+    ControlSocket wake = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(wake == INVALID_CONTROL_SOCKET) {
+      return;
+    }
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+    connect(wake, (struct sockaddr *) &addr, sizeof(addr));
+    closeSocket(wake);
+  }
+#endif
+
+  void acceptLoop() {
+    while(running_) {
+      ControlSocket client = accept(listenfd_, nullptr, nullptr);
+      if(client == INVALID_CONTROL_SOCKET) {
+        continue;
+      }
+      {
+        // close() shuts the client down from now on; past it, running_ is already false
+        std::lock_guard<std::mutex> lock(clientMutex_);
+        clientfd_ = client;
+      }
+      serve(client);
+      std::lock_guard<std::mutex> lock(clientMutex_);
+      closeSocket(clientfd_);
+    }
+  }
+
+  // one client at a time; commands are short and rare
+  void serve(ControlSocket _client) {
+    std::string pending;
+    char buffer[512];
+    while(running_) {
+      int received = (int) recv(_client, buffer, sizeof(buffer), 0);
+      if(received <= 0) {
+        return;
+      }
+      pending.append(buffer, received);
+
+      size_t end;
+      while((end = pending.find('\n')) != std::string::npos) {
+        std::string line = pending.substr(0, end);
+        pending.erase(0, end + 1);
+        if(!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+        if(line.empty()) {
+          continue;
+        }
+        std::string reply = handle(line) + "\n";
+        send(_client, reply.c_str(), (int) reply.size(), 0);
+      }
+      if(pending.size() > 4096) {
+        return;
+      }
+    }
+  }
+
+  std::string handle(const std::string &_line) {
+    // text commands: the string follows " -- ", spaces included
+    std::string line = _line;
+    std::string text;
+    bool hasText = false;
+    size_t separator = line.find(" -- ");
+    if(separator != std::string::npos) {
+      text = line.substr(separator + 4);
+      line = line.substr(0, separator);
+      hasText = true;
+    }
+    std::istringstream tokens(line);
+    std::string verb;
+    tokens >> verb;
+
+    if(verb == "list") {
+      std::string reply = "ok";
+      for(const std::string &name : assets_.names()) {
+        reply += " " + name;
+      }
+      return reply;
+    }
+
+    if(verb == "join") {
+      if(!joinRequests_) {
+        return "error join bursts not available";
+      }
+      std::string program;
+      int programIndex = (tokens >> program) ? atoi(program.c_str()) : -1;
+      joinRequests_->request(programIndex);
+      return "ok";
+    }
+
+    if(verb != "show" && verb != "update" && verb != "hide" && verb != "text" && verb != "update_text") {
+      return "error unknown command " + verb;
+    }
+
+    SMTCommand command;
+    std::string target;
+    if(verb != "text" && !(tokens >> target)) {
+      return "error missing argument";
+    }
+    if(verb == "show") {
+      command.action.type = SMT_ACTION_ADD_IMAGE;
+      command.asset = target;
+      if(!assets_.find(target)) {
+        return "error unknown asset " + target;
+      }
+      command.action.id = nextId_++;
+      // full placement, overridden below by explicit options
+      command.action.fields = SMT_FIELD_X | SMT_FIELD_Y | SMT_FIELD_WIDTH | SMT_FIELD_HEIGHT | SMT_FIELD_Z_ORDER | SMT_FIELD_OPACITY;
+      command.action.placement.xPercentage = 10.0;
+      command.action.placement.yPercentage = 20.0;
+      command.action.placement.widthPercentage = 15.0;
+      command.action.placement.heightPercentage = 10.0;
+    }
+    else if(verb == "text") {
+      if(!hasText) {
+        return "error missing text";
+      }
+      command.action.type = SMT_ACTION_ADD_TEXT;
+      command.action.id = nextId_++;
+      // full placement and style, a lower third band by default
+      command.action.fields = SMT_FIELD_X | SMT_FIELD_Y | SMT_FIELD_WIDTH | SMT_FIELD_HEIGHT | SMT_FIELD_Z_ORDER | SMT_FIELD_OPACITY | SMT_FIELD_FONT | SMT_FIELD_COLOR | SMT_FIELD_SCROLL;
+      command.action.placement.xPercentage = 5.0;
+      command.action.placement.yPercentage = 85.0;
+      command.action.placement.widthPercentage = 90.0;
+      command.action.placement.heightPercentage = 6.0;
+    }
+    else {
+      command.action.type = (verb == "update") ? SMT_ACTION_UPDATE_IMAGE : (verb == "update_text") ? SMT_ACTION_UPDATE_TEXT : SMT_ACTION_REMOVE_IMAGE;
+      command.action.id = strtoull(target.c_str(), nullptr, 10);
+      if(command.action.id == 0) {
+        return "error invalid id " + target;
+      }
+    }
+
+    bool isText = command.action.type == SMT_ACTION_ADD_TEXT || command.action.type == SMT_ACTION_UPDATE_TEXT;
+    if(hasText) {
+      if(!isText) {
+        return "error unexpected text";
+      }
+      if(text.size() > SMT_TEXT_MAX_SIZE) {
+        return "error text too long";
+      }
+      command.action.text.text = text;
+      command.action.fields |= SMT_FIELD_TEXT;
+    }
+
+    std::string option;
+    while(tokens >> option) {
+      size_t eq = option.find('=');
+      if(eq == std::string::npos) {
+        return "error invalid option " + option;
+      }
+      std::string key = option.substr(0, eq);
+      double value = atof(option.c_str() + eq + 1);
+      if(key == "id" && (command.action.type == SMT_ACTION_ADD_IMAGE || command.action.type == SMT_ACTION_ADD_TEXT)) {
+        char *end = nullptr;
+        command.action.id = strtoull(option.c_str() + eq + 1, &end, 10);
+        if(end == option.c_str() + eq + 1 || *end || command.action.id == 0) {
+          return "error invalid id " + option;
+        }
+      }
+      else if(key == "delay") {
+        command.delayMs = (int) value;
+      }
+      else if(command.action.type == SMT_ACTION_REMOVE_IMAGE) {
+        return "error invalid option " + option;
+      }
+      else if(key == "x") { command.action.placement.xPercentage = value; command.action.fields |= SMT_FIELD_X; }
+      else if(key == "y") { command.action.placement.yPercentage = value; command.action.fields |= SMT_FIELD_Y; }
+      else if(key == "w") { command.action.placement.widthPercentage = value; command.action.fields |= SMT_FIELD_WIDTH; }
+      else if(key == "h") { command.action.placement.heightPercentage = value; command.action.fields |= SMT_FIELD_HEIGHT; }
+      else if(key == "z") { command.action.placement.zOrder = (int) value; command.action.fields |= SMT_FIELD_Z_ORDER; }
+      else if(key == "opacity") { command.action.placement.opacity = (uint8_t) (std::min(std::max(value, 0.0), 1.0) * 255.0 + 0.5); command.action.fields |= SMT_FIELD_OPACITY; }
+      else if(key == "visible") { command.action.visible = value != 0; command.action.fields |= SMT_FIELD_VISIBLE; }
+      else if(key == "font" && isText) { command.action.text.fontId = (uint16_t) value; command.action.fields |= SMT_FIELD_FONT; }
+      else if(key == "scroll" && isText) { command.action.text.scrollSpeed = (float) value; command.action.fields |= SMT_FIELD_SCROLL; }
+      else if(key == "color" && isText) {
+        if(!parseSMTColor(option.substr(eq + 1), command.action.text.color)) {
+          return "error invalid color " + option;
+        }
+        command.action.fields |= SMT_FIELD_COLOR;
+      }
+      else {
+        return "error invalid option " + option;
+      }
+    }
+
+    commands_.push(command);
+    return "ok " + std::to_string(command.action.id);
+  }
+
+protected:
+  std::string path_;
+  const AssetRegistry &assets_;
+  ThreadSafeQueue<SMTCommand> &commands_;
+  JoinBurstRequests *joinRequests_ = nullptr;
+  ControlSocket listenfd_ = INVALID_CONTROL_SOCKET;
+  ControlSocket clientfd_ = INVALID_CONTROL_SOCKET;   // client being served, for close()
+  std::mutex clientMutex_;
+  std::thread thread_;
+  std::atomic<bool> running_ = false;
+  uint64_t nextId_ = 1;
+};
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <new>
+#include "block_trace.h"
 
 // Define the sync value (magic number)
 // This should be a unique constant that will be easily recognizable by the receiver
@@ -14,8 +19,18 @@ enum EssenceType {
   ESSENCE_TYPE_NULL = 1,       // Null packet
   ESSENCE_TYPE_SMT = 2,        // Stream Manipulation Table
   ESSENCE_TYPE_EA = 3,         // Essence announcement
+  ESSENCE_TYPE_JOIN = 4,       // Join burst: cached copy of essence data, only for receivers that are joining
 };
 
+// Essence block flags
+#define ESSENCE_FLAG_KEY 0x01          // random access point (AV_PKT_FLAG_KEY)
+#define ESSENCE_FLAG_DISPOSABLE 0x02   // not used as a reference, can be dropped (AV_PKT_FLAG_DISPOSABLE)
+#define ESSENCE_FLAG_PTS 0x04          // pts is valid
+#define ESSENCE_FLAG_SEQUENCED 0x80    // sequence and key flag are valid (essence data of current senders)
+
+// Header size before flags and sequence were added
+#define ESSENCE_BLOCK_HEADER_SIZE_V0 24
+
 #pragma pack(push, 1) 
 
 // Define the block structure for streaming
@@ -28,15 +43,33 @@ struct EssenceBlock {
   uint8_t stream_index;   // Which stream this block belongs to
   uint64_t timestamp;     // Timestamp of the block
   uint32_t payload_size;  // Size of the payload
+  uint8_t flags;          // ESSENCE_FLAG_*
+  uint8_t reserved;
+  uint16_t sequence;      // per program stream counter, gaps mean lost blocks
+  int64_t pts;            // source PTS, in the stream time_base of the EA (the timestamp is the muxer send clock)
 };
 
 #pragma pack(pop)
 
-// Alloc essence block
+// Reference count of a block allocated by createEssenceBlock, in memory in front of its BlockTrace
+struct EssenceBlockRefs {
+  std::atomic<uint32_t> count;
+  uint32_t reserved;
+};
+
+// Alloc essence block (preceded in memory by its reference count and BlockTrace). One reference
 __inline EssenceBlock* createEssenceBlock(int _payloadSize) {
-  EssenceBlock* essenceBlock = (EssenceBlock*) (new uint8_t[_payloadSize + sizeof(EssenceBlock)]);
+  uint8_t *memory = new uint8_t[sizeof(EssenceBlockRefs) + sizeof(BlockTrace) + sizeof(EssenceBlock) + _payloadSize];
+  new (memory) EssenceBlockRefs{ { 1 }, 0 };
+  memory += sizeof(EssenceBlockRefs);
+  memset(memory, 0, sizeof(BlockTrace));
+  EssenceBlock* essenceBlock = (EssenceBlock*) (memory + sizeof(BlockTrace));
   essenceBlock->sync = SYNC_MAGIC_NUMBER;
   essenceBlock->size = sizeof(EssenceBlock);
+  essenceBlock->flags = 0;
+  essenceBlock->reserved = 0;
+  essenceBlock->sequence = 0;
+  essenceBlock->pts = 0;
   uint8_t* payload = (uint8_t*)(essenceBlock + 1);
   memset(payload, 0, _payloadSize);
 
@@ -49,9 +82,59 @@ __inline EssenceBlock * cloneEssenceBlock(EssenceBlock *_block) {
   return block;
 }
 
+// Trace of a block allocated by createEssenceBlock/cloneEssenceBlock (not of received buffers)
+__inline BlockTrace &essenceBlockTrace(EssenceBlock *_block) {
+  return *(BlockTrace *) ((uint8_t *) _block - sizeof(BlockTrace));
+}
+
+__inline void traceStamp(EssenceBlock *_block, TraceStage _stage) {
+  essenceBlockTrace(_block).stamps[_stage] = traceNow();
+}
+
 __inline void destroyEssenceBlock(EssenceBlock **_block) {
   if(*_block) {
-    delete[] * _block;
+    delete[] ((uint8_t *) *_block - sizeof(BlockTrace) - sizeof(EssenceBlockRefs));
+  }
+  *_block = nullptr;
+}
+
+// Shared ownership, for blocks handed to several threads: every extra holder retains the block and
+// releases it when done, the last release frees it. A sole owner may still just destroy it
+__inline EssenceBlock *retainEssenceBlock(EssenceBlock *_block) {
+  ((EssenceBlockRefs *) ((uint8_t *) _block - sizeof(BlockTrace) - sizeof(EssenceBlockRefs)))->count.fetch_add(1, std::memory_order_relaxed);
+  return _block;
+}
+
+__inline void releaseEssenceBlock(EssenceBlock **_block) {
+  if(*_block) {
+    EssenceBlockRefs *refs = (EssenceBlockRefs *) ((uint8_t *) *_block - sizeof(BlockTrace) - sizeof(EssenceBlockRefs));
+    if(refs->count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      destroyEssenceBlock(_block);
+    }
   }
   *_block = nullptr;
 }
+
+// Received block in the current header layout. Blocks with another header size (older senders)
+// are copied to _scratch with the missing fields cleared; current blocks are used in place.
+// Null if _data does not start with a complete block
+__inline EssenceBlock *readEssenceBlock(uint8_t *_data, size_t _size, std::vector<uint8_t> &_scratch) {
+  if(_size < ESSENCE_BLOCK_HEADER_SIZE_V0) {
+    return nullptr;
+  }
+  EssenceBlock *block = (EssenceBlock *) _data;
+  if(block->sync != SYNC_MAGIC_NUMBER || block->size < ESSENCE_BLOCK_HEADER_SIZE_V0 || (uint64_t) block->size + block->payload_size > _size) {
+    return nullptr;
+  }
+  if(block->size == sizeof(EssenceBlock)) {
+    return block;
+  }
+
+  size_t headerSize = block->size < sizeof(EssenceBlock) ? block->size : sizeof(EssenceBlock);
+  _scratch.assign(sizeof(EssenceBlock) + block->payload_size, 0);
+  memcpy(_scratch.data(), _data, headerSize);
+  memcpy(_scratch.data() + sizeof(EssenceBlock), _data + block->size, block->payload_size);
+  block = (EssenceBlock *) _scratch.data();
+  block->size = sizeof(EssenceBlock);
+  return block;
+}
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "queue_thread_safe.h"
+#include "latency_histogram.h"
+
+#define TIMER_WHEEL_TICK_US 1000      // slot width; deadlines themselves are kept exact
+#define TIMER_WHEEL_SLOT_BITS 6       // 64 slots per level
+#define TIMER_WHEEL_LEVELS 4          // 64^4 ticks, ~4.6 hours at 1 ms; later timers are cascaded again
+#define TIMER_WHEEL_SLOTS (1ull << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+typedef uint64_t TimerId;
+
+// Hierarchical timer wheel (Varghese & Lauck). Level 0 holds the next 64 ticks, each higher level
+// 64 times the span of the one below and is cascaded down as the wheel turns, so adding, cancelling
+// and expiring are O(1) however many timers there are. Cancelled timers are dropped lazily from their
+// slot. Not thread safe: EventLoop serializes access
+class TimerWheel {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  // Shared by a timer and the expired batches it is in: cancelling it flags the batches too
+  struct Callback {
+    std::function<void()> function;
+    std::atomic<bool> cancelled = false;
+  };
+
+  struct Expired {
+    std::shared_ptr<Callback> callback;
+    clock::time_point deadline;
+  };
+
+  TimerWheel(clock::time_point _epoch = clock::now())
+  :epoch_(_epoch)
+  {
+    for(auto &level : slots_) {
+      level.resize(TIMER_WHEEL_SLOTS);
+    }
+  }
+
+  // _period > 0 repeats the timer, each deadline _period after the previous one
+  TimerId add(clock::time_point _deadline, std::function<void()> _callback, clock::duration _period = clock::duration::zero()) {
+    TimerId id = nextId_++;
+    Timer &timer = timers_[id];
+    timer.deadline = _deadline;
+    timer.period = _period;
+    timer.callback = std::make_shared<Callback>();
+    timer.callback->function = std::move(_callback);
+    insert(id, _deadline);
+    return id;
+  }
+
+  // A timer already expired but whose callback has not run yet (see clearExpired) is cancelled too
+  bool cancel(TimerId _id) {
+    auto it = timers_.find(_id);
+    if(it != timers_.end()) {
+      it->second.callback->cancelled = true;
+      timers_.erase(it);
+      return true;
+    }
+    auto fired = fired_.find(_id);
+    if(fired != fired_.end()) {
+      fired->second->cancelled = true;
+      fired_.erase(fired);
+      return true;
+    }
+    return false;
+  }
+
+  // The callbacks of the last expire() have run: its one shot timers can't be cancelled any more
+  void clearExpired() {
+    fired_.clear();
+  }
+
+  bool empty() const {
+    return timers_.empty();
+  }
+
+  size_t size() const {
+    return timers_.size();
+  }
+
+  // When the wheel next has to turn: the earliest level 0 deadline, or the next cascade of a higher level
+  clock::time_point nextDeadline() const {
+    if(timers_.empty()) {
+      return clock::time_point::max();
+    }
+    for(uint64_t tick = tick_; tick < tick_ + TIMER_WHEEL_SLOTS; tick++) {
+      clock::time_point earliest = clock::time_point::max();
+      for(TimerId id : slots_[0][tick & TIMER_WHEEL_MASK]) {
+        auto it = timers_.find(id);
+        if(it != timers_.end()) {
+          earliest = std::min(earliest, it->second.deadline);
+        }
+      }
+      if(earliest != clock::time_point::max()) {
+        return std::min(earliest, cascadeTime());
+      }
+    }
+    return cascadeTime();
+  }
+
+  // Callbacks of the timers due at _now, in deadline order per slot. Periodic timers are rescheduled
+  // before their callback runs, so a callback may cancel its own timer
+  void expire(clock::time_point _now, std::vector<Expired> &_expired) {
+    uint64_t now = tickOf(_now);
+    if(timers_.empty()) {
+      // nothing to turn: skip ahead
+      tick_ = std::max(tick_, now);
+      cascaded_ = tick_;
+      return;
+    }
+    while(true) {
+      if(cascaded_ != tick_) {
+        cascade();
+        cascaded_ = tick_;
+      }
+      std::vector<TimerId> &slot = slots_[0][tick_ & TIMER_WHEEL_MASK];
+      std::vector<TimerId> due;
+      for(size_t i = 0; i < slot.size();) {
+        auto it = timers_.find(slot[i]);
+        if(it == timers_.end()) {
+          slot[i] = slot.back();
+          slot.pop_back();
+        }
+        else if(it->second.deadline <= _now) {
+          due.push_back(slot[i]);
+          slot[i] = slot.back();
+          slot.pop_back();
+        }
+        else {
+          i++;
+        }
+      }
+      std::sort(due.begin(), due.end(), [this](TimerId _a, TimerId _b) { return timers_[_a].deadline < timers_[_b].deadline; });
+      for(TimerId id : due) {
+        Timer &timer = timers_[id];
+        _expired.push_back({ timer.callback, timer.deadline });
+        if(timer.period > clock::duration::zero()) {
+          // drift free; a loop that fell more than a period behind skips the missed runs
+          timer.deadline += timer.period;
+          if(timer.deadline <= _now) {
+            timer.deadline = _now + timer.period;
+          }
+          insert(id, timer.deadline);
+        }
+        else {
+          fired_[id] = timer.callback;
+          timers_.erase(id);
+        }
+      }
+      if(tick_ >= now) {
+        break;
+      }
+      tick_++;
+    }
+  }
+
+protected:
+  struct Timer {
+    clock::time_point deadline;
+    clock::duration period;
+    std::shared_ptr<Callback> callback;
+  };
+
+  uint64_t tickOf(clock::time_point _time) const {
+    if(_time <= epoch_) {
+      return 0;
+    }
+    if(_time == clock::time_point::max()) {
+      return UINT64_MAX;
+    }
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(_time - epoch_).count() / TIMER_WHEEL_TICK_US;
+  }
+
+  clock::time_point timeOf(uint64_t _tick) const {
+    return epoch_ + std::chrono::microseconds(_tick * TIMER_WHEEL_TICK_US);
+  }
+
+  // Level by distance from the current tick; level 0 slots are absolute ticks mod 64, level n slots
+  // ticks >> 6n mod 64. Past deadlines go to the current slot, beyond the top level to its last slot
+  void insert(TimerId _id, clock::time_point _deadline) {
+    uint64_t tick = std::max(tickOf(_deadline), tick_);
+    uint64_t delta = tick - tick_;
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+      uint64_t span = 1ull << (TIMER_WHEEL_SLOT_BITS * (level + 1));
+      if(delta < span || level == TIMER_WHEEL_LEVELS - 1) {
+        if(delta >= span) {
+          tick = tick_ + span - 1;
+        }
+        slots_[level][(tick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_MASK].push_back(_id);
+        return;
+      }
+    }
+  }
+
+  // Entering a new block of 64^n ticks moves the matching level n slot down, highest level first
+  void cascade() {
+    for(int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      uint64_t shift = TIMER_WHEEL_SLOT_BITS * level;
+      if(tick_ & ((1ull << shift) - 1)) {
+        continue;
+      }
+      std::vector<TimerId> moved;
+      moved.swap(slots_[level][(tick_ >> shift) & TIMER_WHEEL_MASK]);
+      for(TimerId id : moved) {
+        auto it = timers_.find(id);
+        if(it != timers_.end()) {
+          insert(id, it->second.deadline);
+        }
+      }
+    }
+  }
+
+  // Start of the next level 1 block, if anything waits on higher levels
+  clock::time_point cascadeTime() const {
+    for(int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      for(const std::vector<TimerId> &slot : slots_[level]) {
+        if(!slot.empty()) {
+          return timeOf((tick_ | TIMER_WHEEL_MASK) + 1);
+        }
+      }
+    }
+    return clock::time_point::max();
+  }
+
+protected:
+  clock::time_point epoch_;
+  uint64_t tick_ = 0;                  // current tick, slots of earlier ticks are empty
+  uint64_t cascaded_ = UINT64_MAX;     // tick the higher levels were last cascaded for
+  TimerId nextId_ = 1;
+  std::unordered_map<TimerId, Timer> timers_;
+  std::unordered_map<TimerId, std::shared_ptr<Callback>> fired_;   // one shot timers of the last expire()
+  std::vector<std::vector<TimerId>> slots_[TIMER_WHEEL_LEVELS];
+};
+
+// Event loop shared by the components of a thread: timers on a TimerWheel, tasks posted from other
+// threads and ThreadSafeQueues whose pushes wake it. It sleeps until the next deadline or event, so
+// an idle loop costs no CPU. Timers, tasks and queue handlers all run on the thread in run();
+// everything else may be called from any thread
+class EventLoop {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  TimerId addTimer(clock::duration _delay, std::function<void()> _callback, clock::duration _period = clock::duration::zero()) {
+    return addTimerAt(clock::now() + _delay, std::move(_callback), _period);
+  }
+
+  TimerId addTimerAt(clock::time_point _deadline, std::function<void()> _callback, clock::duration _period = clock::duration::zero()) {
+    TimerId id;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      id = wheel_.add(_deadline, std::move(_callback), _period);
+    }
+    // the loop thread itself looks at the wheel before it sleeps again
+    if(std::this_thread::get_id() != thread_.load(std::memory_order_relaxed)) {
+      wake();
+    }
+    return id;
+  }
+
+  bool cancelTimer(TimerId _id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return wheel_.cancel(_id);
+  }
+
+  // Run _task on the loop thread
+  void post(std::function<void()> _task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      posted_.push_back(std::move(_task));
+    }
+    wake();
+  }
+
+  // Values pushed to _queue are handed to _handler on the loop thread. Register before run(); the
+  // queue wakes the loop while run() is on. Once all queues of a loop are closed and drained, run() returns
+  template<typename T>
+  void addQueue(ThreadSafeQueue<T> &_queue, std::function<void(T &)> _handler) {
+    Source source;
+    source.processOne = [&_queue, _handler]() {
+      T value;
+      if(!_queue.tryPop(value)) {
+        return false;
+      }
+      _handler(value);
+      return true;
+    };
+    source.finished = [&_queue]() { return _queue.isClosed() && _queue.empty(); };
+    source.attach = [this, &_queue](bool _attach) {
+      if(_attach) {
+        _queue.setListener([this]() { wake(); });
+      }
+      else {
+        _queue.setListener(nullptr);
+      }
+    };
+    sources_.push_back(std::move(source));
+  }
+
+  // Timer wakeups later than their deadline are recorded here
+  void setWakeupHistogram(LatencyHistogram *_histogram) {
+    wakeupDelay_ = _histogram;
+  }
+
+  // Runs until stop(), or until every queue is closed. Queued values are handled before it returns
+  void run() {
+    thread_ = std::this_thread::get_id();
+    for(auto &source : sources_) {
+      source.attach(true);
+    }
+    std::vector<TimerWheel::Expired> expired;
+    std::deque<std::function<void()>> posted;
+    while(true) {
+      // timers and posted tasks, run outside the lock so they can add and cancel timers
+      auto now = clock::now();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wheel_.expire(now, expired);
+        posted.swap(posted_);
+      }
+      for(TimerWheel::Expired &timer : expired) {
+        // cancelled by an earlier callback of this batch
+        if(timer.callback->cancelled) {
+          continue;
+        }
+        if(wakeupDelay_) {
+          wakeupDelay_->record((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now - timer.deadline).count());
+        }
+        timer.callback->function();
+      }
+      if(!expired.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wheel_.clearExpired();
+      }
+      expired.clear();
+      for(auto &task : posted) {
+        task();
+      }
+      posted.clear();
+
+      // one value per queue per round, so timers keep their deadlines under load
+      bool busy = false;
+      bool finished = !sources_.empty();
+      for(auto &source : sources_) {
+        busy |= source.processOne();
+        finished &= source.finished();
+      }
+      if(busy) {
+        continue;
+      }
+      if(finished) {
+        break;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      if(!posted_.empty()) {
+        continue;
+      }
+      if(stop_) {
+        break;
+      }
+      clock::time_point deadline = wheel_.nextDeadline();
+      auto ready = [this] { return woken_ || stop_; };
+      if(deadline == clock::time_point::max()) {
+        wakeup_.wait(lock, ready);
+      }
+      else {
+        wakeup_.wait_until(lock, deadline, ready);
+      }
+      woken_ = false;
+    }
+    for(auto &source : sources_) {
+      source.attach(false);
+    }
+    thread_ = std::thread::id();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+  }
+
+  // Makes run() return once the queues are drained. Safe from any thread, not from a signal handler
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wakeup_.notify_all();
+  }
+
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      woken_ = true;
+    }
+    wakeup_.notify_all();
+  }
+
+protected:
+  struct Source {
+    std::function<bool()> processOne;
+    std::function<bool()> finished;
+    std::function<void(bool)> attach;
+  };
+
+protected:
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  bool woken_ = false;
+  bool stop_ = false;
+  std::atomic<std::thread::id> thread_;
+  TimerWheel wheel_;
+  std::deque<std::function<void()>> posted_;
+  std::vector<Source> sources_;
+  LatencyHistogram *wakeupDelay_ = nullptr;
+};
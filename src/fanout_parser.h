@@ -0,0 +1,268 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include "essence_block.h"
+#include "parser_base.h"
+#include "metrics_registry.h"
+#include "thread_placement.h"
+
+#define FANOUT_DEFAULT_MAX_QUEUED 256
+
+// What a consumer that can't keep up loses
+enum FanoutDropPolicy {
+  FANOUT_BLOCK = 0,        // nothing: the reader waits for room, and so do the other consumers
+  FANOUT_DROP_NEWEST,      // incoming blocks until there is room again
+  FANOUT_DROP_OLDEST,      // the oldest queued blocks, so the consumer stays current
+};
+
+__inline const char *fanoutDropPolicyName(FanoutDropPolicy _policy) {
+  static const char *names[] = { "block", "drop_newest", "drop_oldest" };
+  return _policy <= FANOUT_DROP_OLDEST ? names[_policy] : "unknown";
+}
+
+__inline bool parseFanoutDropPolicy(const std::string &_name, FanoutDropPolicy &_policy) {
+  for(int policy = FANOUT_BLOCK; policy <= FANOUT_DROP_OLDEST; policy++) {
+    if(_name == fanoutDropPolicyName((FanoutDropPolicy) policy)) {
+      _policy = (FanoutDropPolicy) policy;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct FanoutConsumerParams {
+  std::string name;                              // metrics label
+  FanoutDropPolicy policy = FANOUT_DROP_OLDEST;
+  size_t maxQueued = FANOUT_DEFAULT_MAX_QUEUED;  // blocks waiting for the consumer
+  ThreadRole role = THREAD_ROLE_CONSUMER;
+};
+
+// Consumer as configured: "<name>[=<argument>][/<policy>[:<max queued>]]", e.g. "record=out.ebs/drop_newest:1024"
+struct FanoutConsumerSpec {
+  std::string name;
+  std::string argument;
+  bool policySet = false;
+  FanoutConsumerParams params;
+};
+
+// Consumer specs separated by ';'. Policies left out stay at the caller's default for the consumer
+__inline bool parseFanoutConsumers(const std::string &_spec, std::vector<FanoutConsumerSpec> &_consumers) {
+  std::stringstream entries(_spec);
+  std::string entry;
+  while(std::getline(entries, entry, ';')) {
+    if(entry.empty()) {
+      continue;
+    }
+    FanoutConsumerSpec consumer;
+    size_t equals = entry.find('=');
+    size_t slash = entry.rfind('/');
+    if(slash != std::string::npos && (equals == std::string::npos || slash > equals)) {
+      std::string policy = entry.substr(slash + 1);
+      size_t colon = policy.find(':');
+      consumer.params.maxQueued = colon != std::string::npos ? (size_t) atoi(policy.c_str() + colon + 1) : FANOUT_DEFAULT_MAX_QUEUED;
+      if(parseFanoutDropPolicy(policy.substr(0, colon), consumer.params.policy) && consumer.params.maxQueued > 0) {
+        consumer.policySet = true;
+        entry.resize(slash);
+      }
+      else if(equals == std::string::npos) {
+        return false;
+      }
+      else {
+        // a path with '/' in the argument
+        consumer.params.maxQueued = FANOUT_DEFAULT_MAX_QUEUED;
+      }
+    }
+    consumer.name = entry.substr(0, equals);
+    if(equals != std::string::npos) {
+      consumer.argument = entry.substr(equals + 1);
+    }
+    if(consumer.name.empty()) {
+      return false;
+    }
+    consumer.params.name = consumer.name;
+    _consumers.push_back(consumer);
+  }
+  return true;
+}
+
+// Hands every received block to several parsers (renderer, recorder, analyzer), each on its own
+// thread and at its own pace. The reader's block only lives for the parse call, so it is copied
+// once into a reference counted block that all consumers share; the last one done with it frees
+// it. Announcements and SMT tables are never dropped: they are small, and a consumer missing one
+// is wrong until the next carousel copy
+class FanoutParser : public ParserBase {
+public:
+  ~FanoutParser() {
+    close();
+  }
+
+  // Consumers are added before open. _parser is only called from the consumer's thread
+  void addConsumer(ParserBase *_parser, const FanoutConsumerParams &_params) {
+    consumers_.emplace_back(new Consumer(_parser, _params));
+  }
+
+  bool open() {
+    for(auto &consumer : consumers_) {
+      consumer->start();
+    }
+    return true;
+  }
+
+  // Closes the consumer queues: each consumer parses what it still has queued, then its thread ends.
+  // Call once the reader stopped calling parse
+  bool close() {
+    for(auto &consumer : consumers_) {
+      consumer->stop();
+    }
+    return true;
+  }
+
+  int parse(EssenceBlock *_block) {
+    if(consumers_.empty()) {
+      return 0;
+    }
+    EssenceBlock *shared = cloneEssenceBlock(_block);
+    bool essential = _block->essence_type == ESSENCE_TYPE_EA || _block->essence_type == ESSENCE_TYPE_SMT;
+    for(auto &consumer : consumers_) {
+      consumer->push(retainEssenceBlock(shared), essential);
+    }
+    releaseEssenceBlock(&shared);
+    return (int) (_block->size + _block->payload_size);
+  }
+
+protected:
+  class Consumer {
+  public:
+    Consumer(ParserBase *_parser, const FanoutConsumerParams &_params)
+    :parser_(_parser)
+    ,params_(_params)
+    ,blocks_(globalMetrics().counter("fanout_blocks_total", metricLabel("consumer", _params.name), "Blocks parsed by a fan-out consumer"))
+    ,dropped_(globalMetrics().counter("fanout_dropped_blocks_total", metricLabel("consumer", _params.name), "Blocks a lagging fan-out consumer dropped"))
+    ,queued_(globalMetrics().gauge("fanout_queued_blocks", metricLabel("consumer", _params.name), "Blocks waiting for a fan-out consumer"))
+    ,queueLatency_(globalMetrics().histogram("fanout_queue_seconds", metricLabel("consumer", _params.name), "Time blocks wait for a fan-out consumer"))
+    {
+      params_.maxQueued = std::max<size_t>(params_.maxQueued, 1);
+    }
+
+    void start() {
+      stop_ = false;
+      thread_ = std::thread(&Consumer::run, this);
+    }
+
+    void stop() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      ready_.notify_all();
+      space_.notify_all();
+      if(thread_.joinable()) {
+        thread_.join();
+      }
+      // only left if the consumer never started
+      std::lock_guard<std::mutex> lock(mutex_);
+      for(Entry &entry : queue_) {
+        releaseEssenceBlock(&entry.block);
+      }
+      queue_.clear();
+      queued_.set(0);
+    }
+
+    // Takes over the reference of _block
+    void push(EssenceBlock *_block, bool _essential) {
+      EssenceBlock *dropped = nullptr;
+      bool accepted;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        accepted = !stop_;
+        if(accepted && queue_.size() >= params_.maxQueued && !_essential) {
+          if(params_.policy == FANOUT_BLOCK) {
+            space_.wait(lock, [this] { return queue_.size() < params_.maxQueued || stop_; });
+            accepted = !stop_;
+          }
+          else if(params_.policy == FANOUT_DROP_NEWEST) {
+            accepted = false;
+            dropped_++;
+          }
+          else {
+            auto oldest = std::find_if(queue_.begin(), queue_.end(), [](const Entry &_entry) { return !_entry.essential; });
+            if(oldest != queue_.end()) {
+              dropped = oldest->block;
+              queue_.erase(oldest);
+              dropped_++;
+            }
+          }
+        }
+        if(accepted) {
+          queue_.push_back({ _block, _essential, traceNow() });
+        }
+        queued_.set((int64_t) queue_.size());
+      }
+      if(!accepted) {
+        releaseEssenceBlock(&_block);
+        return;
+      }
+      releaseEssenceBlock(&dropped);
+      ready_.notify_one();
+    }
+
+  protected:
+    struct Entry {
+      EssenceBlock *block;
+      bool essential;
+      uint64_t queuedAt;
+    };
+
+    void run() {
+      placeThread(params_.role);
+      while(true) {
+        Entry entry;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          ready_.wait(lock, [this] { return !queue_.empty() || stop_; });
+          // stopped: drain the queue first
+          if(queue_.empty()) {
+            break;
+          }
+          entry = queue_.front();
+          queue_.pop_front();
+          queued_.set((int64_t) queue_.size());
+        }
+        space_.notify_one();
+        queueLatency_.record(traceNow() - entry.queuedAt);
+        parser_->parse(entry.block);
+        blocks_++;
+        releaseEssenceBlock(&entry.block);
+      }
+    }
+
+  protected:
+    ParserBase *parser_ = nullptr;
+    FanoutConsumerParams params_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable space_;
+    std::deque<Entry> queue_;
+    bool stop_ = false;
+    // metrics
+    Counter &blocks_;
+    Counter &dropped_;
+    Gauge &queued_;
+    LatencyHistogram &queueLatency_;
+  };
+
+protected:
+  std::vector<std::unique_ptr<Consumer>> consumers_;
+};
@@ -2,14 +2,19 @@
 
 #include "essence_block.h"
 #include "queue_thread_safe.h"
+#include "smt_binary.h"
+#include "codec_params_json.h"
+#include "gop_cache.h"
+#include "stream_selector.h"
 #include <iostream>
+#include <chrono>
+#include <vector>
+#include <deque>
 extern "C" {
 #include <libavformat/avformat.h>
 }
 #include <nlohmann/json.hpp>
 
-#define MAX_ESSENCE_PAYLOAD_SIZE 1024 * 1024 * 4
-
 // Function to announce the block's metadata information (header)
 void announce_block_info(EssenceBlock *_block) {
   std::string type;
@@ -29,7 +34,7 @@ void announce_block_info(EssenceBlock *_block) {
   std::cout << "Announcing block info: " << "Stream " << (int) _block->stream_index << ", Type: " << type << ", Payload Size: " << _block->payload_size << ", Timestamp: " << _block->timestamp << std::endl;
 }
 
-void setEssenceBlock(EssenceBlock *_block, int _programIndex, AVPacket &_packet, AVStream *_stream) {
+void setEssenceBlock(EssenceBlock *_block, int _programIndex, const AVPacket &_packet, AVStream *_stream) {
   // Set block metadata
   _block->essence_type = EssenceType::ESSENCE_TYPE_ED;
   _block->program_index = _programIndex;
@@ -37,6 +42,18 @@ void setEssenceBlock(EssenceBlock *_block, int _programIndex, AVPacket &_packet,
   _block->stream_type = _stream->codecpar->codec_type;
   _block->timestamp = _packet.pts;
   _block->payload_size = _packet.size;
+  _block->flags = ESSENCE_FLAG_SEQUENCED;
+  if(_packet.flags & AV_PKT_FLAG_KEY) {
+    _block->flags |= ESSENCE_FLAG_KEY;
+  }
+  if(_packet.flags & AV_PKT_FLAG_DISPOSABLE) {
+    _block->flags |= ESSENCE_FLAG_DISPOSABLE;
+  }
+  // the muxer restamps the timestamp with its clock: receivers sync audio and video on this
+  if(_packet.pts != AV_NOPTS_VALUE) {
+    _block->pts = _packet.pts;
+    _block->flags |= ESSENCE_FLAG_PTS;
+  }
 
   // payload
   uint8_t* payload = (uint8_t *)(_block + 1);
@@ -62,104 +79,186 @@ void setEssenceAnnouncementBlock(EssenceBlock* _block, int _programIndex, nlohma
 
 struct FFMPEGProducerParams {
   int programIndex = 0;
+  std::string smtEncoding = SMT_ENCODING_BINARY;   // announced to receivers in the EA
+  int joinBurstPeriodMs = 2000;                    // periodic join burst from the GOP cache (receivers have no back channel), 0 = on request only
+  JoinBurstRequests *joinRequests = nullptr;       // on request join bursts (control channel)
+  int joinBurstMinIntervalMs = 1000;               // requests closer to the last burst wait for the interval, then share one burst
+  int64_t joinBurstBitrate = 0;                    // bits/s a burst adds on top of the program, 0 = sent at once
+  bool joinBursts() const {                        // neither periodic nor on request = no GOP cache at all
+    return joinBurstPeriodMs > 0 || joinRequests;
+  }
+  StreamSelector streams;                          // input streams carried by this program, no rules = all
+  int64_t timestampOffsetMs = 0;                   // shifts this program on the muxer clock (MuxerParams::timestampOffsets)
+  bool logBlocks = true;                           // print every block (costly on live inputs)
 };
 
-void ffmpeg_producer(FFMPEGProducerParams &_params, ThreadSafeQueue<EssenceBlock *> &_queue, const char *_inputFile) {
-  // Initialize FFmpeg libraries
-  avformat_network_init();
-
-  AVFormatContext* formatContext = nullptr;
-
-  // Open the input media file
-  if(avformat_open_input(&formatContext, _inputFile, nullptr, nullptr) < 0) {
-    std::cerr << "Error: Couldn't open input file: " << _inputFile << std::endl;
-    return;
-  }
-
-  // Retrieve stream information
-  if(avformat_find_stream_info(formatContext, nullptr) < 0) {
-    std::cerr << "Error: Couldn't find stream information!" << std::endl;
-    avformat_close_input(&formatContext);
-    return;
-  }
-
-  // Print detailed information about the input file
-  av_dump_format(formatContext, 0, _inputFile, false);
-
-  // build json
-  nlohmann::json stream_info;
-
-  // Iterate through the streams and handle each one
-  for(unsigned int i = 0; i < formatContext->nb_streams; i++) {
-    AVStream* stream = formatContext->streams[i];
-    AVCodecParameters* codecParams = stream->codecpar;
-
-    // Identify stream types (audio, video, subtitle, etc.)
-    switch(codecParams->codec_type) {
-    case AVMEDIA_TYPE_VIDEO:
-      std::cout << "Video stream " << i << std::endl;
-      std::cout << "  Codec: " << avcodec_get_name(codecParams->codec_id) << std::endl;
-      break;
-    case AVMEDIA_TYPE_AUDIO:
-      std::cout << "Audio stream " << i << std::endl;
-      std::cout << "  Codec: " << avcodec_get_name(codecParams->codec_id) << std::endl;
-      break;
-    case AVMEDIA_TYPE_SUBTITLE:
-      std::cout << "Subtitle stream " << i << std::endl;
-      break;
-    default:
-      std::cout << "Unknown stream " << i << std::endl;
-      break;
-    }
+// Stream description for the Essence Announcement
+nlohmann::json streamInfoJson(AVStream *_stream) {
+  AVCodecParameters* codecParams = _stream->codecpar;
 
-    // json
-    nlohmann::json stream_json;
-    stream_json["index"] = stream->index;
-    stream_json["type"] = av_get_media_type_string(codecParams->codec_type) ? av_get_media_type_string(codecParams->codec_type) : "unknown";
-    stream_json["codec"] = avcodec_get_name(codecParams->codec_id);
-    if(codecParams->codec_type == AVMEDIA_TYPE_VIDEO) {
-      stream_json["width"] = codecParams->width;
-      stream_json["height"] = codecParams->height;
-      stream_json["frame_rate"] = av_q2d(stream->r_frame_rate);
-    }
-    else if(codecParams->codec_type == AVMEDIA_TYPE_AUDIO) {
-      stream_json["sample_rate"] = codecParams->sample_rate;
-      stream_json["channels"] = codecParams->ch_layout.nb_channels;
+  nlohmann::json stream_json;
+  stream_json["index"] = _stream->index;
+  stream_json["type"] = av_get_media_type_string(codecParams->codec_type) ? av_get_media_type_string(codecParams->codec_type) : "unknown";
+  stream_json["codec"] = avcodec_get_name(codecParams->codec_id);
+  if(codecParams->codec_type == AVMEDIA_TYPE_VIDEO) {
+    stream_json["width"] = codecParams->width;
+    stream_json["height"] = codecParams->height;
+    stream_json["frame_rate"] = av_q2d(_stream->r_frame_rate);
+  }
+  else if(codecParams->codec_type == AVMEDIA_TYPE_AUDIO) {
+    stream_json["sample_rate"] = codecParams->sample_rate;
+    stream_json["channels"] = codecParams->ch_layout.nb_channels;
+  }
+  stream_json["bit_rate"] = codecParams->bit_rate;
+  stream_json["codecpar"] = codecParametersToJson(codecParams, _stream->time_base);
+  return stream_json;
+}
+
+// One program built from a demuxed input: Essence Announcement, essence data blocks sized to
+// their packet, and the GOP cache for join bursts. Fed by a DemuxSource, which may drive several
+// programs from the same packets
+class FFMPEGProgram {
+public:
+  FFMPEGProgram(const FFMPEGProducerParams &_params, ThreadSafeQueue<EssenceBlock *> &_queue)
+  :params_(_params)
+  ,queue_(_queue)
+  {
+  }
+
+  ~FFMPEGProgram() {
+    destroyEssenceBlock(&EABlock_);
+    clearBurst();
+  }
+
+  // Apply the selection rules to a probed input; before announce()
+  void select(AVFormatContext *_formatContext) {
+    selected_ = params_.streams.select(_formatContext);
+    sequences_.assign(selected_.size(), 0);
+    for(unsigned int i = 0; i < selected_.size(); i++) {
+      if(!selected_[i]) {
+        std::cout << "Program " << params_.programIndex << ": dropping stream " << i << std::endl;
+      }
     }
-    stream_json["bit_rate"] = codecParams->bit_rate;
-    stream_info["streams"].push_back(stream_json);
   }
 
-  stream_info["program_index"] = _params.programIndex;
+  bool includes(int _streamIndex) const {
+    return _streamIndex >= 0 && _streamIndex < (int) selected_.size() && selected_[_streamIndex];
+  }
 
-  // Output the JSON
-  std::cout << stream_info.dump(4) << std::endl;
+  // Build and send the EA for the streams of this program
+  // (again after a reconnection: stream indices and parameters may have changed)
+  void announce(AVFormatContext *_formatContext) {
+    videoStreamIndex_ = -1;
+    gopCache_.clear();
+    clearBurst();
+    nlohmann::json stream_info;
+    for(unsigned int i = 0; i < _formatContext->nb_streams; i++) {
+      AVStream *stream = _formatContext->streams[i];
+      if(!includes(stream->index)) {
+        continue;
+      }
+      stream_info["streams"].push_back(streamInfoJson(stream));
 
-  // Build EA
-  EssenceBlock* block = createEssenceBlock(MAX_ESSENCE_PAYLOAD_SIZE);
-  setEssenceAnnouncementBlock(block, _params.programIndex, stream_info);
-  _queue.push(block);
+      // GOP cache of the first video stream, for join bursts
+      if(videoStreamIndex_ < 0 && stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+        videoStreamIndex_ = stream->index;
+      }
+    }
+    stream_info["program_index"] = params_.programIndex;
+    stream_info["smt_encoding"] = params_.smtEncoding;
+    // SMT tables are shared by all programs: receivers shift their action timestamps by this, 90 kHz
+    stream_info["timestamp_offset"] = params_.timestampOffsetMs * 90;
 
-  // Read the packets
-  AVPacket packet;
-  while(av_read_frame(formatContext, &packet) >= 0) {
-    // Create an EssenceBlock for the current packet
-    EssenceBlock *block = createEssenceBlock(MAX_ESSENCE_PAYLOAD_SIZE);    
-    setEssenceBlock(block, _params.programIndex, packet, formatContext->streams[packet.stream_index]);
+    // Output the JSON
+    std::cout << stream_info.dump(4) << std::endl;
+
+    std::string serialized = stream_info.dump();
+    destroyEssenceBlock(&EABlock_);
+    EABlock_ = createEssenceBlock((int) serialized.size());
+    setEssenceAnnouncementBlock(EABlock_, params_.programIndex, stream_info);
+    queue_.push(cloneEssenceBlock(EABlock_));
+    lastJoinBurst_ = std::chrono::steady_clock::now();
+  }
+
+  // Packet of one of the program streams. The packet is only read, into a block of this program:
+  // a packet routed to N programs is copied N times, as each block carries its own header and the
+  // writers send a block as one contiguous buffer. That is about 3 us per 64 KB frame and program
+  void write(const AVPacket *_packet, AVStream *_stream) {
+    EssenceBlock *block = createEssenceBlock(_packet->size);
+    traceStamp(block, TRACE_STAGE_DEMUX);
+    setEssenceBlock(block, params_.programIndex, *_packet, _stream);
+    block->sequence = sequences_[_packet->stream_index]++;
 
     // Announce the block info
-    announce_block_info(block);
+    if(params_.logBlocks) {
+      announce_block_info(block);
+    }
+
+    if(_packet->stream_index == videoStreamIndex_ && params_.joinBursts()) {
+      gopCache_.add(block, (block->flags & ESSENCE_FLAG_KEY) != 0);
+    }
 
     // Register
-    _queue.push(block);
+    traceStamp(block, TRACE_STAGE_ENQUEUE);
+    queue_.push(block);
 
-    // Free the packet
-    av_packet_unref(&packet);
+    // Join burst: EA with full codec parameters, then the cached GOP. One burst at a time,
+    // requests are only taken once the interval since the last one has passed
+    auto now = std::chrono::steady_clock::now();
+    if(burst_.empty()) {
+      bool periodic = params_.joinBurstPeriodMs > 0 && now - lastJoinBurst_ >= std::chrono::milliseconds(params_.joinBurstPeriodMs);
+      bool requested = params_.joinRequests && now - lastJoinBurst_ >= std::chrono::milliseconds(params_.joinBurstMinIntervalMs) && params_.joinRequests->consume(params_.programIndex);
+      if((periodic || requested) && !gopCache_.empty() && EABlock_) {
+        queue_.push(cloneEssenceBlock(EABlock_));
+        gopCache_.burst(params_.programIndex, burst_);
+        lastJoinBurst_ = now;
+        burstPacedAt_ = now;
+        burstCredit_ = 0;
+      }
+    }
+    sendBurst(now);
   }
 
-  // Clean up and close the input
-  avformat_close_input(&formatContext);
+  int programIndex() const {
+    return params_.programIndex;
+  }
 
-  // Cleanup FFmpeg
-  avformat_network_deinit();
-}
+protected:
+  // Queue the burst blocks the bitrate allows since the last call. A block goes out as soon as the
+  // credit isn't negative, so credit owed for a large one delays the next
+  void sendBurst(std::chrono::steady_clock::time_point _now) {
+    if(burst_.empty()) {
+      return;
+    }
+    if(params_.joinBurstBitrate > 0) {
+      burstCredit_ += std::chrono::duration<double>(_now - burstPacedAt_).count() * params_.joinBurstBitrate / 8.0;
+      burstPacedAt_ = _now;
+    }
+    while(!burst_.empty() && (params_.joinBurstBitrate <= 0 || burstCredit_ >= 0)) {
+      EssenceBlock *block = burst_.front();
+      burst_.pop_front();
+      burstCredit_ -= block->size + block->payload_size;
+      queue_.push(block);
+    }
+  }
+
+  void clearBurst() {
+    for(EssenceBlock *block : burst_) {
+      destroyEssenceBlock(&block);
+    }
+    burst_.clear();
+  }
+
+protected:
+  FFMPEGProducerParams params_;
+  ThreadSafeQueue<EssenceBlock *> &queue_;
+  EssenceBlock *EABlock_ = nullptr;
+  std::vector<bool> selected_;
+  std::vector<uint16_t> sequences_;
+  int videoStreamIndex_ = -1;
+  GopCache gopCache_;
+  std::chrono::steady_clock::time_point lastJoinBurst_;
+  std::deque<EssenceBlock *> burst_;                    // burst blocks still to queue
+  std::chrono::steady_clock::time_point burstPacedAt_;
+  double burstCredit_ = 0;                              // bytes
+};
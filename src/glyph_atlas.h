@@ -0,0 +1,281 @@
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <SDL.h>
+#include <SDL_ttf.h>
+#include "text_renderer_base.h"
+#include "overlay_manager.h"
+#include "metrics_registry.h"
+#pragma comment(lib, "SDL2_ttf.lib")
+
+#define GLYPH_ATLAS_SIZE 1024
+#define GLYPH_ATLAS_MIN_LINE_HEIGHT 4
+#define GLYPH_ATLAS_MAX_LINE_HEIGHT 256
+#ifdef _WIN32
+  #define GLYPH_ATLAS_DEFAULT_FONT "C:\\Windows\\Fonts\\arial.ttf"
+#else
+  #define GLYPH_ATLAS_DEFAULT_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+#endif
+
+struct GlyphAtlasParams {
+  int size = GLYPH_ATLAS_SIZE;                                   // texture width and height
+  std::map<int, std::string> fonts = { { 0, GLYPH_ATLAS_DEFAULT_FONT } };   // SMT font id -> TrueType file
+};
+
+// "<id>=<file.ttf>" separated by ';', e.g. "0=DejaVuSans.ttf;1=DejaVuSansMono.ttf"
+__inline bool parseFontTable(const std::string &_spec, std::map<int, std::string> &_fonts) {
+  std::stringstream entries(_spec);
+  std::string entry;
+  while(std::getline(entries, entry, ';')) {
+    size_t equals = entry.find('=');
+    if(equals == 0 || equals == std::string::npos || entry.find_first_not_of("0123456789") != equals) {
+      return false;
+    }
+    _fonts[atoi(entry.c_str())] = entry.substr(equals + 1);
+  }
+  return true;
+}
+
+// Text renderer on SDL_ttf. Every glyph is rasterized once per font and line height into a shared
+// atlas texture (premultiplied white coverage); lines are then composited from it with the text
+// color as texture modulation, one copy per visible glyph. A full atlas is simply started over
+class GlyphAtlas : public TextRendererBase {
+public:
+  GlyphAtlas(const GlyphAtlasParams &_params = GlyphAtlasParams())
+  :params_(_params)
+  {
+  }
+
+  ~GlyphAtlas() {
+    clear();
+    for(auto &face : faces_) {
+      if(face.second.font) {
+        TTF_CloseFont(face.second.font);
+      }
+    }
+    if(ttfInit_) {
+      TTF_Quit();
+    }
+  }
+
+  // Release the atlas texture. Call before destroying the renderer it belongs to
+  void clear() {
+    if(texture_) {
+      SDL_DestroyTexture(texture_);
+      texture_ = nullptr;
+    }
+    renderer_ = nullptr;
+    reset();
+  }
+
+  int measure(int _fontId, int _lineHeight, const std::u32string &_text) {
+    Face *face = getFace(_fontId, _lineHeight);
+    if(!face) {
+      return 0;
+    }
+    int width = 0;
+    for(char32_t c : _text) {
+      width += getGlyph(*face, c).advance;
+    }
+    return width;
+  }
+
+  void draw(SDL_Renderer *_renderer, int _fontId, int _lineHeight, const std::u32string &_text, int _x, int _y, const SDL_Rect &_clip, uint32_t _color, uint8_t _opacity) {
+    Face *face = getFace(_fontId, _lineHeight);
+    if(!face || !prepareTexture(_renderer)) {
+      return;
+    }
+    // premultiplied coverage: color and alpha are both scaled by the text alpha
+    uint32_t alpha = (_color >> 24) * _opacity / 255;
+    SDL_SetTextureColorMod(texture_, (uint8_t) (((_color >> 16) & 0xff) * alpha / 255), (uint8_t) (((_color >> 8) & 0xff) * alpha / 255), (uint8_t) ((_color & 0xff) * alpha / 255));
+    SDL_SetTextureAlphaMod(texture_, (uint8_t) alpha);
+
+    int y = _y + (std::min(_lineHeight, GLYPH_ATLAS_MAX_LINE_HEIGHT) - face->height) / 2;
+    int x = _x;
+    int clipEnd = _clip.x + _clip.w;
+    for(char32_t c : _text) {
+      if(x >= clipEnd) {
+        break;
+      }
+      Glyph &glyph = getGlyph(*face, c);
+      if(x + glyph.advance + face->height > _clip.x) {
+        if(!glyph.rasterized) {
+          rasterize(*face, c, glyph);
+        }
+        if(glyph.rect.w > 0) {
+          SDL_Rect dst = { x + glyph.offsetX, y, glyph.rect.w, glyph.rect.h };
+          SDL_RenderCopy(_renderer, texture_, &glyph.rect, &dst);
+        }
+      }
+      x += glyph.advance;
+    }
+  }
+
+protected:
+  struct Glyph {
+    int advance = 0;
+    int offsetX = 0;                // left bearing when negative
+    bool rasterized = false;
+    SDL_Rect rect = { 0, 0, 0, 0 };   // in the atlas, empty for blank glyphs
+  };
+
+  struct Face {
+    TTF_Font *font = nullptr;
+    int height = 0;
+    std::unordered_map<char32_t, Glyph> glyphs;
+  };
+
+  // Font _fontId sized for a line height of _lineHeight pixels. Fonts that fail to open are remembered
+  Face *getFace(int _fontId, int _lineHeight) {
+    _lineHeight = std::clamp(_lineHeight, GLYPH_ATLAS_MIN_LINE_HEIGHT, GLYPH_ATLAS_MAX_LINE_HEIGHT);
+    uint32_t key = ((uint32_t) _fontId << 16) | (uint32_t) _lineHeight;
+    auto it = faces_.find(key);
+    if(it != faces_.end()) {
+      return it->second.font ? &it->second : nullptr;
+    }
+
+    Face &face = faces_[key];
+    if(!ttfInit_) {
+      if(TTF_Init() != 0) {
+        std::cerr << "TTF_Init Error: " << TTF_GetError() << std::endl;
+        return nullptr;
+      }
+      ttfInit_ = true;
+    }
+    auto font = params_.fonts.find(_fontId);
+    if(font == params_.fonts.end()) {
+      font = params_.fonts.find(0);
+      if(font == params_.fonts.end()) {
+        return nullptr;
+      }
+    }
+    // point size giving the requested line height
+    face.font = TTF_OpenFont(font->second.c_str(), _lineHeight);
+    if(face.font && TTF_FontHeight(face.font) > 0 && TTF_FontHeight(face.font) != _lineHeight) {
+      int size = std::max(1, _lineHeight * _lineHeight / TTF_FontHeight(face.font));
+      TTF_CloseFont(face.font);
+      face.font = TTF_OpenFont(font->second.c_str(), size);
+    }
+    if(!face.font) {
+      std::cerr << "TTF_OpenFont Error: " << font->second << ": " << TTF_GetError() << std::endl;
+      return nullptr;
+    }
+    face.height = TTF_FontHeight(face.font);
+    return &face;
+  }
+
+  Glyph &getGlyph(Face &_face, char32_t _c) {
+    auto it = _face.glyphs.find(_c);
+    if(it != _face.glyphs.end()) {
+      return it->second;
+    }
+    Glyph &glyph = _face.glyphs[_c];
+    int minX = 0, maxX = 0, minY = 0, maxY = 0, advance = 0;
+    if(TTF_GlyphMetrics32(_face.font, (Uint32) _c, &minX, &maxX, &minY, &maxY, &advance) == 0) {
+      glyph.advance = advance;
+      glyph.offsetX = std::min(0, minX);
+    }
+    return glyph;
+  }
+
+  void rasterize(Face &_face, char32_t _c, Glyph &_glyph) {
+    _glyph.rasterized = true;
+    _glyph.rect = { 0, 0, 0, 0 };
+    SDL_Color white = { 255, 255, 255, 255 };
+    SDL_Surface *surface = TTF_RenderGlyph32_Blended(_face.font, (Uint32) _c, white);
+    if(!surface) {
+      return;
+    }
+    SDL_Surface *converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(surface);
+    if(!converted) {
+      return;
+    }
+    premultiplySurface(converted);
+
+    SDL_Rect rect;
+    if(!allocate(converted->w, converted->h, rect)) {
+      // full: start over. Glyphs already queued this frame are flushed before the texture changes
+      reset();
+      atlasResets_++;
+      _glyph.rasterized = true;
+      if(!allocate(converted->w, converted->h, rect)) {
+        SDL_FreeSurface(converted);
+        return;
+      }
+    }
+    SDL_UpdateTexture(texture_, &rect, converted->pixels, converted->pitch);
+    SDL_FreeSurface(converted);
+    _glyph.rect = rect;
+    glyphsRasterized_++;
+  }
+
+  // Shelf packing, one pixel apart so linear filtering never picks up a neighbour
+  bool allocate(int _width, int _height, SDL_Rect &_rect) {
+    if(_width > params_.size || _height > params_.size) {
+      return false;
+    }
+    if(shelfX_ + _width > params_.size) {
+      shelfY_ += shelfHeight_;
+      shelfX_ = 0;
+      shelfHeight_ = 0;
+    }
+    if(shelfY_ + _height > params_.size) {
+      return false;
+    }
+    _rect = { shelfX_, shelfY_, _width, _height };
+    shelfX_ += _width + 1;
+    shelfHeight_ = std::max(shelfHeight_, _height + 1);
+    return true;
+  }
+
+  void reset() {
+    for(auto &face : faces_) {
+      for(auto &glyph : face.second.glyphs) {
+        glyph.second.rasterized = false;
+        glyph.second.rect = { 0, 0, 0, 0 };
+      }
+    }
+    shelfX_ = 0;
+    shelfY_ = 0;
+    shelfHeight_ = 0;
+  }
+
+  // The atlas belongs to one renderer; a new renderer gets a new, empty atlas
+  bool prepareTexture(SDL_Renderer *_renderer) {
+    if(texture_ && renderer_ == _renderer) {
+      return true;
+    }
+    if(texture_) {
+      SDL_DestroyTexture(texture_);
+    }
+    reset();
+    renderer_ = _renderer;
+    texture_ = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, params_.size, params_.size);
+    if(!texture_) {
+      std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+      return false;
+    }
+    SDL_SetTextureBlendMode(texture_, premultipliedBlendMode());
+    return true;
+  }
+
+protected:
+  GlyphAtlasParams params_;
+  bool ttfInit_ = false;
+  std::map<uint32_t, Face> faces_;
+  SDL_Renderer *renderer_ = nullptr;
+  SDL_Texture *texture_ = nullptr;
+  int shelfX_ = 0;
+  int shelfY_ = 0;
+  int shelfHeight_ = 0;
+  // metrics
+  Counter &glyphsRasterized_ = globalMetrics().counter("overlay_glyphs_rasterized_total", "", "Glyphs rasterized into the text atlas");
+  Counter &atlasResets_ = globalMetrics().counter("overlay_glyph_atlas_resets_total", "", "Times the glyph atlas was full and started over");
+};
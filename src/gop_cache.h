@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <nlohmann/json.hpp>
+#include "essence_block.h"
+
+#define GOP_CACHE_MAX_BYTES 8 * 1024 * 1024
+
+// Join burst requests for the producers, e.g. from the control channel.
+// One bit per program index, so requesting is lock-free and repeated requests collapse
+class JoinBurstRequests {
+public:
+  // _programIndex < 0 requests a burst from every program
+  void request(int _programIndex = -1) {
+    uint64_t mask = (_programIndex < 0 || _programIndex > 63) ? ~0ull : (1ull << _programIndex);
+    pending_.fetch_or(mask, std::memory_order_relaxed);
+  }
+
+  // True (once) if a burst was requested for _programIndex
+  bool consume(int _programIndex) {
+    uint64_t bit = 1ull << (_programIndex & 63);
+    return (pending_.fetch_and(~bit, std::memory_order_relaxed) & bit) != 0;
+  }
+
+protected:
+  std::atomic<uint64_t> pending_ = 0;
+};
+
+// Most recent keyframe of a program's video stream and every access unit after it, held by reference:
+// the cache shares the blocks sent live (the muxer only releases them) instead of copying every packet.
+// A join burst sends the cache as ESSENCE_TYPE_JOIN copies: receivers that are already decoding
+// ignore them, a receiver that just joined decodes them and shows a picture without waiting for
+// the next keyframe. The burst starts with a marker block (stream_index 0xff, JSON payload with the
+// number of blocks that follow), so a receiver never starts decoding in the middle of one.
+class GopCache {
+public:
+  GopCache(size_t _maxBytes = GOP_CACHE_MAX_BYTES)
+  :maxBytes_(_maxBytes)
+  {
+  }
+
+  ~GopCache() {
+    clear();
+  }
+
+  // Track an essence data block of the cached stream, before it is queued. A keyframe restarts the cache
+  void add(EssenceBlock *_block, bool _keyframe) {
+    if(_keyframe) {
+      clear();
+      valid_ = true;
+    }
+    if(!valid_) {
+      return;
+    }
+    // a GOP this large is not worth a burst; wait for the next keyframe
+    if(bytes_ + _block->payload_size > maxBytes_) {
+      clear();
+      return;
+    }
+    blocks_.push_back(retainEssenceBlock(_block));
+    bytes_ += _block->payload_size;
+  }
+
+  bool empty() const {
+    return blocks_.empty();
+  }
+
+  // Append the burst (marker + copies of the cached blocks) to _burst, for the producer to pace
+  // out. Returns the number of cached blocks
+  size_t burst(int _programIndex, std::deque<EssenceBlock *> &_burst) const {
+    if(blocks_.empty()) {
+      return 0;
+    }
+
+    nlohmann::json marker;
+    marker["program_index"] = _programIndex;
+    marker["stream_index"] = blocks_.front()->stream_index;
+    marker["blocks"] = blocks_.size();
+    std::string serialized = marker.dump();
+    EssenceBlock *start = createEssenceBlock((int) serialized.size());
+    start->essence_type = EssenceType::ESSENCE_TYPE_JOIN;
+    start->program_index = (uint8_t) _programIndex;
+    start->stream_type = 0xff;
+    start->stream_index = 0xff;
+    start->timestamp = 0;
+    start->payload_size = (uint32_t) serialized.size();
+    memcpy(start + 1, serialized.data(), serialized.size());
+    _burst.push_back(start);
+
+    // the muxer restamps the live blocks while they are shared: the timestamp is not read here
+    for(EssenceBlock *cached : blocks_) {
+      EssenceBlock *block = createEssenceBlock(cached->payload_size);
+      block->essence_type = EssenceType::ESSENCE_TYPE_JOIN;
+      block->program_index = cached->program_index;
+      block->stream_type = cached->stream_type;
+      block->stream_index = cached->stream_index;
+      block->payload_size = cached->payload_size;
+      block->flags = cached->flags;
+      block->sequence = cached->sequence;
+      block->pts = cached->pts;
+      memcpy(block + 1, cached + 1, cached->payload_size);
+      _burst.push_back(block);
+    }
+    return blocks_.size();
+  }
+
+  void clear() {
+    for(EssenceBlock *block : blocks_) {
+      releaseEssenceBlock(&block);
+    }
+    blocks_.clear();
+    bytes_ = 0;
+    valid_ = false;
+  }
+
+protected:
+  size_t maxBytes_ = 0;
+  size_t bytes_ = 0;
+  bool valid_ = false;
+  std::vector<EssenceBlock *> blocks_;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+// log2 sub-buckets per power of two: 16 sub-buckets, ~6% resolution
+#define LATENCY_HISTOGRAM_SUB_BITS 4
+// values up to 2^40 ns (~18 minutes)
+#define LATENCY_HISTOGRAM_MAX_BITS 40
+#define LATENCY_HISTOGRAM_BUCKETS ((LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_SUB_BITS + 1) << LATENCY_HISTOGRAM_SUB_BITS)
+
+__inline int highestBit(uint64_t _value) {
+#ifdef _MSC_VER
+  unsigned long index = 0;
+  _BitScanReverse64(&index, _value);
+  return (int) index;
+#else
+  return 63 - __builtin_clzll(_value);
+#endif
+}
+
+// HDR style latency histogram in nanoseconds: log-linear buckets with a fixed relative error,
+// recorded with relaxed atomic increments only, so any number of threads can record while the
+// exporter reads. Reads are not a consistent snapshot, which is fine for monitoring
+class LatencyHistogram {
+public:
+  void record(uint64_t _ns) {
+    buckets_[bucketIndex(_ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(_ns, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  // Sum of the recorded values, ns
+  uint64_t sum() const {
+    return sum_.load(std::memory_order_relaxed);
+  }
+
+  // Number of values <= _ns (bucket granularity)
+  uint64_t countBelow(uint64_t _ns) const {
+    uint64_t count = 0;
+    for(int i = 0; i < LATENCY_HISTOGRAM_BUCKETS && bucketUpper(i) <= _ns + 1; i++) {
+      count += buckets_[i].load(std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+  // Value at quantile _q (0..1), ns, upper bound of its bucket
+  uint64_t quantile(double _q) const {
+    uint64_t total = count();
+    if(total == 0) {
+      return 0;
+    }
+    uint64_t rank = (uint64_t) (_q * (double) (total - 1)) + 1;
+    uint64_t count = 0;
+    for(int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+      count += buckets_[i].load(std::memory_order_relaxed);
+      if(count >= rank) {
+        return bucketUpper(i) - 1;
+      }
+    }
+    return bucketUpper(LATENCY_HISTOGRAM_BUCKETS - 1) - 1;
+  }
+
+  static int bucketIndex(uint64_t _ns) {
+    if(_ns < (1ull << LATENCY_HISTOGRAM_SUB_BITS)) {
+      return (int) _ns;
+    }
+    int exponent = highestBit(_ns);
+    if(exponent >= LATENCY_HISTOGRAM_MAX_BITS) {
+      return LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+    int shift = exponent - LATENCY_HISTOGRAM_SUB_BITS;
+    int sub = (int) (_ns >> shift) & ((1 << LATENCY_HISTOGRAM_SUB_BITS) - 1);
+    return ((shift + 1) << LATENCY_HISTOGRAM_SUB_BITS) + sub;
+  }
+
+  // Exclusive upper bound of a bucket, ns
+  static uint64_t bucketUpper(int _index) {
+    if(_index < (1 << LATENCY_HISTOGRAM_SUB_BITS)) {
+      return (uint64_t) _index + 1;
+    }
+    int shift = (_index >> LATENCY_HISTOGRAM_SUB_BITS) - 1;
+    uint64_t sub = (uint64_t) (_index & ((1 << LATENCY_HISTOGRAM_SUB_BITS) - 1));
+    return (((1ull << LATENCY_HISTOGRAM_SUB_BITS) + sub + 1) << shift);
+  }
+
+protected:
+  std::atomic<uint64_t> buckets_[LATENCY_HISTOGRAM_BUCKETS] = {};
+  std::atomic<uint64_t> count_ = 0;
+  std::atomic<uint64_t> sum_ = 0;
+};
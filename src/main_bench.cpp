@@ -0,0 +1,465 @@
+// Microbenchmarks of the core primitives, results as JSON: bench [output.json] [minTimeMs]
+// Linux:
+//   g++ -O2 -std=c++17 -Isrc src/main_bench.cpp -o bench $(pkg-config --cflags --libs libavutil libswscale sdl2) -lpthread
+// or, without FFmpeg/SDL (frame conversion and overlay cases skipped):
+//   g++ -O2 -std=c++17 -DBENCH_NO_MEDIA -Isrc src/main_bench.cpp -o bench -lpthread
+#define SDL_MAIN_HANDLED
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cctype>
+#include <thread>
+#include <atomic>
+
+#include "socket_compat.h"
+#include "base64_simple.h"
+#include "bench_harness.h"
+#include "essence_block.h"
+#include "queue_thread_safe.h"
+#include "udp_writer.h"
+#include "block_reassembler.h"
+#include "smt_producer.h"
+#include "qoi_codec.h"
+#ifndef BENCH_NO_MEDIA
+extern "C" {
+  #include <libavutil/frame.h>
+  #include <libavutil/imgutils.h>
+  #include <libswscale/swscale.h>
+}
+#include "overlay_manager.h"
+#pragma comment(lib, "SDL2.lib")
+#endif
+
+// Previous std::string based codec, kept as the baseline
+namespace legacy {
+
+static const std::string base64_chars =
+"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+"abcdefghijklmnopqrstuvwxyz"
+"0123456789+/";
+
+std::string base64_encode(const std::vector<uint8_t>& data) {
+  std::string encoded;
+  uint32_t val = 0;
+  int valb = -6;
+
+  for(uint8_t c : data) {
+    val = (val << 8) + c;
+    valb += 8;
+    while(valb >= 0) {
+      encoded.push_back(base64_chars[(val >> valb) & 0x3F]);
+      valb -= 6;
+    }
+  }
+  if(valb > -6) {
+    encoded.push_back(base64_chars[((val << 8) >> (valb + 8)) & 0x3F]);
+  }
+  while(encoded.size() % 4) {
+    encoded.push_back('=');
+  }
+  return encoded;
+}
+
+inline bool is_base64(unsigned char c) {
+  return std::isalnum(c) || (c == '+') || (c == '/');
+}
+
+std::string base64_decode(const std::string& encoded) {
+  std::string decoded;
+  int val = 0;
+  int valb = -8;
+  for(unsigned char c : encoded) {
+    if(!is_base64(c) && c != '=') {
+      return decoded;
+    }
+    if(c == '=') break;
+    val = (val << 6) + (int) base64_chars.find(c);
+    valb += 6;
+    if(valb >= 0) {
+      decoded.push_back((val >> valb) & 0xFF);
+      valb -= 8;
+    }
+  }
+  return decoded;
+}
+
+} // namespace legacy
+
+static std::string sizeName(size_t _size) {
+  return (_size >= 1024 * 1024) ? std::to_string(_size / (1024 * 1024)) + "MB" : std::to_string(_size / 1024) + "KB";
+}
+
+static void benchBase64(BenchHarness &_bench, size_t _size) {
+  std::mt19937 rng(1234);
+  std::vector<uint8_t> data(_size);
+  for(uint8_t &byte : data) {
+    byte = (uint8_t) rng();
+  }
+  std::string encoded = base64_encode(data);
+  if(encoded != legacy::base64_encode(data) || base64_decode(encoded) != legacy::base64_decode(encoded)) {
+    std::cerr << "Error: base64 output mismatch at " << _size << " bytes" << std::endl;
+    exit(1);
+  }
+
+  std::vector<char> text(base64_encoded_size(_size));
+  std::vector<uint8_t> binary(base64_decoded_max_size(encoded.size()));
+  std::string suffix = "/" + sizeName(_size);
+
+  // encode
+  _bench.run("base64_encode_legacy" + suffix, _size, [&]() {
+    benchKeep(legacy::base64_encode(data));
+  });
+  _bench.run("base64_encode_string" + suffix, _size, [&]() {
+    benchKeep(base64_encode(data));
+  });
+  _bench.run("base64_encode_scalar" + suffix, _size, [&]() {
+    size_t done = base64_detail::encodeScalar(data.data(), data.size(), text.data());
+    benchKeep(done);
+  });
+  _bench.run("base64_encode_presized" + suffix, _size, [&]() {
+    benchKeep(base64_encode(data.data(), data.size(), text.data()));
+  });
+
+  // decode, throughput in decoded bytes
+  _bench.run("base64_decode_legacy" + suffix, _size, [&]() {
+    benchKeep(legacy::base64_decode(encoded));
+  });
+  _bench.run("base64_decode_string" + suffix, _size, [&]() {
+    benchKeep(base64_decode(encoded));
+  });
+  _bench.run("base64_decode_scalar" + suffix, _size, [&]() {
+    benchKeep(base64_detail::decodeScalar(encoded.data(), encoded.size() - 4, binary.data()));
+  });
+  _bench.run("base64_decode_presized" + suffix, _size, [&]() {
+    size_t size = 0;
+    benchKeep(base64_decode(encoded.data(), encoded.size(), binary.data(), &size));
+  });
+  _bench.run("base64_decode_stream_4KB" + suffix, _size, [&]() {
+    Base64StreamDecoder decoder;
+    size_t offset = 0;
+    size_t written = 0;
+    while(offset < encoded.size()) {
+      size_t chunk = std::min<size_t>(4096, encoded.size() - offset);
+      size_t size = 0;
+      decoder.update(encoded.data() + offset, chunk, binary.data() + written, &size);
+      written += size;
+      offset += chunk;
+    }
+    benchKeep(decoder.finish());
+  });
+}
+
+static std::vector<uint8_t> randomBytes(size_t _size) {
+  std::mt19937 rng(1234);
+  std::vector<uint8_t> data(_size);
+  for(uint8_t &byte : data) {
+    byte = (uint8_t) rng();
+  }
+  return data;
+}
+
+// Block allocation and copy, per payload size
+static void benchEssenceBlock(BenchHarness &_bench) {
+  for(size_t size : { (size_t) 1024, (size_t) 64 * 1024, (size_t) 1024 * 1024 }) {
+    std::string suffix = "/" + sizeName(size);
+    _bench.run("essence_block_create" + suffix, size, [&]() {
+      EssenceBlock *block = createEssenceBlock((int) size);
+      benchKeep(block);
+      destroyEssenceBlock(&block);
+    });
+
+    EssenceBlock *source = createEssenceBlock((int) size);
+    source->payload_size = (uint32_t) size;
+    _bench.run("essence_block_clone" + suffix, size, [&]() {
+      EssenceBlock *block = cloneEssenceBlock(source);
+      benchKeep(block);
+      destroyEssenceBlock(&block);
+    });
+    destroyEssenceBlock(&source);
+  }
+}
+
+// Producers -> muxer handoff: N producer threads, one consumer. Per item, thread start included
+static void benchQueue(BenchHarness &_bench) {
+  const int items = 64 * 1024;
+  for(int producers : { 1, 2, 4, 8 }) {
+    _bench.run("queue_push_pop/" + std::to_string(producers) + "p", 0, [&]() {
+      ThreadSafeQueue<EssenceBlock *> queue;
+      std::vector<std::thread> threads;
+      int perProducer = items / producers;
+      for(int p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, perProducer]() {
+          for(int i = 0; i < perProducer; i++) {
+            queue.push((EssenceBlock *) (uintptr_t) (i + 1));
+          }
+        });
+      }
+      for(int i = 0; i < perProducer * producers; i++) {
+        benchKeep(queue.pop());
+      }
+      for(std::thread &thread : threads) {
+        thread.join();
+      }
+    }, items);
+  }
+}
+
+// UDPWriter::write of one block to a loopback receiver drained by a thread
+static void benchUDPWriter(BenchHarness &_bench) {
+  SOCKET receiver = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = 0;
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  socklen_t addrSize = sizeof(addr);
+  int receiveBufferSize = 8 * 1024 * 1024;
+  setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, (const char *) &receiveBufferSize, sizeof(receiveBufferSize));
+  if(receiver == INVALID_SOCKET || bind(receiver, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR || getsockname(receiver, (sockaddr *) &addr, &addrSize) == SOCKET_ERROR) {
+    std::cerr << "Error: loopback socket unavailable, skipping udp_writer" << std::endl;
+    closesocket(receiver);
+    return;
+  }
+
+  std::atomic<bool> stop = false;
+  std::thread drain([&]() {
+    char buffer[1500];
+    while(!stop) {
+      recv(receiver, buffer, sizeof(buffer), 0);
+    }
+  });
+
+  UDPWriter writer("127.0.0.1", ntohs(addr.sin_port));
+  if(writer.open()) {
+    for(size_t size : { (size_t) 1024, (size_t) 64 * 1024 }) {
+      std::vector<uint8_t> data = randomBytes(size);
+      _bench.run("udp_writer_write/" + sizeName(size), size, [&]() {
+        benchKeep(writer.write(data.data(), (int) data.size()));
+      });
+    }
+  }
+
+  // wake the drain thread up
+  stop = true;
+  uint8_t wake = 0;
+  writer.write(&wake, 1);
+  drain.join();
+  writer.close();
+  closesocket(receiver);
+}
+
+class CountingParser : public ParserBase {
+public:
+  int parse(EssenceBlock *_block) {
+    blocks++;
+    return _block->size + _block->payload_size;
+  }
+
+  uint64_t blocks = 0;
+};
+
+// UDPReader reassembly of a synthetic datagram stream (blocks cut in CHUNK_SIZE datagrams, as sent)
+static void benchReassembly(BenchHarness &_bench) {
+  for(size_t size : { (size_t) 1024, (size_t) 64 * 1024 }) {
+    std::vector<uint8_t> payload = randomBytes(size);
+    std::vector<uint8_t> stream;
+    for(int i = 0; i < 16; i++) {
+      EssenceBlock *block = createEssenceBlock((int) size);
+      block->essence_type = EssenceType::ESSENCE_TYPE_ED;
+      block->payload_size = (uint32_t) size;
+      memcpy(block + 1, payload.data(), size);
+      stream.insert(stream.end(), (uint8_t *) block, (uint8_t *) (block + 1) + size);
+      destroyEssenceBlock(&block);
+    }
+
+    CountingParser parser;
+    BlockReassembler reassembler(&parser);
+    _bench.run("udp_reader_reassembly/" + sizeName(size), stream.size(), [&]() {
+      uint64_t now = traceNow();
+      for(size_t offset = 0; offset < stream.size(); offset += CHUNK_SIZE) {
+        reassembler.consume(stream.data() + offset, std::min<size_t>(CHUNK_SIZE, stream.size() - offset), now);
+      }
+    });
+    if(parser.blocks == 0) {
+      std::cerr << "Error: no block reassembled" << std::endl;
+      exit(1);
+    }
+  }
+}
+
+// SMT action encoding, JSON and binary, without and with a 32 KB asset
+static void benchSMT(BenchHarness &_bench) {
+  SMTAction action;
+  action.type = SMT_ACTION_ADD_IMAGE;
+  action.id = 1;
+  action.timestamp = 90000;
+  action.contentHash = 0x0123456789abcdefull;
+  action.fields = SMT_FIELD_X | SMT_FIELD_Y | SMT_FIELD_WIDTH | SMT_FIELD_HEIGHT | SMT_FIELD_Z_ORDER | SMT_FIELD_OPACITY;
+  action.placement.xPercentage = 10.0;
+  action.placement.yPercentage = 20.0;
+  action.placement.widthPercentage = 15.0;
+  action.placement.heightPercentage = 10.0;
+
+  std::vector<uint8_t> asset = randomBytes(32 * 1024);
+  std::string encoded = base64_encode(asset);
+
+  for(bool withAsset : { false, true }) {
+    std::string suffix = withAsset ? "/32KB_asset" : "/no_asset";
+    size_t bytes = withAsset ? asset.size() : 0;
+
+    _bench.run("smt_json_build" + suffix, bytes, [&]() {
+      nlohmann::json smt;
+      smt["actions"].push_back(buildSMTActionJson(action, withAsset ? &encoded : nullptr, SMT_DATA_PNG));
+      benchKeep(smt.dump());
+    });
+
+    nlohmann::json smt;
+    smt["actions"].push_back(buildSMTActionJson(action, withAsset ? &encoded : nullptr, SMT_DATA_PNG));
+    std::string serialized = smt.dump();
+    _bench.run("smt_json_parse" + suffix, bytes, [&]() {
+      nlohmann::json parsed = nlohmann::json::parse(serialized);
+      for(const nlohmann::json &actionJson : parsed["actions"]) {
+        SMTAction parsedAction;
+        benchKeep(parseSMTAction(actionJson, parsedAction));
+        if(actionJson.contains("data")) {
+          benchKeep(base64_decode(actionJson["data"].get<std::string>()));
+        }
+      }
+    });
+
+    std::vector<uint8_t> binary(sizeof(SMTBinaryHeader) + sizeof(SMTBinaryAction) + asset.size());
+    _bench.run("smt_binary_build" + suffix, bytes, [&]() {
+      SMTBinaryWriter writer(binary.data(), binary.size());
+      benchKeep(withAsset ? writer.addAction(action, SMT_DATA_PNG, asset.data(), (uint32_t) asset.size()) : writer.addAction(action));
+    });
+    _bench.run("smt_binary_parse" + suffix, 0, [&]() {
+      SMTBinaryReader reader;
+      reader.open(binary.data(), binary.size());
+      const SMTBinaryAction *record = nullptr;
+      const uint8_t *data = nullptr;
+      while(reader.next(record, data)) {
+        SMTAction parsedAction;
+        benchKeep(parseSMTAction(*record, parsedAction));
+      }
+    });
+  }
+}
+
+// Receiver ready overlay (SMT_DATA_QOI): a 288x108 premultiplied logo, flat fill with soft edges
+static void benchOverlayQOI(BenchHarness &_bench) {
+  const int width = 288, height = 108;
+  std::vector<uint8_t> logo((size_t) width * height * 4);
+  for(int y = 0; y < height; y++) {
+    for(int x = 0; x < width; x++) {
+      int edge = std::min(std::min(x, width - 1 - x), std::min(y, height - 1 - y));
+      uint8_t alpha = (uint8_t) std::min(255, edge * 32);
+      uint8_t *pixel = &logo[((size_t) y * width + x) * 4];
+      pixel[0] = (uint8_t) (200 * alpha / 255);
+      pixel[1] = (uint8_t) ((40 + x / 4) * alpha / 255);
+      pixel[2] = (uint8_t) (30 * alpha / 255);
+      pixel[3] = alpha;
+    }
+  }
+
+  std::vector<uint8_t> encoded;
+  _bench.run("overlay_qoi_encode/288x108", logo.size(), [&]() {
+    benchKeep(qoiEncode(logo.data(), width, height, width * 4, encoded));
+  });
+  std::vector<uint32_t> pixels((size_t) width * height);
+  _bench.run("overlay_qoi_decode/288x108", logo.size(), [&]() {
+    benchKeep(qoiDecodeARGB(encoded.data(), encoded.size(), pixels.data(), width * 4));
+  });
+}
+
+#ifndef BENCH_NO_MEDIA
+// Receiver per frame work at 1080p: YUV420P conversion and overlay composite (software renderer)
+static void benchFrame(BenchHarness &_bench) {
+  const int width = 1920;
+  const int height = 1080;
+  size_t frameSize = (size_t) av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+
+  AVFrame *frame = av_frame_alloc();
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = width;
+  frame->height = height;
+  av_frame_get_buffer(frame, 32);
+  for(int plane = 0; plane < 3; plane++) {
+    memset(frame->data[plane], 0x80, frame->linesize[plane] * (plane ? height / 2 : height));
+  }
+  uint8_t *dstData[4];
+  int dstLinesize[4];
+  av_image_alloc(dstData, dstLinesize, width, height, AV_PIX_FMT_YUV420P, 1);
+  SwsContext *sws = sws_getContext(width, height, AV_PIX_FMT_YUV420P, width, height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+  _bench.run("sws_scale_yuv420p/1080p", frameSize, [&]() {
+    benchKeep(sws_scale(sws, frame->data, frame->linesize, 0, height, dstData, dstLinesize));
+  });
+  sws_freeContext(sws);
+  av_freep(&dstData[0]);
+  av_frame_free(&frame);
+
+  SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+  SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target) : nullptr;
+  if(!renderer) {
+    std::cerr << "Error: software renderer unavailable, skipping overlay_composite: " << SDL_GetError() << std::endl;
+    SDL_FreeSurface(target);
+    return;
+  }
+  {
+    SDL_Surface *logo = SDL_CreateRGBSurfaceWithFormat(0, 384, 216, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_FillRect(logo, nullptr, 0x80ff8000);
+    OverlayManager overlays;
+    OverlayPlacement placement;
+    placement.xPercentage = 75.0;
+    placement.yPercentage = 5.0;
+    placement.widthPercentage = 20.0;
+    placement.heightPercentage = 20.0;
+    placement.opacity = 200;
+    overlays.setContent(1, 1, std::shared_ptr<SDL_Surface>(logo, SDL_FreeSurface));
+    overlays.setPlacement(1, placement);
+    _bench.run("overlay_composite/1080p", 0, [&]() {
+      overlays.render(renderer, width, height);
+    });
+  }
+  SDL_DestroyRenderer(renderer);
+  SDL_FreeSurface(target);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  BenchParams params;
+  if(argc > 1) {
+    params.output = argv[1];
+  }
+  if(argc > 2) {
+    params.minTimeMs = atoi(argv[2]);
+  }
+
+  BenchHarness bench(params);
+#ifdef BASE64_X86
+  std::cerr << "base64 simd level: " << (int) base64_detail::simdLevel() << std::endl;
+#endif
+#ifdef _WIN32
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+  benchEssenceBlock(bench);
+  benchQueue(bench);
+  benchUDPWriter(bench);
+  benchReassembly(bench);
+  for(size_t size : { (size_t) 1024, (size_t) 64 * 1024, (size_t) 1024 * 1024 }) {
+    benchBase64(bench, size);
+  }
+  benchSMT(bench);
+  benchOverlayQOI(bench);
+#ifndef BENCH_NO_MEDIA
+  benchFrame(bench);
+#endif
+
+#ifdef _WIN32
+  WSACleanup();
+#endif
+
+  return bench.write() ? 0 : -1;
+}
@@ -0,0 +1,459 @@
+// In process sender -> receiver loopback, for capacity planning:
+//   loopback [input] [blocks] [payload_bytes] [programs] [udp_port] [output.json] [udp_bitrate]
+// <input> is "synthetic" (default: <programs> programs of <blocks> blocks of <payload_bytes>) or
+// an input spec as accepted by the sender (file inputs are demuxed as fast as possible).
+// The pipeline producer -> muxer -> writer -> reassembly -> null parser runs with an in memory
+// writer, over loopback UDP (so the kernel cost can be told apart from ours) and through a shared
+// memory ring (blocks parsed in place, no reassembly).
+// Reports blocks/s, Mbps, enqueue -> parse latency quantiles and allocations per block, as JSON.
+// A run that lost blocks fails (exit code 1): the UDP run is paced to <udp_bitrate> (default 400 Mbps).
+// Linux:
+//   g++ -O2 -std=c++17 -Isrc src/main_loopback.cpp -o loopback $(pkg-config --cflags --libs libavformat libavcodec libavutil) -lpthread
+// or, synthetic input only:
+//   g++ -O2 -std=c++17 -DLOOPBACK_NO_MEDIA -Isrc src/main_loopback.cpp -o loopback -lpthread
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <functional>
+#include <nlohmann/json.hpp>
+
+#include "socket_compat.h"
+#include "essence_block.h"
+#include "queue_thread_safe.h"
+#include "muxer_timestamp.h"
+#include "muxer_consumer.h"
+#include "memory_writer.h"
+#include "udp_writer.h"
+#include "udp_reader.h"
+#include "shm_writer.h"
+#include "shm_reader.h"
+#include "block_reassembler.h"
+#include "latency_histogram.h"
+#ifndef LOOPBACK_NO_MEDIA
+#include "ffmpeg_producer.h"
+#include "demux_source.h"
+#endif
+
+using json = nlohmann::json;
+
+// Every operator new of the process (essence blocks included), for allocations per block
+static std::atomic<uint64_t> allocations(0);
+
+// Scalar and array forms alike, so every new pairs with its own delete (-Wmismatched-new-delete)
+static void *countedAlloc(size_t _size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *memory = malloc(_size ? _size : 1);
+  if(!memory) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+static void countedFree(void *_memory) noexcept {
+  free(_memory);
+}
+
+void *operator new(size_t _size) {
+  return countedAlloc(_size);
+}
+
+void *operator new[](size_t _size) {
+  return countedAlloc(_size);
+}
+
+void operator delete(void *_memory) noexcept {
+  countedFree(_memory);
+}
+
+void operator delete(void *_memory, size_t) noexcept {
+  countedFree(_memory);
+}
+
+void operator delete[](void *_memory) noexcept {
+  countedFree(_memory);
+}
+
+void operator delete[](void *_memory, size_t) noexcept {
+  countedFree(_memory);
+}
+
+struct LoopbackParams {
+  std::string input = "synthetic";
+  int blocks = 20000;           // synthetic, per program
+  int payloadSize = 8192;       // synthetic
+  int programs = 4;             // synthetic
+  int maxQueued = 64;           // synthetic, producer waits while the muxer queue is this deep
+  int port = 23456;             // loopback UDP
+  int64_t udpBitrate = 400000000; // loopback UDP, bits/s the sender is paced to so the receiver keeps up, 0 = unpaced
+  std::string shmName = "0x12345678_loopback";
+  int drainTimeoutMs = 500;     // UDP / shm, end of the run once nothing arrived for this long
+  std::string output;           // JSON file, empty = stdout
+};
+
+// Enqueue stamps of the blocks in flight, keyed by program, stream and sequence (the trace prefix
+// does not travel with the bytes). Direct mapped: a slot overwritten before its block was parsed
+// just loses that sample
+class EnqueueStamps {
+public:
+  void put(const EssenceBlock *_block, uint64_t _stamp) {
+    uint32_t key = blockKey(_block);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot &slot = slots_[slotIndex(key)];
+    slot.key = key;
+    slot.stamp = _stamp;
+  }
+
+  // Stamp of the block, 0 if unknown
+  uint64_t take(const EssenceBlock *_block) {
+    uint32_t key = blockKey(_block);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot &slot = slots_[slotIndex(key)];
+    if(slot.key != key || !slot.stamp) {
+      return 0;
+    }
+    uint64_t stamp = slot.stamp;
+    slot.stamp = 0;
+    return stamp;
+  }
+
+protected:
+  static uint32_t blockKey(const EssenceBlock *_block) {
+    return ((uint32_t) _block->program_index << 24) | ((uint32_t) _block->stream_index << 16) | _block->sequence;
+  }
+
+  static size_t slotIndex(uint32_t _key) {
+    return (size_t) ((_key * 2654435761u) >> (32 - SLOT_BITS));
+  }
+
+  static const int SLOT_BITS = 16;
+
+  struct Slot {
+    uint32_t key = 0;
+    uint64_t stamp = 0;
+  };
+
+  std::mutex mutex_;
+  Slot slots_[1 << SLOT_BITS];
+};
+
+// Sender side of a run: notes the enqueue stamp of every essence data block before passing it on,
+// paced to _bitrate bits/s if not 0
+class TracingWriter : public WriterBase {
+public:
+  TracingWriter(WriterBase &_writer, EnqueueStamps &_stamps, int64_t _bitrate = 0)
+  :writer_(_writer)
+  ,stamps_(_stamps)
+  ,bitrate_(_bitrate)
+  {
+  }
+
+  bool open() {
+    return writer_.open();
+  }
+
+  bool close() {
+    return writer_.close();
+  }
+
+  int flush() {
+    return writer_.flush();
+  }
+
+  std::chrono::steady_clock::time_point flushDeadline() const {
+    return writer_.flushDeadline();
+  }
+
+  int write(const unsigned char *_packet, int _packetSize) {
+    EssenceBlock *block = (EssenceBlock *) _packet;
+    if(block->essence_type == ESSENCE_TYPE_ED && (block->flags & ESSENCE_FLAG_SEQUENCED)) {
+      stamps_.put(block, essenceBlockTrace(block).stamps[TRACE_STAGE_ENQUEUE]);
+      blocks++;
+    }
+    if(bitrate_ > 0) {
+      if(!bytes) {
+        pacingStart_ = std::chrono::steady_clock::now();
+      }
+      std::this_thread::sleep_until(pacingStart_ + std::chrono::microseconds((int64_t) (bytes * 8 * 1000000 / (uint64_t) bitrate_)));
+    }
+    bytes += (uint64_t) _packetSize;
+    return writer_.write(_packet, _packetSize);
+  }
+
+  std::atomic<uint64_t> blocks = 0;
+  std::atomic<uint64_t> bytes = 0;
+
+protected:
+  WriterBase &writer_;
+  EnqueueStamps &stamps_;
+  int64_t bitrate_ = 0;
+  std::chrono::steady_clock::time_point pacingStart_;
+};
+
+// Receiver side of a run: counts essence data and records the enqueue -> parse latency
+class LoopbackParser : public ParserBase {
+public:
+  LoopbackParser(EnqueueStamps &_stamps)
+  :stamps_(_stamps)
+  {
+  }
+
+  int parse(EssenceBlock *_block) {
+    if(_block->essence_type != ESSENCE_TYPE_ED) {
+      return 0;
+    }
+    uint64_t now = traceNow();
+    uint64_t stamp = stamps_.take(_block);
+    if(stamp && now >= stamp) {
+      latency.record(now - stamp);
+    }
+    bytes += (uint64_t) _block->size + _block->payload_size;
+    lastParse = now;
+    blocks++;
+    return 0;
+  }
+
+  std::atomic<uint64_t> blocks = 0;
+  std::atomic<uint64_t> bytes = 0;
+  std::atomic<uint64_t> lastParse = 0;
+  LatencyHistogram latency;
+
+protected:
+  EnqueueStamps &stamps_;
+};
+
+// Synthetic programs: one video stream each, a key block every 50, as fast as the window allows
+void synthetic_producer(const LoopbackParams &_params, ThreadSafeQueue<EssenceBlock *> &_queue) {
+  std::vector<uint16_t> sequences(_params.programs, 0);
+  for(int i = 0; i < _params.blocks; i++) {
+    for(int program = 0; program < _params.programs; program++) {
+      while((int) _queue.size() >= _params.maxQueued) {
+        std::this_thread::yield();
+      }
+      EssenceBlock *block = createEssenceBlock(_params.payloadSize);
+      traceStamp(block, TRACE_STAGE_DEMUX);
+      block->essence_type = ESSENCE_TYPE_ED;
+      block->program_index = (uint8_t) program;
+      block->stream_type = 0;   // AVMEDIA_TYPE_VIDEO
+      block->stream_index = 0;
+      block->payload_size = _params.payloadSize;
+      block->flags = ESSENCE_FLAG_SEQUENCED | ((i % 50 == 0) ? ESSENCE_FLAG_KEY : 0);
+      block->sequence = sequences[program]++;
+      traceStamp(block, TRACE_STAGE_ENQUEUE);
+      _queue.push(block);
+    }
+  }
+}
+
+// Runs the producers into _queue until the input ends
+bool produce(const LoopbackParams &_params, ThreadSafeQueue<EssenceBlock *> &_queue) {
+  if(_params.input == "synthetic") {
+    synthetic_producer(_params, _queue);
+    return true;
+  }
+#ifndef LOOPBACK_NO_MEDIA
+  std::string url;
+  std::vector<FFMPEGProducerParams> programs;
+  int nextProgram = 0;
+  FFMPEGProducerParams defaults;
+  defaults.logBlocks = false;
+  if(!parseInputSpec(_params.input, defaults, nextProgram, url, programs)) {
+    std::cerr << "Invalid input: " << _params.input << std::endl;
+    return false;
+  }
+  DemuxSourceParams sourceParams;
+  sourceParams.statsPeriodMs = 0;
+  DemuxSource source(url, sourceParams);
+  for(FFMPEGProducerParams &program : programs) {
+    source.addProgram(program, _queue);
+  }
+  demux_source(source);
+  return true;
+#else
+  std::cerr << "Only synthetic input in this build" << std::endl;
+  return false;
+#endif
+}
+
+// One pass of the pipeline, from the producers to _writer; _parser is the far end of the writer.
+// Production starts once _ready() (the receiver can see the writer)
+json run(const std::string &_name, const LoopbackParams &_params, TracingWriter &_writer, LoopbackParser &_parser, std::function<bool()> _ready = [] { return true; }) {
+  ThreadSafeQueue<EssenceBlock *> queue;
+
+  MuxerTimestamp muxerClock;
+  muxerClock.start();
+  MuxerParams muxerParams;
+  muxerParams.bitrate = 0;   // no null padding, as fast as possible
+
+  uint64_t allocationsStart = allocations.load();
+  uint64_t start = traceNow();
+  std::thread consumerThread(muxer_consumer, std::ref(muxerParams), std::ref(queue), std::ref(_writer), std::cref(muxerClock));
+  for(int i = 0; i < 200 && !_ready(); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  bool produced = produce(_params, queue);
+
+  // the muxer sends everything queued, then returns
+  queue.close();
+  consumerThread.join();
+
+  // other threads: wait for the receiver to catch up or give up on what was lost
+  uint64_t lastCount = _parser.blocks;
+  auto lastProgress = std::chrono::steady_clock::now();
+  while(_parser.blocks < _writer.blocks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if(_parser.blocks != lastCount) {
+      lastCount = _parser.blocks;
+      lastProgress = std::chrono::steady_clock::now();
+    }
+    else if(std::chrono::steady_clock::now() - lastProgress > std::chrono::milliseconds(_params.drainTimeoutMs)) {
+      break;
+    }
+  }
+  uint64_t allocationsEnd = allocations.load();
+  uint64_t finish = _parser.lastParse ? (uint64_t) _parser.lastParse : traceNow();
+  double seconds = (finish > start ? finish - start : 1) / 1e9;
+
+  // a run that lost blocks measured a receiver that did not keep up: it fails
+  uint64_t lost = _writer.blocks > _parser.blocks ? (uint64_t) (_writer.blocks - _parser.blocks) : 0;
+  json result;
+  result["name"] = _name;
+  result["ok"] = produced && lost == 0;
+  result["blocks_sent"] = (uint64_t) _writer.blocks;
+  result["blocks_parsed"] = (uint64_t) _parser.blocks;
+  result["blocks_lost"] = lost;
+  result["seconds"] = seconds;
+  result["blocks_per_sec"] = _parser.blocks / seconds;
+  result["mbps"] = _parser.bytes * 8.0 / seconds / 1e6;
+  result["latency_us"] = {
+    { "p50", _parser.latency.quantile(0.5) / 1e3 },
+    { "p99", _parser.latency.quantile(0.99) / 1e3 },
+    { "p999", _parser.latency.quantile(0.999) / 1e3 },
+    { "samples", _parser.latency.count() }
+  };
+  result["allocations_per_block"] = _writer.blocks ? (double) (allocationsEnd - allocationsStart) / _writer.blocks : 0.0;
+
+  std::cerr << _name << ": " << _parser.blocks << "/" << _writer.blocks << " blocks, " << result["blocks_per_sec"].get<double>() << " blocks/s, "
+            << result["mbps"].get<double>() << " Mbps, p50/p99/p99.9 " << result["latency_us"]["p50"].get<double>() << "/"
+            << result["latency_us"]["p99"].get<double>() << "/" << result["latency_us"]["p999"].get<double>() << " us, "
+            << result["allocations_per_block"].get<double>() << " allocations/block";
+  if(lost) {
+    std::cerr << ", " << lost << " blocks lost";
+  }
+  std::cerr << std::endl;
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  LoopbackParams params;
+  if(argc > 1) {
+    params.input = argv[1];
+  }
+  if(argc > 2) {
+    params.blocks = atoi(argv[2]);
+  }
+  if(argc > 3) {
+    params.payloadSize = atoi(argv[3]);
+  }
+  if(argc > 4) {
+    params.programs = atoi(argv[4]);
+  }
+  if(argc > 5) {
+    params.port = atoi(argv[5]);
+  }
+  if(argc > 6) {
+    params.output = argv[6];
+  }
+  if(argc > 7) {
+    params.udpBitrate = atoll(argv[7]);
+  }
+  if(params.blocks <= 0 || params.payloadSize < 0 || params.programs <= 0 || params.programs > 256 || params.udpBitrate < 0) {
+    std::cerr << "Usage: " << argv[0] << " [input|synthetic] [blocks] [payload_bytes] [programs(1-256)] [udp_port] [output.json] [udp_bitrate]" << std::endl;
+    return -1;
+  }
+
+#ifdef _WIN32
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+  json report;
+  report["input"] = params.input;
+  if(params.input == "synthetic") {
+    report["blocks"] = params.blocks;
+    report["payload_bytes"] = params.payloadSize;
+    report["programs"] = params.programs;
+  }
+  report["runs"] = json::array();
+
+  // in memory: our own cost only
+  {
+    EnqueueStamps *stamps = new EnqueueStamps();
+    LoopbackParser parser(*stamps);
+    BlockReassembler reassembler(&parser);
+    MemoryWriter memoryWriter(reassembler);
+    TracingWriter writer(memoryWriter, *stamps);
+    report["runs"].push_back(run("memory", params, writer, parser));
+    delete stamps;
+  }
+
+  // loopback UDP: the same plus the kernel
+  {
+    EnqueueStamps *stamps = new EnqueueStamps();
+    LoopbackParser parser(*stamps);
+    UDPReader reader(&parser, "127.0.0.1", params.port);
+    UDPWriter udpWriter("127.0.0.1", params.port);
+    TracingWriter writer(udpWriter, *stamps, params.udpBitrate);
+    if(reader.open()) {
+      report["runs"].push_back(run("udp", params, writer, parser));
+      reader.close();
+    }
+    else {
+      std::cerr << "Couldn't open the UDP receiver on port " << params.port << ", skipping the UDP run" << std::endl;
+    }
+    delete stamps;
+  }
+
+  // shared memory ring: no kernel copies, no reassembly
+  {
+    EnqueueStamps *stamps = new EnqueueStamps();
+    LoopbackParser parser(*stamps);
+    ShmReader reader(&parser, params.shmName);
+    ShmWriter shmWriter(params.shmName);
+    TracingWriter writer(shmWriter, *stamps);
+    reader.open();
+    report["runs"].push_back(run("shm", params, writer, parser, [&reader] { return reader.attached(); }));
+    reader.close();
+    delete stamps;
+  }
+
+#ifdef _WIN32
+  WSACleanup();
+#endif
+
+  bool ok = true;
+  for(const json &run : report["runs"]) {
+    ok = ok && run["ok"].get<bool>();
+  }
+  report["ok"] = ok;
+
+  std::string dump = report.dump(2);
+  if(params.output.empty()) {
+    std::cout << dump << std::endl;
+    return ok ? 0 : 1;
+  }
+  std::ofstream file(params.output);
+  if(!file) {
+    std::cerr << "Error: Couldn't open " << params.output << std::endl;
+    return -1;
+  }
+  file << dump << std::endl;
+  return ok ? 0 : 1;
+}
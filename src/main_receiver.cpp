@@ -2,6 +2,8 @@
 #include <string>
 #include <chrono>
 #include <thread>
+#include <memory>
+#include <vector>
 
 // For Windows
 #ifdef _WIN32
@@ -13,7 +15,15 @@
 #include "essence_block.h"
 #include "smt_producer.h"
 #include "render_parser.h"
+#include "fanout_parser.h"
+#include "recorder_parser.h"
+#include "stream_analyzer_parser.h"
 #include "udp_reader.h"
+#include "shm_reader.h"
+#include "metrics_exporter.h"
+#include "thread_placement.h"
+#include "event_loop.h"
+#include "shutdown_signal.h"
 
 // Initialize sockets (Windows specific)
 #ifdef _WIN32
@@ -35,10 +45,52 @@ void cleanup_socket_library() {
 
 int main(int argc, char *argv[]) {
   if(argc < 3) {
-    std::cerr << "Usage: " << argv[0] << " <server_ip> <server_port>" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " <server_ip | shm://name> <server_port> [audio_sink: sdl | null | <file.wav>] [metrics_file.prom] [thread_placement] [fonts] [consumers]" << std::endl;
+    std::cerr << "  shm://<name>: shared memory ring of a sender on the same host (<server_port> unused)" << std::endl;
+    std::cerr << "  [thread_placement]: <role>=<cpus>[/rt[:<priority>]] separated by ';', roles reader, audio, consumer, present" << std::endl;
+    std::cerr << "  [fonts]: text overlay fonts, <id>=<file.ttf> separated by ';' (font 0 is the default)" << std::endl;
+    std::cerr << "  [consumers]: render | record=<file> | analyze, each [/block | drop_newest | drop_oldest[:<max queued>]], separated by ';'" << std::endl;
     return -1;
   }
 
+  // main thread event loop: metrics file; Ctrl+C / SIGTERM stop it. Signals are routed to it before
+  // any other thread starts
+  EventLoop loop;
+  ShutdownSignal shutdownSignal;
+  shutdownSignal.open(loop);
+
+  AudioPlayerParams audioParams;
+  if(argc > 3) {
+    audioParams.sink = argv[3];
+  }
+
+  // text overlays: SMT font ids mapped to TrueType files
+  GlyphAtlasParams textParams;
+  if(argc > 6 && !parseFontTable(argv[6], textParams.fonts)) {
+    std::cerr << "Invalid font table: " << argv[6] << std::endl;
+    return -1;
+  }
+
+  // received blocks shared by several consumers, each on its own thread (default: render only, on the reader thread)
+  std::vector<FanoutConsumerSpec> consumers;
+  if(argc > 7) {
+    if(!parseFanoutConsumers(argv[7], consumers)) {
+      std::cerr << "Invalid consumers: " << argv[7] << std::endl;
+      return -1;
+    }
+    for(auto &consumer : consumers) {
+      if(consumer.name != "render" && consumer.name != "analyze" && (consumer.name != "record" || consumer.argument.empty())) {
+        std::cerr << "Invalid consumer: " << consumer.name << std::endl;
+        return -1;
+      }
+      // the renderer is lossless by default (a dropped video block breaks decoding until the next key
+      // frame); monitoring consumers stay current instead of holding up the renderer
+      if(!consumer.policySet) {
+        consumer.params.policy = consumer.name == "render" ? FANOUT_BLOCK : FANOUT_DROP_OLDEST;
+      }
+    }
+  }
+
 #ifdef _WIN32
   init_socket_library(); // Initialize for Windows
 #endif
@@ -48,21 +100,79 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
+  if(audioParams.sink == "sdl" && SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+    std::cerr << "SDL audio unavailable, using null sink: " << SDL_GetError() << std::endl;
+    audioParams.sink = "null";
+  }
+
   if(!(IMG_Init(IMG_INIT_JPG) & IMG_INIT_JPG)) {
     std::cerr << "IMG_Init Error: " << IMG_GetError() << std::endl;
     SDL_Quit();
     return -1;
   }
 
-  RenderParser render;
-  UDPReader reader(&render, argv[1], std::stoi(argv[2]));
-  reader.open();
+  // cpu affinity and scheduling class per thread role, checked before the threads start
+  if(argc > 5) {
+    if(!threadPlacement().parse(argv[5])) {
+      std::cerr << "Invalid thread placement: " << argv[5] << std::endl;
+      return -1;
+    }
+    ThreadRole roles[] = { THREAD_ROLE_READER, THREAD_ROLE_AUDIO, THREAD_ROLE_CONSUMER, THREAD_ROLE_PRESENT };
+    reportThreadPlacement(roles, 4);
+  }
 
-  while(1) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  // per stage latencies, reassembly drops and video resync counters
+  MetricsExporterParams metricsParams;
+  if(argc > 4) {
+    metricsParams.path = argv[4];
   }
+  MetricsExporter metricsExporter(globalMetrics(), metricsParams);
+  metricsExporter.open(loop);
+
+  // the parsers own SDL and TTF resources: destroyed (consumer threads joined) before SDL_Quit
+  {
+    RenderParser render(audioParams, textParams);
+    StreamAnalyzerParser analyzer;
+    std::vector<std::unique_ptr<RecorderParser>> recorders;
+    FanoutParser fanout;
+    ParserBase *parser = &render;
+    if(!consumers.empty()) {
+      for(auto &consumer : consumers) {
+        if(consumer.name == "render") {
+          fanout.addConsumer(&render, consumer.params);
+        }
+        else if(consumer.name == "analyze") {
+          fanout.addConsumer(&analyzer, consumer.params);
+        }
+        else {
+          recorders.emplace_back(new RecorderParser(consumer.argument));
+          if(!recorders.back()->open()) {
+            return -1;
+          }
+          fanout.addConsumer(recorders.back().get(), consumer.params);
+        }
+      }
+      fanout.open();
+      parser = &fanout;
+    }
 
-  reader.close();
+    std::unique_ptr<ReaderBase> reader;
+    if(isShmUrl(argv[1])) {
+      reader.reset(new ShmReader(parser, std::string(argv[1]).substr(strlen(SHM_URL_PREFIX))));
+    }
+    else {
+      reader.reset(new UDPReader(parser, argv[1], std::stoi(argv[2])));
+    }
+    reader->open();
+
+    loop.run();
+
+    // orderly shutdown: no more blocks, then the consumers; their parsers go at the end of the scope
+    reader->close();
+    fanout.close();
+    metricsExporter.close();
+    shutdownSignal.close();
+  }
 
   IMG_Quit();
   SDL_Quit();
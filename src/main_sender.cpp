@@ -2,6 +2,10 @@
 #include <string>
 #include <chrono>
 #include <thread>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <atomic>
 
 // For Windows
 #ifdef _WIN32
@@ -13,9 +17,16 @@
 #include "essence_block.h"
 #include "queue_thread_safe.h"
 #include "ffmpeg_producer.h"
+#include "demux_source.h"
 #include "udp_writer.h"
+#include "shm_writer.h"
 #include "muxer_consumer.h"
 #include "smt_producer.h"
+#include "overlay_rasterizer.h"
+#include "metrics_exporter.h"
+#include "thread_placement.h"
+#include "event_loop.h"
+#include "shutdown_signal.h"
 
 // Initialize sockets (Windows specific)
 #ifdef _WIN32
@@ -37,28 +48,141 @@ void cleanup_socket_library() {
 
 int main(int argc, char *argv[]) {
   if(argc < 5) {
-    std::cerr << "Usage: " << argv[0] << " <input_file> <server_ip> <server_port> <bitrate>" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " <inputs> <server_ip | shm://name> <server_port> <bitrate> [smt_control_socket] [metrics_file.prom] [thread_placement] [overlay_raster]" << std::endl;
+    std::cerr << "  <inputs>: <url>[@<program>[~<offset ms>][:<rule>+<rule>...][,<program>...]] separated by ';'" << std::endl;
+    std::cerr << "  <rule>: v, a, s, d (type), v:<n> (nth of type), a:<lang>, codec:<name>, #<index>" << std::endl;
+    std::cerr << "  e.g. movie.ts@0,1 sends programs 0 and 1 from a single demux of movie.ts" << std::endl;
+    std::cerr << "       movie.ts@0:v:0+a:0 sends only the first video and audio streams" << std::endl;
+    std::cerr << "       movie.ts@0,1~500 timestamps program 1 half a second later than program 0" << std::endl;
+    std::cerr << "  shm://<name>: shared memory ring for receivers on the same host (<server_port> unused)" << std::endl;
+    std::cerr << "  [thread_placement]: <role>=<cpus>[/rt[:<priority>]] separated by ';', roles demux, muxer, smt (event loop)" << std::endl;
+    std::cerr << "       e.g. muxer=2/rt;demux=4-7;smt=1" << std::endl;
+    std::cerr << "  [overlay_raster]: native or <width>x<height>[,...]: overlays are sent decoded, premultiplied and" << std::endl;
+    std::cerr << "       QOI compressed, at their native size and as <asset>@<width>x<height> per size" << std::endl;
     return -1;
   }
 
+  // main thread event loop: SMT producer and metrics file. Ctrl+C / SIGTERM stop it, and so does the
+  // end of all inputs; signals are routed to it before any other thread starts
+  EventLoop loop;
+  ShutdownSignal shutdownSignal;
+  shutdownSignal.open(loop);
+
 #ifdef _WIN32
   init_socket_library(); // Initialize for Windows
 #endif
 
-  UDPWriter udpWriter(argv[2], std::stoi(argv[3]));
+  // cpu affinity and scheduling class per thread role, checked before the threads start
+  if(argc > 7) {
+    if(!threadPlacement().parse(argv[7])) {
+      std::cerr << "Invalid thread placement: " << argv[7] << std::endl;
+      return -1;
+    }
+    ThreadRole roles[] = { THREAD_ROLE_DEMUX, THREAD_ROLE_MUXER, THREAD_ROLE_SMT };
+    reportThreadPlacement(roles, 3);
+  }
+
+  // overlays decoded and scaled once here rather than by every receiver
+  std::vector<AssetRasterParams> rasterSizes;
+  if(argc > 8 && !parseAssetRasterSizes(argv[8], rasterSizes)) {
+    std::cerr << "Invalid overlay raster sizes: " << argv[8] << std::endl;
+    return -1;
+  }
+
+  // per stage latencies, queue depth and bitrates, written for a Prometheus textfile collector
+  MetricsExporterParams metricsParams;
+  if(argc > 6) {
+    metricsParams.path = argv[6];
+  }
+  MetricsExporter metricsExporter(globalMetrics(), metricsParams);
+  metricsExporter.open(loop);
+
+  // same host receivers read blocks in place from shared memory, the rest get UDP
+  std::unique_ptr<WriterBase> writer;
+  if(isShmUrl(argv[2])) {
+    writer.reset(new ShmWriter(std::string(argv[2]).substr(strlen(SHM_URL_PREFIX))));
+  }
+  else {
+    writer.reset(new UDPWriter(argv[2], std::stoi(argv[3])));
+  }
   ThreadSafeQueue<EssenceBlock *> queue;
-  FFMPEGProducerParams producerParams0 = { 0 };
-  std::thread producerThread0(ffmpeg_producer, std::ref(producerParams0), std::ref(queue), argv[1]);
-  FFMPEGProducerParams producerParams1 = { 1 };
-  std::thread producerThread1(ffmpeg_producer, std::ref(producerParams1), std::ref(queue), argv[1]);
+  // SMT encoding, announced in the EA of every program
+  std::string smtEncoding = SMT_ENCODING_BINARY;
+  // join bursts every FFMPEGProducerParams::joinBurstPeriodMs for multicast receivers, and on request
+  // through the SMT control channel
+  JoinBurstRequests joinRequests;
   MuxerParams muxerParams;
-  std::thread consumerThread(muxer_consumer, std::ref(muxerParams), std::ref(queue), std::ref(udpWriter));
-  std::thread dummySMTThread(smt_producer, std::ref(queue));
+  FFMPEGProducerParams producerDefaults;
+  producerDefaults.smtEncoding = smtEncoding;
+  producerDefaults.joinRequests = &joinRequests;
+  // a burst may take a quarter of the output bitrate, so the programs keep theirs
+  producerDefaults.joinBurstBitrate = muxerParams.bitrate / 4;
+
+  // one demux per input, fanned out to its programs
+  std::vector<std::unique_ptr<DemuxSource>> sources;
+  std::stringstream inputs(argv[1]);
+  std::string input;
+  int nextProgram = 0;
+  while(std::getline(inputs, input, ';')) {
+    std::string url;
+    std::vector<FFMPEGProducerParams> programs;
+    if(!parseInputSpec(input, producerDefaults, nextProgram, url, programs)) {
+      std::cerr << "Invalid input: " << input << std::endl;
+      return -1;
+    }
+    // live inputs: low latency options, stall detection and reconnection
+    DemuxSourceParams sourceParams;
+    sourceParams.live = isLiveUrl(url);
+    DemuxSource *source = new DemuxSource(url, sourceParams);
+    for(FFMPEGProducerParams &program : programs) {
+      program.logBlocks = !sourceParams.live;
+      if(program.timestampOffsetMs) {
+        muxerParams.timestampOffsets[program.programIndex] = program.timestampOffsetMs * 90;
+      }
+      source->addProgram(program, queue);
+    }
+    sources.emplace_back(source);
+  }
+  std::vector<std::thread> sourceThreads;
+  std::atomic<size_t> sourcesRunning = sources.size();
+  for(auto &source : sources) {
+    sourceThreads.emplace_back([&loop, &sourcesRunning](DemuxSource &_source) {
+      demux_source(_source);
+      if(--sourcesRunning == 0) {
+        loop.stop();
+      }
+    }, std::ref(*source));
+  }
+  // muxer clock, shared with the SMT producer so actions can be scheduled on block timestamps
+  MuxerTimestamp muxerClock;
+  muxerClock.start();
+  std::thread consumerThread(muxer_consumer, std::ref(muxerParams), std::ref(queue), std::ref(*writer), std::cref(muxerClock));
+  SMTProducerParams smtParams;
+  smtParams.encoding = smtEncoding;
+  smtParams.joinRequests = &joinRequests;
+  if(argc > 5) {
+    smtParams.controlPath = argv[5];
+  }
+  smtParams.rasterSizes = rasterSizes;
+  smtParams.rasterizer = rasterizeOverlayAsset;
+  SMTProducer smtProducer(smtParams, queue, muxerClock);
+  smtProducer.open(loop);
+
+  placeThread(THREAD_ROLE_SMT);
+  loop.run();
 
-  producerThread0.join();
-  producerThread1.join();
+  // orderly shutdown: inputs, then the SMT producer, then the muxer sends what is still queued
+  for(auto &source : sources) {
+    source->stop();
+  }
+  for(std::thread &sourceThread : sourceThreads) {
+    sourceThread.join();
+  }
+  smtProducer.close();
+  queue.close();
   consumerThread.join();
-  dummySMTThread.join();
+  metricsExporter.close();
+  shutdownSignal.close();
 
 #ifdef _WIN32
   cleanup_socket_library(); // Cleanup for Windows
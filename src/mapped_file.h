@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <iostream>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    close();
+  }
+
+  bool open(const std::string &_path) {
+    close();
+#ifdef _WIN32
+    file_ = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file_ == INVALID_HANDLE_VALUE) {
+      std::cerr << "Error: Couldn't open " << _path << std::endl;
+      return false;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+      std::cerr << "Error: Empty or unreadable file " << _path << std::endl;
+      close();
+      return false;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mapping_) {
+      std::cerr << "Error: CreateFileMapping failed for " << _path << std::endl;
+      close();
+      return false;
+    }
+    data_ = (const uint8_t *) MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    size_ = (size_t) size.QuadPart;
+#else
+    fd_ = ::open(_path.c_str(), O_RDONLY);
+    if(fd_ < 0) {
+      std::cerr << "Error: Couldn't open " << _path << std::endl;
+      return false;
+    }
+    struct stat st;
+    if(fstat(fd_, &st) != 0 || st.st_size == 0) {
+      std::cerr << "Error: Empty or unreadable file " << _path << std::endl;
+      close();
+      return false;
+    }
+    void *data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    data_ = (data == MAP_FAILED) ? nullptr : (const uint8_t *) data;
+    size_ = (size_t) st.st_size;
+#endif
+    if(!data_) {
+      std::cerr << "Error: Couldn't map " << _path << std::endl;
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+#ifdef _WIN32
+    if(data_) UnmapViewOfFile(data_);
+    if(mapping_) CloseHandle(mapping_);
+    if(file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if(data_) munmap((void *) data_, size_);
+    if(fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const uint8_t *data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+protected:
+#ifdef _WIN32
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include "writer_base.h"
+#include "block_reassembler.h"
+#include "udp_writer.h"
+
+// In process writer: hands what the muxer writes straight to a reassembler, cut into datagram
+// sized chunks like UDPWriter does, on the muxer thread. No sockets, no copies
+class MemoryWriter : public WriterBase {
+public:
+  MemoryWriter(BlockReassembler &_reassembler, int _chunkSize = CHUNK_SIZE)
+  :reassembler_(_reassembler)
+  ,chunkSize_(_chunkSize)
+  {
+  }
+
+  bool open() {
+    return true;
+  }
+
+  bool close() {
+    return true;
+  }
+
+  int write(const unsigned char *_packet, int _packetSize) {
+    uint64_t now = traceNow();
+    for(int offset = 0; offset < _packetSize; offset += chunkSize_) {
+      int chunkSize = (_packetSize - offset > chunkSize_) ? chunkSize_ : _packetSize - offset;
+      reassembler_.consume(_packet + offset, (size_t) chunkSize, now);
+    }
+    return _packetSize;
+  }
+
+protected:
+  BlockReassembler &reassembler_;
+  int chunkSize_ = CHUNK_SIZE;
+};
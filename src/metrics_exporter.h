@@ -0,0 +1,71 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include "metrics_registry.h"
+#include "event_loop.h"
+
+struct MetricsExporterParams {
+  std::string path;         // Prometheus text file (node_exporter textfile collector), empty = off
+  int periodMs = 1000;
+};
+
+// Writes the registry to a text file periodically, from a timer of the process event loop. The file
+// is written aside and renamed, so a scraper never reads a partial file
+class MetricsExporter {
+public:
+  MetricsExporter(MetricsRegistry &_registry, const MetricsExporterParams &_params)
+  :registry_(_registry)
+  ,params_(_params)
+  {
+  }
+
+  ~MetricsExporter() {
+    close();
+  }
+
+  bool open(EventLoop &_loop) {
+    if(params_.path.empty()) {
+      return false;
+    }
+    loop_ = &_loop;
+    timer_ = _loop.addTimer(std::chrono::milliseconds(0), [this] { write(); }, std::chrono::milliseconds(params_.periodMs));
+    std::cout << "Exporting metrics to " << params_.path << std::endl;
+    return true;
+  }
+
+  // Final write, once the loop has stopped
+  void close() {
+    if(!loop_) {
+      return;
+    }
+    loop_->cancelTimer(timer_);
+    loop_ = nullptr;
+    write();
+  }
+
+  bool write() {
+    std::string tmp = params_.path + ".tmp";
+    {
+      std::ofstream file(tmp, std::ios::out | std::ios::trunc);
+      if(!file) {
+        std::cerr << "Couldn't write metrics file " << tmp << std::endl;
+        return false;
+      }
+      registry_.writePrometheus(file);
+    }
+#ifdef _WIN32
+    std::remove(params_.path.c_str());
+#endif
+    return std::rename(tmp.c_str(), params_.path.c_str()) == 0;
+  }
+
+protected:
+  MetricsRegistry &registry_;
+  MetricsExporterParams params_;
+  EventLoop *loop_ = nullptr;
+  TimerId timer_ = 0;
+};
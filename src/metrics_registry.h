@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <ostream>
+#include "latency_histogram.h"
+
+struct Counter {
+  std::atomic<uint64_t> value = 0;
+
+  void operator++(int) {
+    value.fetch_add(1, std::memory_order_relaxed);
+  }
+  void operator+=(uint64_t _value) {
+    value.fetch_add(_value, std::memory_order_relaxed);
+  }
+  operator uint64_t() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+struct Gauge {
+  std::atomic<int64_t> value = 0;
+
+  void set(int64_t _value) {
+    value.store(_value, std::memory_order_relaxed);
+  }
+  operator int64_t() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+// Process metrics. Registration (name + labels, e.g. "program=\"0\",stream=\"1\"") takes a lock and
+// is meant for setup or first use; the returned objects are never freed or moved, so the hot path
+// keeps the reference and only does relaxed atomic updates.
+class MetricsRegistry {
+public:
+  Counter &counter(const std::string &_name, const std::string &_labels = "", const std::string &_help = "") {
+    return get(counters_, _name, _labels, _help);
+  }
+
+  Gauge &gauge(const std::string &_name, const std::string &_labels = "", const std::string &_help = "") {
+    return get(gauges_, _name, _labels, _help);
+  }
+
+  // Latency histogram, exported in seconds
+  LatencyHistogram &histogram(const std::string &_name, const std::string &_labels = "", const std::string &_help = "") {
+    return get(histograms_, _name, _labels, _help);
+  }
+
+  // Prometheus text exposition format
+  void writePrometheus(std::ostream &_out) {
+    static const double bounds[] = { 0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string last;
+    for(auto &entry : counters_) {
+      header(_out, entry.first.first, "counter", last);
+      _out << entry.first.first << labels(entry.first.second) << " " << (uint64_t) *entry.second << "\n";
+    }
+    for(auto &entry : gauges_) {
+      header(_out, entry.first.first, "gauge", last);
+      _out << entry.first.first << labels(entry.first.second) << " " << (int64_t) *entry.second << "\n";
+    }
+    for(auto &entry : histograms_) {
+      const std::string &name = entry.first.first;
+      const std::string &labelSet = entry.first.second;
+      const LatencyHistogram &histogram = *entry.second;
+      std::string prefix = labelSet.empty() ? "" : labelSet + ",";
+      header(_out, name, "histogram", last);
+      for(double bound : bounds) {
+        _out << name << "_bucket{" << prefix << "le=\"" << bound << "\"} " << histogram.countBelow((uint64_t) (bound * 1e9)) << "\n";
+      }
+      _out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << histogram.count() << "\n";
+      _out << name << "_sum" << labels(labelSet) << " " << histogram.sum() / 1e9 << "\n";
+      _out << name << "_count" << labels(labelSet) << " " << histogram.count() << "\n";
+    }
+  }
+
+protected:
+  typedef std::pair<std::string, std::string> Key;
+
+  template<typename T>
+  T &get(std::map<Key, std::unique_ptr<T>> &_metrics, const std::string &_name, const std::string &_labels, const std::string &_help) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<T> &metric = _metrics[Key(_name, _labels)];
+    if(!metric) {
+      metric.reset(new T());
+    }
+    if(!_help.empty()) {
+      help_[_name] = _help;
+    }
+    return *metric;
+  }
+
+  void header(std::ostream &_out, const std::string &_name, const char *_type, std::string &_last) {
+    if(_name == _last) {
+      return;
+    }
+    auto help = help_.find(_name);
+    if(help != help_.end()) {
+      _out << "# HELP " << _name << " " << help->second << "\n";
+    }
+    _out << "# TYPE " << _name << " " << _type << "\n";
+    _last = _name;
+  }
+
+  static std::string labels(const std::string &_labels) {
+    return _labels.empty() ? "" : "{" + _labels + "}";
+  }
+
+protected:
+  std::mutex mutex_;
+  std::map<Key, std::unique_ptr<Counter>> counters_;
+  std::map<Key, std::unique_ptr<Gauge>> gauges_;
+  std::map<Key, std::unique_ptr<LatencyHistogram>> histograms_;
+  std::map<std::string, std::string> help_;
+};
+
+// key="value" label with the value escaped
+__inline std::string metricLabel(const std::string &_key, const std::string &_value) {
+  std::string label = _key + "=\"";
+  for(char c : _value) {
+    if(c == '\\' || c == '"') {
+      label += '\\';
+      label += c;
+    }
+    else if(c == '\n') {
+      label += "\\n";
+    }
+    else {
+      label += c;
+    }
+  }
+  return label + "\"";
+}
+
+// Registry of the process, shared by every stage
+__inline MetricsRegistry &globalMetrics() {
+  static MetricsRegistry registry;
+  return registry;
+}
@@ -3,21 +3,68 @@
 #include "essence_block.h"
 #include "queue_thread_safe.h"
 #include "muxer_timestamp.h"
+#include "writer_base.h"
+#include "metrics_registry.h"
+#include "thread_placement.h"
+#include "event_loop.h"
 #include <iostream>
 #include <map>
+#include <atomic>
+#include <algorithm>
 
 struct MuxerParams {
   int bitrate = 8000000;
   int checkBitratePeriodMs = 100;
   int writeEAPeriodMs = 50;
+  std::map<int, int64_t> timestampOffsets;   // program index -> offset added to its essence data timestamps, 90 kHz
 };
 
+// Muxer clock timestamp of a block, shifted by the offset of its program. Essence data and join
+// burst blocks only: announcements, SMT tables and padding stay on the plain clock (the SMT action
+// timestamps are shifted by the receivers, by the timestamp_offset their program announces)
+__inline uint64_t muxerBlockTimestamp(const MuxerParams &_params, const EssenceBlock *_block, uint64_t _now) {
+  if(_block->essence_type != EssenceType::ESSENCE_TYPE_ED && _block->essence_type != EssenceType::ESSENCE_TYPE_JOIN) {
+    return _now;
+  }
+  auto offset = _params.timestampOffsets.find(_block->program_index);
+  if(offset == _params.timestampOffsets.end()) {
+    return _now;
+  }
+  int64_t timestamp = (int64_t) _now + offset->second;
+  return timestamp > 0 ? (uint64_t) timestamp : 0;
+}
+
 #define NULL_PAYLOAD_SIZE 1024 * 2
 
-void muxer_consumer(MuxerParams &_params, ThreadSafeQueue<EssenceBlock *> &_queue, WriterBase &_writer) {
+// Per stage latency histograms of the sender
+struct SenderStageMetrics {
+  LatencyHistogram &build = globalMetrics().histogram("sender_stage_seconds", "stage=\"build\"", "Time between sender stage boundaries");
+  LatencyHistogram &queue = globalMetrics().histogram("sender_stage_seconds", "stage=\"queue\"");
+  LatencyHistogram &send = globalMetrics().histogram("sender_stage_seconds", "stage=\"send\"");
+  LatencyHistogram &total = globalMetrics().histogram("sender_stage_seconds", "stage=\"total\"");
+};
+
+// Sends the queued blocks, pads up to the bitrate with null packets and repeats the Essence
+// Announcements. Runs an event loop on its thread: blocks wake it up, the bitrate check, the EA
+// repeat and the writer's flush deadline are timers. Returns once the queue is closed and drained
+void muxer_consumer(MuxerParams &_params, ThreadSafeQueue<EssenceBlock *> &_queue, WriterBase &_writer, const MuxerTimestamp &_mts) {
+  placeThread(THREAD_ROLE_MUXER);
+
+  typedef std::chrono::steady_clock clock;
+
   // open writer
   _writer.open();
 
+  // metrics
+  SenderStageMetrics stages;
+  Gauge &queueDepth = globalMetrics().gauge("sender_queue_depth", "", "Blocks waiting for the muxer");
+  Counter &nullBytes = globalMetrics().counter("sender_null_bytes_total", "", "Null packet padding sent");
+  Counter &eaRepeatBytes = globalMetrics().counter("sender_ea_repeat_bytes_total", "", "Essence Announcement repetitions sent");
+  std::map<int, Counter *> blockBytes;   // (type, program, stream) -> bytes sent
+
+  EventLoop loop;
+  loop.setWakeupHistogram(&wakeupDelayHistogram(THREAD_ROLE_MUXER));
+
   // null packet
   EssenceBlock *NULLBlock = createEssenceBlock(NULL_PAYLOAD_SIZE);
   NULLBlock->essence_type = EssenceType::ESSENCE_TYPE_NULL;
@@ -28,76 +75,114 @@ void muxer_consumer(MuxerParams &_params, ThreadSafeQueue<EssenceBlock *> &_queu
   NULLBlock->payload_size = NULL_PAYLOAD_SIZE;
 
   // start clock (bitrate)
-  auto startTimeBitrate = std::chrono::steady_clock::now();
+  auto startTimeBitrate = clock::now();
   uint64_t totalBytesSent = 0;
   uint64_t targetBitrate = _params.bitrate;
 
-  // timestamp
-  MuxerTimestamp mts;
-  mts.start();
-
   // Essence Announcement
   std::map<int, EssenceBlock *> eaBlocks;
-  auto startTimeEA = std::chrono::steady_clock::now();
-
-  while(true) {
-    if(!_queue.empty()) {
-      EssenceBlock *block = _queue.pop();
-      block->timestamp = mts.getCurrentTimestamp();
-
-      // write
-      int bytesSent = _writer.write((const uint8_t *) block, block->size + block->payload_size);
-      totalBytesSent += bytesSent;
-
-      // check ESSENCE_TYPE_EA blocks and clone them. Insert every x ms
-      if(block->essence_type == EssenceType::ESSENCE_TYPE_EA) {
-        int programIndex = block->program_index;
-        if(eaBlocks.find(programIndex) != eaBlocks.end()) {
-          EssenceBlock *block = eaBlocks[programIndex];
-          destroyEssenceBlock(&block);
-        }
-        eaBlocks[programIndex] = cloneEssenceBlock(block);
-      }
 
-      destroyEssenceBlock(&block);
+  // a datagram the writer holds back is sent by its deadline
+  TimerId flushTimer = 0;
+  clock::time_point flushAt = clock::time_point::max();
+  auto scheduleFlush = [&]() {
+    clock::time_point deadline = _writer.flushDeadline();
+    if(deadline == flushAt) {
+      return;
     }
-    else {
-      auto now = std::chrono::steady_clock::now();
-
-      // CBR
-      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTimeBitrate).count();
-      if(elapsed >= _params.checkBitratePeriodMs) {
-        double currentBitrate = (totalBytesSent * 8.0) / (elapsed / 1000.0); // bps
-
-        if(currentBitrate < targetBitrate) {
-          size_t nullPacketsNeeded = (size_t) (((targetBitrate - currentBitrate) / 8.0) * (elapsed / 1000.0) / (NULLBlock->size + NULLBlock->payload_size));
-
-          for(size_t i = 0; i < nullPacketsNeeded && _queue.empty(); ++i) {
-            // write
-            NULLBlock->timestamp = mts.getCurrentTimestamp();
-            _writer.write((const uint8_t *) NULLBlock, NULLBlock->size + NULLBlock->payload_size);
-          }
-        }
-
-        // Reset counters
-        totalBytesSent = 0;
-        startTimeBitrate = now;
+    if(flushTimer) {
+      loop.cancelTimer(flushTimer);
+      flushTimer = 0;
+    }
+    flushAt = deadline;
+    if(deadline != clock::time_point::max()) {
+      flushTimer = loop.addTimerAt(deadline, [&]() {
+        flushTimer = 0;
+        flushAt = clock::time_point::max();
+        _writer.flush();
+      });
+    }
+  };
+
+  loop.addQueue<EssenceBlock *>(_queue, [&](EssenceBlock *&_block) {
+    EssenceBlock *block = _block;
+    traceStamp(block, TRACE_STAGE_MUX);
+    queueDepth.set((int64_t) _queue.size());
+    block->timestamp = muxerBlockTimestamp(_params, block, _mts.getCurrentTimestamp());
+
+    // write
+    int bytesSent = _writer.write((const uint8_t *) block, block->size + block->payload_size);
+    totalBytesSent += bytesSent;
+
+    // trace
+    BlockTrace &trace = essenceBlockTrace(block);
+    trace.stamps[TRACE_STAGE_SEND] = traceNow();
+    traceRecord(trace, TRACE_STAGE_DEMUX, TRACE_STAGE_ENQUEUE, stages.build);
+    traceRecord(trace, TRACE_STAGE_ENQUEUE, TRACE_STAGE_MUX, stages.queue);
+    traceRecord(trace, TRACE_STAGE_MUX, TRACE_STAGE_SEND, stages.send);
+    traceRecord(trace, TRACE_STAGE_DEMUX, TRACE_STAGE_SEND, stages.total);
+
+    // bytes per program / stream, for bitrates
+    int key = (block->essence_type << 16) | (block->program_index << 8) | block->stream_index;
+    Counter *&bytes = blockBytes[key];
+    if(!bytes) {
+      std::string labels = "type=\"" + std::to_string(block->essence_type) + "\",program=\"" + std::to_string(block->program_index) + "\",stream=\"" + std::to_string(block->stream_index) + "\"";
+      bytes = &globalMetrics().counter("sender_bytes_total", labels, "Block bytes sent per essence type, program and stream");
+    }
+    *bytes += (uint64_t) bytesSent;
+
+    // check ESSENCE_TYPE_EA blocks and clone them. Insert every x ms
+    if(block->essence_type == EssenceType::ESSENCE_TYPE_EA) {
+      int programIndex = block->program_index;
+      if(eaBlocks.find(programIndex) != eaBlocks.end()) {
+        EssenceBlock *block = eaBlocks[programIndex];
+        destroyEssenceBlock(&block);
       }
+      eaBlocks[programIndex] = cloneEssenceBlock(block);
+    }
 
-      // Essence announcement
-      elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTimeEA).count();
-      if(elapsed >= _params.writeEAPeriodMs) {
-        for(auto& pair : eaBlocks) {
-          EssenceBlock *block = pair.second;
-          block->timestamp = mts.getCurrentTimestamp();
-          _writer.write((const uint8_t *) block, block->size + block->payload_size);
+    // the GOP cache of a program may still hold the block
+    releaseEssenceBlock(&block);
+    scheduleFlush();
+  });
+
+  // CBR: pad what the blocks left of the bitrate, as long as no block is waiting
+  if(targetBitrate > 0) {
+    loop.addTimer(std::chrono::milliseconds(_params.checkBitratePeriodMs), [&]() {
+      auto now = clock::now();
+      double elapsed = std::chrono::duration<double>(now - startTimeBitrate).count();
+      double currentBitrate = (totalBytesSent * 8.0) / elapsed; // bps
+
+      if(currentBitrate < targetBitrate) {
+        size_t nullPacketsNeeded = (size_t) (((targetBitrate - currentBitrate) / 8.0) * elapsed / (NULLBlock->size + NULLBlock->payload_size));
+
+        for(size_t i = 0; i < nullPacketsNeeded && _queue.empty(); ++i) {
+          // write
+          NULLBlock->timestamp = _mts.getCurrentTimestamp();
+          nullBytes += (uint64_t) _writer.write((const uint8_t *) NULLBlock, NULLBlock->size + NULLBlock->payload_size);
         }
-        startTimeEA = now;
       }
-    }
+
+      // Reset counters
+      totalBytesSent = 0;
+      startTimeBitrate = now;
+      scheduleFlush();
+    }, std::chrono::milliseconds(_params.checkBitratePeriodMs));
   }
 
-  // Close writer
+  // Essence announcement
+  loop.addTimer(std::chrono::milliseconds(_params.writeEAPeriodMs), [&]() {
+    for(auto& pair : eaBlocks) {
+      EssenceBlock *block = pair.second;
+      block->timestamp = _mts.getCurrentTimestamp();
+      eaRepeatBytes += (uint64_t) _writer.write((const uint8_t *) block, block->size + block->payload_size);
+    }
+    scheduleFlush();
+  }, std::chrono::milliseconds(_params.writeEAPeriodMs));
+
+  loop.run();
+
+  // Close writer (sends what it still holds)
   _writer.close();
 
   // NULL
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include "audio_sink_base.h"
+
+// Headless sink. Drains the ring in real time and, if a path is given, records the samples into a WAV file
+class NullAudioSink : public AudioSinkBase {
+public:
+  NullAudioSink(const std::string &_wavPath = "")
+  :wavPath_(_wavPath)
+  {
+  }
+
+  ~NullAudioSink() {
+    close();
+  }
+
+  bool open(SPSCRingBuffer<int16_t> *_ring, int _sampleRate, int _channels, int _bufferFrames) {
+    ring_ = _ring;
+    sampleRate_ = _sampleRate;
+    channels_ = _channels;
+    bufferFrames_ = _bufferFrames;
+
+    if(!wavPath_.empty()) {
+      wavFile_.open(wavPath_, std::ios::binary);
+      if(!wavFile_) {
+        std::cerr << "Failed to open file: " << wavPath_ << std::endl;
+        return false;
+      }
+      writeWavHeader(0);
+    }
+
+    stopFlag_ = false;
+    workerThread_ = std::thread(&NullAudioSink::drainLoop, this);
+
+    return true;
+  }
+
+  bool close() {
+    stopFlag_ = true;
+    if(workerThread_.joinable()) {
+      workerThread_.join();
+    }
+
+    if(wavFile_.is_open()) {
+      wavFile_.seekp(0);
+      writeWavHeader(dataBytes_);
+      wavFile_.close();
+    }
+
+    return true;
+  }
+
+  int latencyFrames() {
+    return bufferFrames_;
+  }
+
+  uint64_t underruns() {
+    return underruns_.load(std::memory_order_relaxed);
+  }
+
+protected:
+  void drainLoop() {
+    std::vector<int16_t> buffer(bufferFrames_ * channels_);
+    auto period = std::chrono::microseconds((int64_t) bufferFrames_ * 1000000 / sampleRate_);
+    auto next = std::chrono::steady_clock::now();
+
+    while(!stopFlag_) {
+      next += period;
+      std::this_thread::sleep_until(next);
+
+      size_t read = ring_->read(buffer.data(), buffer.size());
+      if(read < buffer.size()) {
+        std::fill(buffer.begin() + read, buffer.end(), (int16_t) 0);
+        underruns_.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      if(wavFile_.is_open()) {
+        wavFile_.write((const char *) buffer.data(), buffer.size() * sizeof(int16_t));
+        dataBytes_ += (uint32_t) (buffer.size() * sizeof(int16_t));
+      }
+    }
+  }
+
+  void writeWavHeader(uint32_t _dataBytes) {
+    auto put32 = [&](uint32_t _v) { wavFile_.write((const char *) &_v, 4); };
+    auto put16 = [&](uint16_t _v) { wavFile_.write((const char *) &_v, 2); };
+    wavFile_.write("RIFF", 4);
+    put32(36 + _dataBytes);
+    wavFile_.write("WAVEfmt ", 8);
+    put32(16);                                // fmt chunk size
+    put16(1);                                 // PCM
+    put16((uint16_t) channels_);
+    put32(sampleRate_);
+    put32(sampleRate_ * channels_ * 2);       // byte rate
+    put16((uint16_t) (channels_ * 2));        // block align
+    put16(16);                                // bits per sample
+    wavFile_.write("data", 4);
+    put32(_dataBytes);
+  }
+
+protected:
+  std::string wavPath_;
+  std::ofstream wavFile_;
+  uint32_t dataBytes_ = 0;
+  SPSCRingBuffer<int16_t> *ring_ = nullptr;
+  int sampleRate_ = 48000;
+  int channels_ = 2;
+  int bufferFrames_ = 256;
+  std::thread workerThread_;
+  std::atomic<bool> stopFlag_ = false;
+  std::atomic<uint64_t> underruns_ = 0;
+};
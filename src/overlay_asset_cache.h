@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <SDL.h>
+
+#define OVERLAY_ASSET_CACHE_BUDGET 64 * 1024 * 1024
+
+// LRU cache of decoded overlay assets keyed by content hash.
+// Besides the decoded original, scaled variants (hash, width, height) are kept so that
+// showing a known logo again at a known size costs neither a decode nor a rescale.
+// Surfaces are shared: evicting an entry never invalidates a surface a layer still holds.
+class OverlayAssetCache {
+public:
+  OverlayAssetCache(size_t _budgetBytes = OVERLAY_ASSET_CACHE_BUDGET)
+  :budgetBytes_(_budgetBytes)
+  {
+  }
+
+  static std::shared_ptr<SDL_Surface> makeShared(SDL_Surface *_surface) {
+    return std::shared_ptr<SDL_Surface>(_surface, SDL_FreeSurface);
+  }
+
+  bool contains(uint64_t _hash) const {
+    return entries_.find(Key{ _hash, 0, 0 }) != entries_.end();
+  }
+
+  // Decoded original (_width == 0) or scaled variant. Marks the entry as recently used
+  std::shared_ptr<SDL_Surface> find(uint64_t _hash, int _width = 0, int _height = 0) {
+    auto it = entries_.find(Key{ _hash, _width, _height });
+    if(it == entries_.end()) {
+      return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->surface;
+  }
+
+  void insert(uint64_t _hash, int _width, int _height, const std::shared_ptr<SDL_Surface> &_surface) {
+    Key key{ _hash, _width, _height };
+    auto it = entries_.find(key);
+    if(it != entries_.end()) {
+      usedBytes_ -= it->second->bytes;
+      lru_.erase(it->second);
+      entries_.erase(it);
+    }
+
+    size_t bytes = (size_t) _surface->pitch * _surface->h;
+    lru_.push_front(Entry{ key, _surface, bytes });
+    entries_[key] = lru_.begin();
+    usedBytes_ += bytes;
+
+    // evict least recently used entries, never the one just inserted
+    while(usedBytes_ > budgetBytes_ && lru_.size() > 1) {
+      Entry &victim = lru_.back();
+      usedBytes_ -= victim.bytes;
+      entries_.erase(victim.key);
+      lru_.pop_back();
+    }
+  }
+
+  // Variant of asset _hash scaled to _width x _height, created from the original on first use
+  std::shared_ptr<SDL_Surface> getScaled(uint64_t _hash, int _width, int _height) {
+    std::shared_ptr<SDL_Surface> scaled = find(_hash, _width, _height);
+    if(scaled) {
+      return scaled;
+    }
+
+    std::shared_ptr<SDL_Surface> original = find(_hash);
+    if(!original) {
+      return nullptr;
+    }
+    if(original->w == _width && original->h == _height) {
+      return original;
+    }
+
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, _width, _height, 32, original->format->format);
+    if(!surface) {
+      std::cerr << "SDL_CreateRGBSurfaceWithFormat Error: " << SDL_GetError() << std::endl;
+      return original;
+    }
+    if(SDL_SoftStretchLinear(original.get(), nullptr, surface, nullptr) != 0) {
+      std::cerr << "SDL_SoftStretchLinear Error: " << SDL_GetError() << std::endl;
+      SDL_FreeSurface(surface);
+      return original;
+    }
+    scaled = makeShared(surface);
+    insert(_hash, _width, _height, scaled);
+    return scaled;
+  }
+
+  size_t usedBytes() const {
+    return usedBytes_;
+  }
+
+protected:
+  struct Key {
+    uint64_t hash;
+    int width;
+    int height;
+    bool operator==(const Key &_other) const {
+      return hash == _other.hash && width == _other.width && height == _other.height;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &_key) const {
+      return (size_t) (_key.hash ^ ((uint64_t) _key.width << 32) ^ (uint64_t) _key.height);
+    }
+  };
+
+  struct Entry {
+    Key key;
+    std::shared_ptr<SDL_Surface> surface;
+    size_t bytes;
+  };
+
+protected:
+  size_t budgetBytes_ = 0;
+  size_t usedBytes_ = 0;
+  std::list<Entry> lru_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries_;
+};
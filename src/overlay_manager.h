@@ -0,0 +1,254 @@
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <SDL.h>
+#include "smt_action.h"
+#include "text_renderer_base.h"
+
+// Overlay surfaces are ARGB8888 with premultiplied alpha: sender rasterized assets arrive that way,
+// decoded ones are converted once (premultiplySurface), and scaling them doesn't bleed color at edges
+__inline void premultiplySurface(SDL_Surface *_surface) {
+  for(int y = 0; y < _surface->h; y++) {
+    uint32_t *row = (uint32_t *) ((uint8_t *) _surface->pixels + (size_t) y * _surface->pitch);
+    for(int x = 0; x < _surface->w; x++) {
+      uint32_t pixel = row[x];
+      uint32_t a = pixel >> 24;
+      if(a != 255) {
+        uint32_t r = (((pixel >> 16) & 0xff) * a + 127) / 255;
+        uint32_t g = (((pixel >> 8) & 0xff) * a + 127) / 255;
+        uint32_t b = ((pixel & 0xff) * a + 127) / 255;
+        row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+      }
+    }
+  }
+}
+
+__inline SDL_BlendMode premultipliedBlendMode() {
+  static SDL_BlendMode mode = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+                                                         SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+  return mode;
+}
+
+struct OverlayLayer {
+  uint64_t id = 0;
+  OverlayPlacement placement;
+  bool visible = true;
+  uint64_t contentHash = 0;
+  std::shared_ptr<SDL_Surface> surface;   // decoded content waiting to be uploaded
+  SDL_Texture *texture = nullptr;   // uploaded content
+  int textureWidth = 0;
+  int textureHeight = 0;
+  // text layers
+  bool isText = false;
+  SMTText text;
+  std::u32string codepoints;        // text decoded once when it changes
+  uint64_t scrollStart = 0;         // clock at the first frame the ticker text was shown, 0 = not shown yet
+};
+
+// Overlay layer table keyed by SMT action id.
+// Layers are composited in z-order; content is uploaded to the GPU only when it changes.
+class OverlayManager {
+public:
+  ~OverlayManager() {
+    clear();
+  }
+
+  // True if layer _id already shows the content identified by _hash (no need to decode it again)
+  bool hasContent(uint64_t _id, uint64_t _hash) const {
+    auto it = layers_.find(_id);
+    return it != layers_.end() && it->second.contentHash == _hash && (it->second.texture || it->second.surface);
+  }
+
+  // Set layer content, creating the layer if needed. _surface may be shared with the asset cache
+  void setContent(uint64_t _id, uint64_t _hash, const std::shared_ptr<SDL_Surface> &_surface) {
+    OverlayLayer &layer = getLayer(_id);
+    layer.surface = _surface;
+    layer.contentHash = _hash;
+    layer.isText = false;
+  }
+
+  // Set the text and style fields present in _fields, creating a text layer if needed
+  void setText(uint64_t _id, const SMTText &_text, uint32_t _fields) {
+    OverlayLayer &layer = getLayer(_id);
+    layer.isText = true;
+    if(_fields & SMT_FIELD_TEXT) {
+      layer.text.text = _text.text;
+      decodeUTF8(layer.text.text, layer.codepoints);
+      layer.scrollStart = 0;
+    }
+    if(_fields & SMT_FIELD_FONT) layer.text.fontId = _text.fontId;
+    if(_fields & SMT_FIELD_COLOR) layer.text.color = _text.color;
+    if(_fields & SMT_FIELD_SCROLL) layer.text.scrollSpeed = _text.scrollSpeed;
+  }
+
+  bool isText(uint64_t _id) const {
+    auto it = layers_.find(_id);
+    return it != layers_.end() && it->second.isText;
+  }
+
+  // Glyph source of text layers. Without one, text layers are not drawn
+  void setTextRenderer(TextRendererBase *_textRenderer) {
+    textRenderer_ = _textRenderer;
+  }
+
+  void setPlacement(uint64_t _id, const OverlayPlacement &_placement) {
+    OverlayLayer &layer = getLayer(_id);
+    if(layer.placement.zOrder != _placement.zOrder) {
+      orderDirty_ = true;
+    }
+    layer.placement = _placement;
+  }
+
+  void setVisible(uint64_t _id, bool _visible) {
+    auto it = layers_.find(_id);
+    if(it != layers_.end()) {
+      it->second.visible = _visible;
+    }
+  }
+
+  bool contains(uint64_t _id) const {
+    return layers_.find(_id) != layers_.end();
+  }
+
+  const OverlayPlacement *getPlacement(uint64_t _id) const {
+    auto it = layers_.find(_id);
+    return it != layers_.end() ? &it->second.placement : nullptr;
+  }
+
+  void remove(uint64_t _id) {
+    auto it = layers_.find(_id);
+    if(it != layers_.end()) {
+      releaseLayer(it->second);
+      layers_.erase(it);
+      orderDirty_ = true;
+    }
+  }
+
+  void clear() {
+    for(auto &pair : layers_) {
+      releaseLayer(pair.second);
+    }
+    layers_.clear();
+    sortedLayers_.clear();
+    orderDirty_ = false;
+  }
+
+  // Composite visible layers over the current render target of _width x _height pixels.
+  // _clock (90 kHz, the frame timestamp) drives ticker scrolling
+  void render(SDL_Renderer *_renderer, int _width, int _height, uint64_t _clock = 0) {
+    if(orderDirty_) {
+      sortedLayers_.clear();
+      for(auto &pair : layers_) {
+        sortedLayers_.push_back(&pair.second);
+      }
+      std::sort(sortedLayers_.begin(), sortedLayers_.end(), [](const OverlayLayer *_a, const OverlayLayer *_b) {
+        return (_a->placement.zOrder != _b->placement.zOrder) ? _a->placement.zOrder < _b->placement.zOrder : _a->id < _b->id;
+      });
+      orderDirty_ = false;
+    }
+
+    for(OverlayLayer *layer : sortedLayers_) {
+      if(!layer->visible || layer->placement.opacity == 0) {
+        continue;
+      }
+
+      SDL_Rect rect;
+      rect.x = (int) (layer->placement.xPercentage * _width / 100.0);
+      rect.y = (int) (layer->placement.yPercentage * _height / 100.0);
+      rect.w = (int) (layer->placement.widthPercentage * _width / 100.0);
+      rect.h = (int) (layer->placement.heightPercentage * _height / 100.0);
+      if(rect.w <= 0 || rect.h <= 0 || rect.x >= _width || rect.y >= _height || rect.x + rect.w <= 0 || rect.y + rect.h <= 0) {
+        continue;
+      }
+
+      if(layer->isText) {
+        renderText(_renderer, *layer, rect, _width, _clock);
+        continue;
+      }
+      if(layer->surface) {
+        upload(_renderer, *layer);
+      }
+      if(!layer->texture) {
+        continue;
+      }
+
+      // premultiplied content: opacity scales color and alpha alike
+      uint8_t opacity = layer->placement.opacity;
+      SDL_SetTextureColorMod(layer->texture, opacity, opacity, opacity);
+      SDL_SetTextureAlphaMod(layer->texture, opacity);
+      SDL_RenderCopy(_renderer, layer->texture, nullptr, &rect);
+    }
+  }
+
+protected:
+  OverlayLayer &getLayer(uint64_t _id) {
+    auto it = layers_.find(_id);
+    if(it == layers_.end()) {
+      it = layers_.emplace(_id, OverlayLayer()).first;
+      it->second.id = _id;
+      orderDirty_ = true;
+    }
+    return it->second;
+  }
+
+  // One line of text filling the layer height, clipped to the layer. Tickers enter at the right
+  // edge, leave at the left one and start over
+  void renderText(SDL_Renderer *_renderer, OverlayLayer &_layer, const SDL_Rect &_rect, int _width, uint64_t _clock) {
+    if(!textRenderer_ || _layer.codepoints.empty()) {
+      return;
+    }
+    int x = _rect.x;
+    if(_layer.text.scrollSpeed > 0.0f) {
+      if(!_layer.scrollStart || _clock < _layer.scrollStart) {
+        _layer.scrollStart = _clock ? _clock : 1;
+      }
+      int textWidth = textRenderer_->measure(_layer.text.fontId, _rect.h, _layer.codepoints);
+      double pixelsPerSecond = _layer.text.scrollSpeed * _width / 100.0;
+      int64_t travel = (int64_t) ((_clock - _layer.scrollStart) * pixelsPerSecond / 90000.0);
+      x = _rect.x + _rect.w - (int) (travel % (_rect.w + textWidth));
+    }
+    SDL_RenderSetClipRect(_renderer, &_rect);
+    textRenderer_->draw(_renderer, _layer.text.fontId, _rect.h, _layer.codepoints, x, _rect.y, _rect, _layer.text.color, _layer.placement.opacity);
+    SDL_RenderSetClipRect(_renderer, nullptr);
+  }
+
+  // Upload pending content, reusing the texture when the size is unchanged
+  void upload(SDL_Renderer *_renderer, OverlayLayer &_layer) {
+    SDL_Surface *surface = _layer.surface.get();
+    if(!_layer.texture || _layer.textureWidth != surface->w || _layer.textureHeight != surface->h) {
+      if(_layer.texture) {
+        SDL_DestroyTexture(_layer.texture);
+      }
+      _layer.texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, surface->w, surface->h);
+      if(!_layer.texture) {
+        std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+        return;
+      }
+      SDL_SetTextureBlendMode(_layer.texture, premultipliedBlendMode());
+      _layer.textureWidth = surface->w;
+      _layer.textureHeight = surface->h;
+    }
+    SDL_UpdateTexture(_layer.texture, nullptr, surface->pixels, surface->pitch);
+
+    _layer.surface.reset();
+  }
+
+  void releaseLayer(OverlayLayer &_layer) {
+    _layer.surface.reset();
+    if(_layer.texture) {
+      SDL_DestroyTexture(_layer.texture);
+      _layer.texture = nullptr;
+    }
+  }
+
+protected:
+  std::unordered_map<uint64_t, OverlayLayer> layers_;
+  std::vector<OverlayLayer *> sortedLayers_;
+  TextRendererBase *textRenderer_ = nullptr;
+  bool orderDirty_ = false;
+};
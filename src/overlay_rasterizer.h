@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include "smt_binary.h"
+#include "qoi_codec.h"
+#include "asset_registry.h"
+extern "C" {
+  #include <libavcodec/avcodec.h>
+  #include <libswscale/swscale.h>
+  #include <libavutil/imgutils.h>
+}
+
+// Overlay pixels as the receivers want them: 8 bit RGBA, alpha premultiplied, at the size it is shown
+struct OverlayRaster {
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> pixels;   // width * 4 bytes per row
+};
+
+__inline void premultiplyRGBA(uint8_t *_pixels, size_t _count) {
+  for(size_t i = 0; i < _count; i++, _pixels += 4) {
+    uint32_t a = _pixels[3];
+    if(a != 255) {
+      _pixels[0] = (uint8_t) ((_pixels[0] * a + 127) / 255);
+      _pixels[1] = (uint8_t) ((_pixels[1] * a + 127) / 255);
+      _pixels[2] = (uint8_t) ((_pixels[2] * a + 127) / 255);
+    }
+  }
+}
+
+// Decode a JPEG / PNG asset once (libavcodec), premultiply and scale it to _width x _height (0 = native
+// size). Scaling happens after premultiplication so transparent edges don't bleed their color in
+__inline bool rasterizeOverlay(const uint8_t *_data, size_t _size, uint8_t _dataType, int _width, int _height, OverlayRaster &_raster) {
+  const AVCodec *codec = avcodec_find_decoder(_dataType == SMT_DATA_JPEG ? AV_CODEC_ID_MJPEG : AV_CODEC_ID_PNG);
+  AVCodecContext *codecCtx = codec ? avcodec_alloc_context3(codec) : nullptr;
+  AVPacket *packet = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  bool decoded = false;
+  if(codecCtx && packet && frame && avcodec_open2(codecCtx, codec, nullptr) >= 0 && av_new_packet(packet, (int) _size) >= 0) {
+    memcpy(packet->data, _data, _size);
+    decoded = avcodec_send_packet(codecCtx, packet) >= 0 && avcodec_send_packet(codecCtx, nullptr) >= 0 && avcodec_receive_frame(codecCtx, frame) >= 0;
+  }
+  av_packet_free(&packet);
+  avcodec_free_context(&codecCtx);
+  if(!decoded) {
+    std::cerr << "Error: Couldn't decode overlay asset" << std::endl;
+    av_frame_free(&frame);
+    return false;
+  }
+
+  // native size RGBA, premultiplied
+  OverlayRaster native;
+  native.width = frame->width;
+  native.height = frame->height;
+  native.pixels.resize((size_t) native.width * native.height * 4);
+  SwsContext *swsCtx = sws_getContext(frame->width, frame->height, (AVPixelFormat) frame->format, native.width, native.height, AV_PIX_FMT_RGBA, SWS_POINT, nullptr, nullptr, nullptr);
+  if(!swsCtx) {
+    av_frame_free(&frame);
+    return false;
+  }
+  uint8_t *dst[4] = { native.pixels.data(), nullptr, nullptr, nullptr };
+  int dstStride[4] = { native.width * 4, 0, 0, 0 };
+  sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+  sws_freeContext(swsCtx);
+  av_frame_free(&frame);
+  premultiplyRGBA(native.pixels.data(), (size_t) native.width * native.height);
+
+  int width = _width > 0 ? _width : native.width;
+  int height = _height > 0 ? _height : native.height;
+  if(width == native.width && height == native.height) {
+    _raster = std::move(native);
+    return true;
+  }
+
+  _raster.width = width;
+  _raster.height = height;
+  _raster.pixels.resize((size_t) width * height * 4);
+  swsCtx = sws_getContext(native.width, native.height, AV_PIX_FMT_RGBA, width, height, AV_PIX_FMT_RGBA, SWS_AREA | SWS_ACCURATE_RND, nullptr, nullptr, nullptr);
+  if(!swsCtx) {
+    return false;
+  }
+  const uint8_t *src[4] = { native.pixels.data(), nullptr, nullptr, nullptr };
+  int srcStride[4] = { native.width * 4, 0, 0, 0 };
+  dst[0] = _raster.pixels.data();
+  dstStride[0] = width * 4;
+  sws_scale(swsCtx, src, srcStride, 0, native.height, dst, dstStride);
+  sws_freeContext(swsCtx);
+  return true;
+}
+
+// AssetRasterizer producing the receiver ready form (SMT_DATA_QOI): premultiplied RGBA, QOI compressed
+__inline bool rasterizeOverlayAsset(const uint8_t *_data, size_t _size, uint8_t _dataType, const AssetRasterParams &_params, std::vector<uint8_t> &_payload, int &_width, int &_height) {
+  OverlayRaster raster;
+  if(!rasterizeOverlay(_data, _size, _dataType, _params.width, _params.height, raster)) {
+    return false;
+  }
+  _width = raster.width;
+  _height = raster.height;
+  return qoiEncode(raster.pixels.data(), raster.width, raster.height, raster.width * 4, _payload);
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// QOI ("Quite OK Image") lossless RGBA codec, https://qoiformat.org/qoi-specification.pdf
+// Single pass, no entropy coder: decodes an overlay several times faster than PNG at a
+// comparable size for flat graphics (logos, tickers, lower thirds)
+#define QOI_MAGIC 0x716f6966           // "qoif"
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+#define QOI_MAX_DIMENSION 16384
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_MASK_2 0xc0
+
+#define QOI_SRGB 0
+#define QOI_LINEAR 1
+
+struct QOIInfo {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint8_t channels = 4;
+  uint8_t colorspace = QOI_SRGB;
+};
+
+namespace qoi_detail {
+  struct Pixel {
+    uint8_t r, g, b, a;
+  };
+
+  __inline int hash(const Pixel &_p) {
+    return (_p.r * 3 + _p.g * 5 + _p.b * 7 + _p.a * 11) & 63;
+  }
+
+  __inline bool equal(const Pixel &_a, const Pixel &_b) {
+    return _a.r == _b.r && _a.g == _b.g && _a.b == _b.b && _a.a == _b.a;
+  }
+
+  __inline void write32(uint8_t *_out, uint32_t _value) {
+    _out[0] = (uint8_t) (_value >> 24);
+    _out[1] = (uint8_t) (_value >> 16);
+    _out[2] = (uint8_t) (_value >> 8);
+    _out[3] = (uint8_t) _value;
+  }
+
+  __inline uint32_t read32(const uint8_t *_in) {
+    return ((uint32_t) _in[0] << 24) | ((uint32_t) _in[1] << 16) | ((uint32_t) _in[2] << 8) | _in[3];
+  }
+}
+
+__inline bool qoiReadHeader(const uint8_t *_data, size_t _size, QOIInfo &_info) {
+  if(_size < QOI_HEADER_SIZE + QOI_PADDING_SIZE || qoi_detail::read32(_data) != QOI_MAGIC) {
+    return false;
+  }
+  _info.width = qoi_detail::read32(_data + 4);
+  _info.height = qoi_detail::read32(_data + 8);
+  _info.channels = _data[12];
+  _info.colorspace = _data[13];
+  return _info.width > 0 && _info.height > 0 && _info.width <= QOI_MAX_DIMENSION && _info.height <= QOI_MAX_DIMENSION
+      && (_info.channels == 3 || _info.channels == 4) && _info.colorspace <= QOI_LINEAR;
+}
+
+// Encode 8 bit RGBA pixels (_stride bytes per row) into _out
+__inline bool qoiEncode(const uint8_t *_rgba, int _width, int _height, int _stride, std::vector<uint8_t> &_out, uint8_t _colorspace = QOI_SRGB) {
+  using namespace qoi_detail;
+  if(_width <= 0 || _height <= 0 || _width > QOI_MAX_DIMENSION || _height > QOI_MAX_DIMENSION) {
+    return false;
+  }
+  // worst case: every pixel as QOI_OP_RGBA
+  _out.resize(QOI_HEADER_SIZE + (size_t) _width * _height * 5 + QOI_PADDING_SIZE);
+  uint8_t *out = _out.data();
+  write32(out, QOI_MAGIC);
+  write32(out + 4, (uint32_t) _width);
+  write32(out + 8, (uint32_t) _height);
+  out[12] = 4;
+  out[13] = _colorspace;
+  size_t p = QOI_HEADER_SIZE;
+
+  Pixel index[64];
+  memset(index, 0, sizeof(index));
+  Pixel previous = { 0, 0, 0, 255 };
+  int run = 0;
+  for(int y = 0; y < _height; y++) {
+    const uint8_t *row = _rgba + (size_t) y * _stride;
+    for(int x = 0; x < _width; x++) {
+      Pixel px = { row[x * 4], row[x * 4 + 1], row[x * 4 + 2], row[x * 4 + 3] };
+      if(equal(px, previous)) {
+        if(++run == 62) {
+          out[p++] = (uint8_t) (QOI_OP_RUN | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+      if(run > 0) {
+        out[p++] = (uint8_t) (QOI_OP_RUN | (run - 1));
+        run = 0;
+      }
+
+      int position = hash(px);
+      if(equal(index[position], px)) {
+        out[p++] = (uint8_t) (QOI_OP_INDEX | position);
+      }
+      else {
+        index[position] = px;
+        if(px.a == previous.a) {
+          int8_t dr = (int8_t) (px.r - previous.r);
+          int8_t dg = (int8_t) (px.g - previous.g);
+          int8_t db = (int8_t) (px.b - previous.b);
+          int8_t drdg = (int8_t) (dr - dg);
+          int8_t dbdg = (int8_t) (db - dg);
+          if(dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+            out[p++] = (uint8_t) (QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+          }
+          else if(drdg > -9 && drdg < 8 && dg > -33 && dg < 32 && dbdg > -9 && dbdg < 8) {
+            out[p++] = (uint8_t) (QOI_OP_LUMA | (dg + 32));
+            out[p++] = (uint8_t) (((drdg + 8) << 4) | (dbdg + 8));
+          }
+          else {
+            out[p++] = QOI_OP_RGB;
+            out[p++] = px.r;
+            out[p++] = px.g;
+            out[p++] = px.b;
+          }
+        }
+        else {
+          out[p++] = QOI_OP_RGBA;
+          out[p++] = px.r;
+          out[p++] = px.g;
+          out[p++] = px.b;
+          out[p++] = px.a;
+        }
+      }
+      previous = px;
+    }
+  }
+  if(run > 0) {
+    out[p++] = (uint8_t) (QOI_OP_RUN | (run - 1));
+  }
+  memset(out + p, 0, QOI_PADDING_SIZE - 1);
+  out[p + QOI_PADDING_SIZE - 1] = 1;
+  _out.resize(p + QOI_PADDING_SIZE);
+  return true;
+}
+
+// Decode straight into 32 bit pixels (A << 24 | R << 16 | G << 8 | B, i.e. SDL ARGB8888),
+// _pitch bytes per row. Truncated or corrupt input leaves the remaining pixels as they are
+__inline bool qoiDecodeARGB(const uint8_t *_data, size_t _size, uint32_t *_pixels, int _pitch) {
+  using namespace qoi_detail;
+  QOIInfo info;
+  if(!qoiReadHeader(_data, _size, info)) {
+    return false;
+  }
+
+  Pixel index[64];
+  memset(index, 0, sizeof(index));
+  Pixel px = { 0, 0, 0, 255 };
+  size_t p = QOI_HEADER_SIZE;
+  size_t end = _size - QOI_PADDING_SIZE;
+  int run = 0;
+  for(uint32_t y = 0; y < info.height; y++) {
+    uint32_t *row = (uint32_t *) ((uint8_t *) _pixels + (size_t) y * _pitch);
+    for(uint32_t x = 0; x < info.width; x++) {
+      if(run > 0) {
+        run--;
+      }
+      else {
+        if(p >= end) {
+          return false;
+        }
+        uint8_t b1 = _data[p++];
+        if(b1 == QOI_OP_RGB) {
+          if(p + 3 > end) return false;
+          px.r = _data[p++];
+          px.g = _data[p++];
+          px.b = _data[p++];
+        }
+        else if(b1 == QOI_OP_RGBA) {
+          if(p + 4 > end) return false;
+          px.r = _data[p++];
+          px.g = _data[p++];
+          px.b = _data[p++];
+          px.a = _data[p++];
+        }
+        else if((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+          px = index[b1];
+        }
+        else if((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+          px.r += ((b1 >> 4) & 0x03) - 2;
+          px.g += ((b1 >> 2) & 0x03) - 2;
+          px.b += (b1 & 0x03) - 2;
+        }
+        else if((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+          if(p >= end) return false;
+          uint8_t b2 = _data[p++];
+          int vg = (b1 & 0x3f) - 32;
+          px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+          px.g += vg;
+          px.b += vg - 8 + (b2 & 0x0f);
+        }
+        else {
+          run = b1 & 0x3f;
+        }
+        index[hash(px)] = px;
+      }
+      row[x] = ((uint32_t) px.a << 24) | ((uint32_t) px.r << 16) | ((uint32_t) px.g << 8) | px.b;
+    }
+  }
+  return true;
+}
@@ -3,18 +3,31 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <functional>
 
+// Blocking FIFO between threads. A queue can also wake an EventLoop (setListener) and be closed, so
+// the loop consuming it knows it has seen the last value
 template<typename T>
 class ThreadSafeQueue {
   std::queue<T> queue;
   std::mutex mutex;
   std::condition_variable cv;
+  std::function<void()> listener;
+  bool closed = false;
 
 public:
   void push(T value) {
-    std::lock_guard<std::mutex> lock(mutex);
-    queue.push(value);
-    cv.notify_one();
+    std::function<void()> notify;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push(value);
+      notify = listener;
+      cv.notify_one();
+    }
+    if(notify) {
+      notify();
+    }
   }
 
   T pop() {
@@ -25,9 +38,60 @@ public:
     return value;
   }
 
+  // Waits until _deadline for a value. Returns false on timeout, or right away once closed and empty
+  bool popUntil(T &_value, std::chrono::steady_clock::time_point _deadline) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!cv.wait_until(lock, _deadline, [&] { return !queue.empty() || closed; }) || queue.empty()) {
+      return false;
+    }
+    _value = queue.front();
+    queue.pop();
+    return true;
+  }
+
+  bool tryPop(T &_value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(queue.empty()) {
+      return false;
+    }
+    _value = queue.front();
+    queue.pop();
+    return true;
+  }
+
+  // No more values will come. Values already queued can still be popped
+  void close() {
+    std::function<void()> notify;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      notify = listener;
+      cv.notify_all();
+    }
+    if(notify) {
+      notify();
+    }
+  }
+
+  bool isClosed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed;
+  }
+
+  // Called after every push and on close, from the pushing thread
+  void setListener(std::function<void()> _listener) {
+    std::lock_guard<std::mutex> lock(mutex);
+    listener = _listener;
+  }
+
   bool empty() {
     std::lock_guard<std::mutex> lock(mutex);
     return queue.empty();
   }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+  }
 };
 
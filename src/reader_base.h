@@ -0,0 +1,8 @@
+#pragma once
+
+class ReaderBase {
+public:
+  virtual ~ReaderBase() = default;
+  virtual bool open() = 0;
+  virtual bool close() = 0;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include "essence_block.h"
+#include "parser_base.h"
+#include "metrics_registry.h"
+
+// Records received blocks to a file, back to back as they came off the wire (current header layout).
+// That is the byte stream BlockReassembler takes, so a recording can be replayed or analyzed later.
+// Join bursts and null packets are left out: they only repeat or pad the essence data
+class RecorderParser : public ParserBase {
+public:
+  RecorderParser(const std::string &_path)
+  :path_(_path)
+  {
+  }
+
+  ~RecorderParser() {
+    close();
+  }
+
+  bool open() {
+    file_.open(path_, std::ios::binary | std::ios::trunc);
+    if(!file_) {
+      std::cerr << "Failed to open file: " << path_ << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool close() {
+    if(file_.is_open()) {
+      file_.close();
+    }
+    return true;
+  }
+
+  int parse(EssenceBlock *_block) {
+    if(!file_.is_open() || _block->essence_type == ESSENCE_TYPE_JOIN || _block->essence_type == ESSENCE_TYPE_NULL) {
+      return 0;
+    }
+    size_t size = _block->size + _block->payload_size;
+    if(!file_.write((const char *) _block, size)) {
+      writeErrors_++;
+      file_.clear();
+      return 0;
+    }
+    blocks_++;
+    bytes_ += size;
+    return (int) size;
+  }
+
+protected:
+  std::string path_;
+  std::ofstream file_;
+  // metrics
+  Counter &blocks_ = globalMetrics().counter("recorder_blocks_total", "", "Blocks written to the recording");
+  Counter &bytes_ = globalMetrics().counter("recorder_bytes_total", "", "Block bytes written to the recording");
+  Counter &writeErrors_ = globalMetrics().counter("recorder_write_errors_total", "", "Blocks that failed to write");
+};
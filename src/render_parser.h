@@ -1,6 +1,23 @@
 #pragma once
 
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include "parser_base.h"
+#include "audio_player.h"
+#include "overlay_manager.h"
+#include "glyph_atlas.h"
+#include "smt_timeline.h"
+#include "smt_binary.h"
+#include "overlay_asset_cache.h"
+#include "qoi_codec.h"
+#include "content_hash.h"
+#include "codec_params_json.h"
+#include "metrics_registry.h"
+#include "thread_placement.h"
 #include <nlohmann/json.hpp>
 extern "C" {
   #include <libavcodec/avcodec.h>
@@ -14,30 +31,48 @@ extern "C" {
 #pragma comment(lib, "SDL2main.lib")
 #pragma comment(lib, "SDL2_image.lib")
 
+// A/V sync thresholds, 90 kHz units
+#define AV_SYNC_DROP_THRESHOLD (90 * 40)   // video later than the audio clock by this much is dropped
+#define AV_SYNC_MAX_WAIT (90 * 100)        // never hold a video frame longer than this
+#define PTS_RESYNC_THRESHOLD (90 * 10000)  // source PTS this far from the muxer clock mapping: discontinuity, remapped
+#define RENDER_PRESENT_QUEUE_FRAMES 8      // decoded frames waiting for presentation, beyond that the oldest is dropped
+
+// Video loss / overload counters
+struct VideoResyncStats {
+  Counter &gaps = globalMetrics().counter("video_gaps_total", "", "Video sequence discontinuities");
+  Counter &lostBlocks = globalMetrics().counter("video_lost_blocks_total", "", "Video blocks missing in sequence gaps");
+  Counter &skippedUntilKey = globalMetrics().counter("video_skipped_until_key_total", "", "Access units not decoded while waiting for a keyframe");
+  Counter &droppedDisposable = globalMetrics().counter("video_dropped_disposable_total", "", "Non-reference access units dropped while overloaded");
+  Counter &overloads = globalMetrics().counter("video_overloads_total", "", "Times the decoder fell behind the audio clock");
+  Counter &lateFrames = globalMetrics().counter("video_late_frames_total", "", "Decoded frames dropped by A/V sync");
+};
+
 class RenderParser : public ParserBase {
 public:
-  RenderParser() {
-
+  RenderParser(const AudioPlayerParams &_audioParams = AudioPlayerParams(), const GlyphAtlasParams &_textParams = GlyphAtlasParams())
+  :glyphs_(_textParams)
+  ,audio_(_audioParams)
+  {
+    overlays_.setTextRenderer(&glyphs_);
+    presentThread_ = std::thread(&RenderParser::presentLoop, this);
   }
 
   ~RenderParser() {
+    {
+      std::lock_guard<std::mutex> lock(presentMutex_);
+      presentStop_ = true;
+    }
+    presentReady_.notify_all();
+    if(presentThread_.joinable()) {
+      presentThread_.join();
+    }
+    timeline_.clear();
+    awaitingAsset_.clear();
     destroyEssenceBlock(&EABlock_);
     avcodec_free_context(&videoCodecCtx_); 
     if(swsCtx_) {
       sws_freeContext(swsCtx_);
     }
-    if(window_) {
-      SDL_DestroyWindow(window_);
-    }
-    if(texture_) {
-    SDL_DestroyTexture(texture_);
-    }
-    if(renderer_) {
-      SDL_DestroyRenderer(renderer_);
-    }
-    if(imageTexture_) {
-      SDL_DestroyTexture(imageTexture_);
-    }
   }
 
   int parse(EssenceBlock* _block) {
@@ -48,66 +83,45 @@ public:
         if(programIndex == _block->program_index) {
           int streamIndex = _block->stream_index;
           if(streamIndex == videoStreamIndex_) {
-            if(videoCodecCtx_) {
-              AVPacket *packet = av_packet_alloc();
-              packet->data = (uint8_t *) (_block + 1);
-              packet->size = _block->payload_size;
-
-              if(avcodec_send_packet(videoCodecCtx_, packet) >= 0) {
-                AVFrame *frame = av_frame_alloc();
-                while(avcodec_receive_frame(videoCodecCtx_, frame) == 0) {
-                  std::cout << "Decoded frame: " << frame->pts << std::endl;
-
-                  if(!swsCtx_) {
-                    swsCtx_ = sws_getContext(videoCodecCtx_->width, videoCodecCtx_->height, videoCodecCtx_->pix_fmt, videoCodecCtx_->width, videoCodecCtx_->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
-                  }
-
-                  if(!window_) {
-                    // Create SDL window and renderer
-                    window_ = SDL_CreateWindow("H.264 Decoder", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, videoCodecCtx_->width, videoCodecCtx_->height, SDL_WINDOW_SHOWN);
-                    if(window_) {
-                      renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
-                      texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, videoCodecCtx_->width, videoCodecCtx_->height);
-                    }
-                  }
-
-                  // Convert the frame to YUV420P
-                  AVFrame *frameYUV = av_frame_alloc();
-                  uint8_t *buffer = (uint8_t *) av_malloc(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, videoCodecCtx_->width, videoCodecCtx_->height, 1));
-                  av_image_fill_arrays(frameYUV->data, frameYUV->linesize, buffer, AV_PIX_FMT_YUV420P, videoCodecCtx_->width, videoCodecCtx_->height, 1);
-                  sws_scale(swsCtx_, frame->data, frame->linesize, 0, videoCodecCtx_->height, frameYUV->data, frameYUV->linesize);
-
-                  // Update the SDL texture
-                  SDL_UpdateYUVTexture(texture_, nullptr, frameYUV->data[0], frameYUV->linesize[0], frameYUV->data[1], frameYUV->linesize[1], frameYUV->data[2], frameYUV->linesize[2]);
-
-                  // Render the frame
-                  SDL_RenderClear(renderer_);
-                  SDL_RenderCopy(renderer_, texture_, nullptr, nullptr);
-
-                  // overlay image
-                  if(imageTexture_) {
-                    SDL_Rect overlayRect = { 100, 100, 200, 150 };
-                    SDL_RenderCopy(renderer_, imageTexture_, nullptr, &overlayRect);
-                  }
-
-                  SDL_RenderPresent(renderer_);
-
-                  SDL_Event e;
-                  SDL_PollEvent(&e);                  
-
-                  av_free(buffer);
-                  av_frame_free(&frameYUV);
-                  
-                  av_frame_unref(frame);                
-                }
-                av_frame_free(&frame);
-              }
+            // live data reached: a join burst still being consumed is over
+            joinRemaining_ = 0;
+            if(acceptVideo(_block)) {
+              decodeVideo(_block, false);
             }
           }
           else if(streamIndex == audioStreamIndex_) {
-
+            if(audio_.isOpen()) {
+              audio_.push(_block, streamTimestamp(_block, audioTimeBase_));
+            }
+          }
+        }
+      }
+    }
+    // Join burst: cached GOP, only used while this receiver has not shown a picture yet
+    else if(_block->essence_type == EssenceType::ESSENCE_TYPE_JOIN) {
+      if(EABlock_ && programIndex_ == _block->program_index) {
+        if(_block->stream_index == 0xff) {
+          if(!videoStarted_ && videoCodecCtx_) {
+            try {
+              nlohmann::json marker = nlohmann::json::parse((const char *) (_block + 1), (const char *) (_block + 1) + _block->payload_size);
+              if(marker.value("stream_index", -1) == videoStreamIndex_) {
+                joinRemaining_ = marker.value("blocks", 0);
+                avcodec_flush_buffers(videoCodecCtx_);
+                // the burst starts on a keyframe and the live blocks continue from it
+                waitKey_ = false;
+                haveSequence_ = false;
+                std::cout << "Joining from GOP cache: " << joinRemaining_ << " blocks" << std::endl;
+              }
+            }
+            catch(const nlohmann::json::parse_error &_e) {
+              std::cerr << "JSON parsing error: " << _e.what() << std::endl;
+            }
           }
         }
+        else if(joinRemaining_ > 0 && _block->stream_index == videoStreamIndex_) {
+          joinRemaining_--;
+          decodeVideo(_block, true);
+        }
       }
     }
     // NULL packet
@@ -117,36 +131,46 @@ public:
     // SMT table (Stream manipulation table)
     else if(_block->essence_type == EssenceType::ESSENCE_TYPE_SMT) {
       const uint8_t* payload = (const uint8_t*)(_block + 1);
+
+      // binary encoding: records and asset bytes are used in place
+      SMTBinaryReader reader;
+      if(reader.open(payload, _block->payload_size)) {
+        const SMTBinaryAction *record = nullptr;
+        const uint8_t *data = nullptr;
+        while(reader.next(record, data)) {
+          SMTAction action;
+          if(parseSMTAction(*record, action) && parseSMTText(*record, data, action)) {
+            receiveAction(action, data, record->data_size, record->data_type);
+          }
+        }
+        return _block->size + _block->payload_size;
+      }
+      else if(isSMTBinary(payload, _block->payload_size)) {
+        std::cerr << "Unsupported SMT binary version" << std::endl;
+        return _block->size + _block->payload_size;
+      }
+
+      // JSON encoding (debug / compatibility)
       std::string receivedData((const char*)payload, _block->payload_size);
       try {
         nlohmann::json SMTJson = nlohmann::json::parse(receivedData);
 
-        // Output the reconstructed JSON
-        std::cout << "Reconstructed JSON:\n" << SMTJson.dump(4) << std::endl;   
-
-        for(int i = 0; i < SMTJson["actions"].size(); i++) {
-          std::string actionType = SMTJson["actions"][i]["action"];
-          uint64_t id = SMTJson["actions"][i]["id"];
-          // add image from data
-          if(actionType == ACTION_ADD_IMAGE) {
-            std::string imageType = SMTJson["actions"][i]["data_type"];
-            std::string base64Image = SMTJson["actions"][i]["data"];
-            std::string image = base64_decode(base64Image);
-            if(imageTexture_) {
-              SDL_DestroyTexture(imageTexture_);
-            }
-            imageTexture_ = loadFromMemory(image, renderer_);
-            actionId_ = id;
-          }
-          // remove image
-          else if(actionType == ACTION_REMOVE_IMAGE) {
-            if(id == actionId_) {
-              if(imageTexture_) {
-                SDL_DestroyTexture(imageTexture_);
-              }
-              imageTexture_ = nullptr;
-            }
+        for(size_t i = 0; i < SMTJson["actions"].size(); i++) {
+          const nlohmann::json &actionJson = SMTJson["actions"][i];
+          SMTAction action;
+          if(!parseSMTAction(actionJson, action)) {
+            continue;
+          }
+          if(actionJson.contains("asset_hash")) {
+            action.contentHash = contentHashFromString(actionJson["asset_hash"]);
+          }
+
+          // the payload is only base64 decoded when the asset is not cached yet
+          std::string image;
+          if(actionJson.contains("data") && needsAssetData(action)) {
+            image = base64_decode(actionJson["data"].get<std::string>());
           }
+          receiveAction(action, (const uint8_t *) image.data(), image.size(), smtDataTypeFromName(actionJson.value("data_type", "")));
         }
       }
       catch(const nlohmann::json::parse_error &_e) {
@@ -154,9 +178,13 @@ public:
         std::cerr << "Error location: byte " << _e.byte << std::endl;
       }
     }
-    // Essence Announcement
+    // Essence Announcement: the first one opens the decoders. A different one for this program (the
+    // sender reopened its input, streams or codec parameters changed) reopens them
     else if(_block->essence_type == EssenceType::ESSENCE_TYPE_EA) {
-      // first payload received
+      if(EABlock_ && _block->program_index == programIndex_ && (_block->payload_size != EABlock_->payload_size || memcmp(_block + 1, EABlock_ + 1, _block->payload_size) != 0)) {
+        std::cout << "Essence Announcement changed, reopening the decoders" << std::endl;
+        closeDecoders();
+      }
       if(!EABlock_) {
         EABlock_ = cloneEssenceBlock(_block);
         const uint8_t* payload = (const uint8_t *) (EABlock_ + 1);
@@ -166,17 +194,31 @@ public:
           // Output the reconstructed JSON
           std::cout << "Reconstructed JSON:\n" << EAPayload_.dump(4) << std::endl;
           programIndex_ = EAPayload_["program_index"];
-          for(int i = 0; i < EAPayload_["streams"].size(); i++) {
+          smtTimestampOffset_ = EAPayload_.value("timestamp_offset", (int64_t) 0);
+          std::string smtEncoding = EAPayload_.value("smt_encoding", SMT_ENCODING_JSON);
+          if(smtEncoding != SMT_ENCODING_BINARY && smtEncoding != SMT_ENCODING_JSON) {
+            std::cerr << "Unsupported SMT encoding announced: " << smtEncoding << std::endl;
+          }
+          for(size_t i = 0; i < EAPayload_["streams"].size(); i++) {
             std::string type = EAPayload_["streams"][i]["type"];
             if( (videoStreamIndex_ < 0) && (type == "video") ) {
               videoStreamIndex_ = EAPayload_["streams"][i]["index"];
+              videoTimeBase_ = codecTimeBaseFromJson(EAPayload_["streams"][i].value("codecpar", nlohmann::json::object()));
 
-              // open decoder
+              // open decoder, with the announced parameters (extradata) when present
               std::string codecName = EAPayload_["streams"][i]["codec"];
               const AVCodec *codec = avcodec_find_decoder_by_name(codecName.c_str());
               if(codec) {   
                 videoCodecCtx_ = avcodec_alloc_context3(codec);
                 if(videoCodecCtx_) {
+                  if(EAPayload_["streams"][i].contains("codecpar")) {
+                    AVCodecParameters *codecpar = avcodec_parameters_alloc();
+                    if(codecParametersFromJson(EAPayload_["streams"][i]["codecpar"], codec, codecpar)) {
+                      avcodec_parameters_to_context(videoCodecCtx_, codecpar);
+                    }
+                    avcodec_parameters_free(&codecpar);
+                  }
+                  videoCodecCtx_->pkt_timebase = av_make_q(1, 90000);
                   if(avcodec_open2(videoCodecCtx_, codec, nullptr) < 0) {
                     avcodec_free_context(&videoCodecCtx_);
                   }                              
@@ -185,6 +227,26 @@ public:
             }
             else if((audioStreamIndex_ < 0) && (type == "audio")) {
               audioStreamIndex_ = EAPayload_["streams"][i]["index"];
+              audioTimeBase_ = codecTimeBaseFromJson(EAPayload_["streams"][i].value("codecpar", nlohmann::json::object()));
+
+              // open decoder
+              std::string codecName = EAPayload_["streams"][i]["codec"];
+              int sampleRate = EAPayload_["streams"][i].value("sample_rate", 48000);
+              int channels = EAPayload_["streams"][i].value("channels", 2);
+              AVCodecParameters *codecpar = nullptr;
+              const AVCodec *codec = avcodec_find_decoder_by_name(codecName.c_str());
+              if(codec && EAPayload_["streams"][i].contains("codecpar")) {
+                codecpar = avcodec_parameters_alloc();
+                if(!codecParametersFromJson(EAPayload_["streams"][i]["codecpar"], codec, codecpar)) {
+                  avcodec_parameters_free(&codecpar);
+                }
+              }
+              {
+                // the presentation thread reads the audio clock under presentMutex_
+                std::lock_guard<std::mutex> lock(presentMutex_);
+                audio_.open(codecName, sampleRate, channels, codecpar);
+              }
+              avcodec_parameters_free(&codecpar);
             }
           }
         }
@@ -198,10 +260,467 @@ public:
     return _block->size + _block->payload_size;
   }
 
+  const VideoResyncStats &resyncStats() const {
+    return resyncStats_;
+  }
+
   protected:
-    // Load JPEG from memory into an SDL_Texture
-    SDL_Texture* loadFromMemory(const std::string &jpegData, SDL_Renderer *renderer) {
-      SDL_RWops* rw = SDL_RWFromConstMem(jpegData.data(), (int) jpegData.size());
+    // Decoders and per stream state of the current announcement. The presentation thread resizes the
+    // window and its texture to the frames decoded after the next announcement
+    void closeDecoders() {
+      destroyEssenceBlock(&EABlock_);
+      avcodec_free_context(&videoCodecCtx_);
+      if(swsCtx_) {
+        sws_freeContext(swsCtx_);
+        swsCtx_ = nullptr;
+      }
+      {
+        // frames of the old streams are not shown; the presentation thread reads the audio clock under this lock
+        std::lock_guard<std::mutex> lock(presentMutex_);
+        for(PresentFrame &pending : presentQueue_) {
+          av_frame_free(&pending.frame);
+        }
+        presentQueue_.clear();
+        audio_.close();
+      }
+      videoStreamIndex_ = -1;
+      audioStreamIndex_ = -1;
+      ptsOffset_ = AV_NOPTS_VALUE;
+      videoStarted_ = false;
+      joinRemaining_ = 0;
+      waitKey_ = true;
+      haveSequence_ = false;
+      overloaded_ = false;
+    }
+
+    // Loss and overload handling for a live video block, before it reaches the decoder.
+    // A sequence gap means references were lost: non-key access units are skipped up to the next
+    // random access point instead of decoding artifacts for the rest of the GOP. While overloaded,
+    // disposable (non-reference) access units are dropped. Blocks of older senders carry no
+    // sequence or key flag and always go to the decoder
+    bool acceptVideo(const EssenceBlock *_block) {
+      if(!(_block->flags & ESSENCE_FLAG_SEQUENCED)) {
+        return true;
+      }
+
+      if(haveSequence_ && _block->sequence != expectedSequence_) {
+        uint16_t lost = (uint16_t) (_block->sequence - expectedSequence_);
+        resyncStats_.gaps++;
+        resyncStats_.lostBlocks += lost;
+        if(!waitKey_) {
+          std::cerr << "Video gap: " << lost << " blocks lost, waiting for a keyframe" << std::endl;
+        }
+        waitKey_ = true;
+      }
+      haveSequence_ = true;
+      expectedSequence_ = _block->sequence + 1;
+
+      if(waitKey_) {
+        if(!(_block->flags & ESSENCE_FLAG_KEY)) {
+          resyncStats_.skippedUntilKey++;
+          return false;
+        }
+        waitKey_ = false;
+        if(videoCodecCtx_) {
+          avcodec_flush_buffers(videoCodecCtx_);
+        }
+        std::cout << "Video resynchronized on keyframe (" << (uint64_t) resyncStats_.skippedUntilKey << " access units skipped so far)" << std::endl;
+      }
+
+      if(overloaded_ && (_block->flags & ESSENCE_FLAG_DISPOSABLE)) {
+        resyncStats_.droppedDisposable++;
+        return false;
+      }
+      return true;
+    }
+
+    // Overload = decoded frames arrive too late for the audio clock. The decoder then also skips
+    // non-reference frames for codecs whose packets do not flag them
+    void setOverloaded(bool _overloaded) {
+      if(overloaded_ == _overloaded) {
+        return;
+      }
+      overloaded_ = _overloaded;
+      videoCodecCtx_->skip_frame = _overloaded ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+      if(_overloaded) {
+        resyncStats_.overloads++;
+      }
+    }
+
+    // Program clock timestamp (90 kHz) of an essence data or join block. The source PTS (ESSENCE_FLAG_PTS)
+    // keeps audio and video in their source timing, whatever order and pace the muxer sent them in: the
+    // A/V sync compares these. The first live block maps the program PTS onto the muxer clock, which SMT
+    // actions are scheduled on. Blocks of older senders: their (send) timestamp
+    int64_t streamTimestamp(const EssenceBlock *_block, AVRational _timeBase) {
+      if(!(_block->flags & ESSENCE_FLAG_PTS) || _timeBase.num <= 0 || _timeBase.den <= 0) {
+        return (int64_t) _block->timestamp;
+      }
+      int64_t pts = av_rescale_q(_block->pts, _timeBase, av_make_q(1, 90000));
+      // join burst blocks were cached a GOP ago, their send time says nothing of their PTS
+      if(_block->essence_type == EssenceType::ESSENCE_TYPE_ED && (ptsOffset_ == AV_NOPTS_VALUE || std::abs(pts + ptsOffset_ - (int64_t) _block->timestamp) > PTS_RESYNC_THRESHOLD)) {
+        ptsOffset_ = (int64_t) _block->timestamp - pts;
+      }
+      if(ptsOffset_ == AV_NOPTS_VALUE) {
+        return (int64_t) _block->timestamp;
+      }
+      return pts + ptsOffset_;
+    }
+
+    // Decode a video access unit and queue its frames for presentation. Join burst frames (_join) are
+    // shown as soon as they are decoded: they only exist to get a picture up after joining
+    void decodeVideo(EssenceBlock *_block, bool _join) {
+      if(!videoCodecCtx_) {
+        return;
+      }
+
+      AVPacket *packet = av_packet_alloc();
+      packet->data = (uint8_t *) (_block + 1);
+      packet->size = _block->payload_size;
+      packet->pts = streamTimestamp(_block, videoTimeBase_);
+
+      uint64_t decodeStart = traceNow();
+      if(avcodec_send_packet(videoCodecCtx_, packet) >= 0) {
+        AVFrame *frame = av_frame_alloc();
+        while(avcodec_receive_frame(videoCodecCtx_, frame) == 0) {
+          decodeLatency_.record(traceNow() - decodeStart);
+          std::cout << "Decoded frame: " << frame->pts << std::endl;
+
+          videoStarted_ = true;
+
+          // A frame already late for the audio clock is not even converted, and the decoder skips
+          // non-reference frames until it catches up. Early frames wait on the presentation thread
+          int64_t audioClock = 0;
+          if(!_join && frame->best_effort_timestamp != AV_NOPTS_VALUE && audio_.getClock(audioClock)) {
+            if(frame->best_effort_timestamp - audioClock < -AV_SYNC_DROP_THRESHOLD) {
+              setOverloaded(true);
+              resyncStats_.lateFrames++;
+              av_frame_unref(frame);
+              decodeStart = traceNow();
+              continue;
+            }
+            setOverloaded(false);
+          }
+
+          if(!swsCtx_) {
+            swsCtx_ = sws_getContext(videoCodecCtx_->width, videoCodecCtx_->height, videoCodecCtx_->pix_fmt, videoCodecCtx_->width, videoCodecCtx_->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+          }
+
+          // Convert the frame to YUV420P
+          AVFrame *frameYUV = av_frame_alloc();
+          frameYUV->format = AV_PIX_FMT_YUV420P;
+          frameYUV->width = videoCodecCtx_->width;
+          frameYUV->height = videoCodecCtx_->height;
+          if(av_frame_get_buffer(frameYUV, 0) == 0) {
+            sws_scale(swsCtx_, frame->data, frame->linesize, 0, videoCodecCtx_->height, frameYUV->data, frameYUV->linesize);
+            frameYUV->pts = frame->best_effort_timestamp;
+            queueFrame(frameYUV, _join);
+          }
+          else {
+            av_frame_free(&frameYUV);
+          }
+
+          av_frame_unref(frame);                
+          decodeStart = traceNow();
+        }
+        av_frame_free(&frame);
+      }
+      av_packet_free(&packet);
+    }
+
+    // Hand a converted frame over to the presentation thread. Never waits: with the queue full, the
+    // oldest frame is dropped, it could only be shown late
+    void queueFrame(AVFrame *_frame, bool _join) {
+      AVFrame *dropped = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(presentMutex_);
+        if(presentQueue_.size() >= RENDER_PRESENT_QUEUE_FRAMES) {
+          dropped = presentQueue_.front().frame;
+          presentQueue_.pop_front();
+        }
+        presentQueue_.push_back({ _frame, _join });
+      }
+      presentReady_.notify_one();
+      if(dropped) {
+        resyncStats_.lateFrames++;
+        av_frame_free(&dropped);
+      }
+    }
+
+    // Presentation thread: owns the window, the renderer and every texture (video, overlay layers,
+    // glyph atlas). A/V sync waits happen here, so neither the decoder nor the reader feeding it are
+    // held up by them
+    void presentLoop() {
+      placeThread(THREAD_ROLE_PRESENT);
+      while(true) {
+        PresentFrame entry;
+        int64_t audioClock = 0;
+        bool haveClock = false;
+        {
+          std::unique_lock<std::mutex> lock(presentMutex_);
+          presentReady_.wait(lock, [this] { return !presentQueue_.empty() || presentStop_; });
+          if(presentStop_) {
+            break;
+          }
+          entry = presentQueue_.front();
+          presentQueue_.pop_front();
+          haveClock = !entry.join && entry.frame->pts != AV_NOPTS_VALUE && audio_.getClock(audioClock);
+        }
+
+        // A/V sync: audio is the master clock. Late frames are dropped, early frames wait before presenting
+        if(haveClock) {
+          int64_t syncDelay = entry.frame->pts - audioClock;
+          if(syncDelay < -AV_SYNC_DROP_THRESHOLD) {
+            resyncStats_.lateFrames++;
+            av_frame_free(&entry.frame);
+            continue;
+          }
+          if(syncDelay > 0) {
+            std::unique_lock<std::mutex> lock(presentMutex_);
+            presentReady_.wait_for(lock, std::chrono::microseconds(std::min<int64_t>(syncDelay, AV_SYNC_MAX_WAIT) * 1000 / 90), [this] { return presentStop_; });
+          }
+        }
+
+        showFrame(entry.frame);
+        av_frame_free(&entry.frame);
+      }
+
+      std::unique_lock<std::mutex> lock(presentMutex_);
+      for(PresentFrame &pending : presentQueue_) {
+        av_frame_free(&pending.frame);
+      }
+      presentQueue_.clear();
+      lock.unlock();
+
+      // textures before the renderer they belong to
+      {
+        std::lock_guard<std::mutex> overlayLock(overlayMutex_);
+        overlays_.clear();
+        glyphs_.clear();
+      }
+      if(texture_) {
+        SDL_DestroyTexture(texture_);
+      }
+      if(renderer_) {
+        SDL_DestroyRenderer(renderer_);
+      }
+      if(window_) {
+        SDL_DestroyWindow(window_);
+      }
+    }
+
+    // Upload a YUV420P frame, draw the overlay layers due on it and present
+    void showFrame(AVFrame *_frame) {
+      uint64_t presentStart = traceNow();
+      if(!texture_ || _frame->width != textureWidth_ || _frame->height != textureHeight_) {
+        // Create SDL window and renderer, or resize the window after a new announcement
+        if(texture_) {
+          SDL_DestroyTexture(texture_);
+          texture_ = nullptr;
+        }
+        if(!window_) {
+          window_ = SDL_CreateWindow("H.264 Decoder", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, _frame->width, _frame->height, SDL_WINDOW_SHOWN);
+          if(window_) {
+            renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
+          }
+        }
+        else {
+          SDL_SetWindowSize(window_, _frame->width, _frame->height);
+        }
+        if(!renderer_) {
+          return;
+        }
+        texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, _frame->width, _frame->height);
+        textureWidth_ = _frame->width;
+        textureHeight_ = _frame->height;
+        std::lock_guard<std::mutex> lock(overlayMutex_);
+        outputWidth_ = _frame->width;
+        outputHeight_ = _frame->height;
+      }
+
+      // Update the SDL texture
+      SDL_UpdateYUVTexture(texture_, nullptr, _frame->data[0], _frame->linesize[0], _frame->data[1], _frame->linesize[1], _frame->data[2], _frame->linesize[2]);
+
+      // Render the frame
+      SDL_RenderClear(renderer_);
+      SDL_RenderCopy(renderer_, texture_, nullptr, nullptr);
+
+      {
+        std::lock_guard<std::mutex> lock(overlayMutex_);
+        // SMT actions scheduled up to this frame
+        if(_frame->pts != AV_NOPTS_VALUE) {
+          applyDueActions(_frame->pts);
+        }
+
+        // overlay layers
+        int outputWidth = 0, outputHeight = 0;
+        SDL_GetRendererOutputSize(renderer_, &outputWidth, &outputHeight);
+        overlays_.render(renderer_, outputWidth, outputHeight, _frame->pts != AV_NOPTS_VALUE ? (uint64_t) _frame->pts : 0);
+      }
+
+      SDL_RenderPresent(renderer_);
+      presentLatency_.record(traceNow() - presentStart);
+
+      SDL_Event e;
+      SDL_PollEvent(&e);                  
+    }
+
+    // Whether the asset payload of a received action is needed: not for assets already cached.
+    // Carousel repeats carry it too, for receivers that joined late or lost the first copy
+    bool needsAssetData(const SMTAction &_action) {
+      std::lock_guard<std::mutex> lock(overlayMutex_);
+      return !_action.contentHash || !assets_.contains(_action.contentHash);
+    }
+
+    // Schedule a received SMT action. _data is the raw asset, if any.
+    // Assets are referenced by content hash and only decoded when not cached yet;
+    // they are prepared now, so activation on their frame costs nothing
+    void receiveAction(SMTAction &_action, const uint8_t *_data, size_t _dataSize, uint8_t _dataType) {
+      // actions are on the plain muxer clock, the program's timestamps may be shifted
+      int64_t timestamp = (int64_t) _action.timestamp + smtTimestampOffset_;
+      _action.timestamp = timestamp > 0 ? (uint64_t) timestamp : 0;
+
+      std::unique_lock<std::mutex> lock(overlayMutex_);
+      if(_action.type == SMT_ACTION_ADD_IMAGE) {
+        // a repeat may bring the asset of an action scheduled hash only
+        if(_dataSize > 0) {
+          if(!_action.contentHash) {
+            _action.contentHash = contentHash(_data, _dataSize);
+          }
+          if(!assets_.contains(_action.contentHash)) {
+            // decoded without the lock, presentation goes on meanwhile
+            lock.unlock();
+            SDL_Surface *surface = loadFromMemory(_data, _dataSize, _dataType);
+            lock.lock();
+            if(surface) {
+              assets_.insert(_action.contentHash, 0, 0, OverlayAssetCache::makeShared(surface));
+            }
+          }
+        }
+      }
+      // carousel repeat of an action we already have
+      if(timeline_.contains(_action)) {
+        return;
+      }
+
+      if(_action.type == SMT_ACTION_ADD_IMAGE) {
+        _action.surface = prepareAsset(_action);
+      }
+      timeline_.schedule(_action);
+    }
+
+    // Apply every scheduled SMT action whose timestamp has been reached by _pts. Presentation thread,
+    // under overlayMutex_
+    void applyDueActions(uint64_t _pts) {
+      // due add_image actions whose asset has arrived since
+      for(auto it = awaitingAsset_.begin(); it != awaitingAsset_.end();) {
+        if(assets_.contains(it->second.contentHash)) {
+          applyAddImage(it->second);
+          it = awaitingAsset_.erase(it);
+        }
+        else {
+          ++it;
+        }
+      }
+
+      SMTAction action;
+      while(timeline_.popDue(_pts, action)) {
+        // add image, kept pending until its asset arrives (late join, lost payload, evicted asset)
+        if(action.type == SMT_ACTION_ADD_IMAGE) {
+          awaitingAsset_.erase(action.id);
+          if(!applyAddImage(action)) {
+            std::cerr << "Overlay asset not available yet: " << contentHashToString(action.contentHash) << std::endl;
+            awaitingAsset_[action.id] = action;
+          }
+        }
+        // move, restack or fade an existing layer
+        else if(action.type == SMT_ACTION_UPDATE_IMAGE) {
+          const OverlayPlacement *placement = overlays_.getPlacement(action.id);
+          if(placement) {
+            overlays_.setPlacement(action.id, mergePlacement(action, *placement));
+            if(action.fields & SMT_FIELD_VISIBLE) {
+              overlays_.setVisible(action.id, action.visible);
+            }
+          }
+        }
+        // text layer: only the string and its style arrive, glyphs come from the atlas
+        else if(action.type == SMT_ACTION_ADD_TEXT) {
+          overlays_.setText(action.id, action.text, action.fields | SMT_FIELD_TEXT);
+          overlays_.setPlacement(action.id, mergePlacement(action, OverlayPlacement()));
+          overlays_.setVisible(action.id, true);
+        }
+        else if(action.type == SMT_ACTION_UPDATE_TEXT) {
+          const OverlayPlacement *placement = overlays_.getPlacement(action.id);
+          if(placement && overlays_.isText(action.id)) {
+            overlays_.setText(action.id, action.text, action.fields);
+            overlays_.setPlacement(action.id, mergePlacement(action, *placement));
+            if(action.fields & SMT_FIELD_VISIBLE) {
+              overlays_.setVisible(action.id, action.visible);
+            }
+          }
+        }
+        // remove an image or text layer
+        else if(action.type == SMT_ACTION_REMOVE_IMAGE) {
+          awaitingAsset_.erase(action.id);
+          overlays_.remove(action.id);
+        }
+      }
+    }
+
+    // Show the asset of an add_image action on its layer. False if the asset has not been received
+    bool applyAddImage(SMTAction &_action) {
+      // the asset may have arrived after the action was scheduled
+      if(!_action.surface) {
+        _action.surface = prepareAsset(_action);
+      }
+      if(_action.surface) {
+        overlays_.setContent(_action.id, _action.contentHash, _action.surface);
+        _action.surface = nullptr;
+      }
+      else if(!overlays_.hasContent(_action.id, _action.contentHash)) {
+        return false;
+      }
+      overlays_.setPlacement(_action.id, mergePlacement(_action, OverlayPlacement()));
+      overlays_.setVisible(_action.id, true);
+      return true;
+    }
+
+    // Cached asset for an add_image action, scaled to its on-screen size when the output size is known.
+    // Null if the layer already shows this content or the asset has not been received
+    std::shared_ptr<SDL_Surface> prepareAsset(const SMTAction &_action) {
+      if(!_action.contentHash || overlays_.hasContent(_action.id, _action.contentHash)) {
+        return nullptr;
+      }
+      if(outputWidth_ > 0 && (_action.fields & SMT_FIELD_WIDTH) && (_action.fields & SMT_FIELD_HEIGHT)) {
+        int width = (int) (_action.placement.widthPercentage * outputWidth_ / 100.0);
+        int height = (int) (_action.placement.heightPercentage * outputHeight_ / 100.0);
+        if(width > 0 && height > 0) {
+          return assets_.getScaled(_action.contentHash, width, height);
+        }
+      }
+      return assets_.find(_action.contentHash);
+    }
+
+    // Asset from memory into a premultiplied ARGB8888 SDL_Surface ready to be uploaded. Sender rasterized
+    // assets (SMT_DATA_QOI) decode straight into the surface; JPEG / PNG go through SDL_image
+    SDL_Surface* loadFromMemory(const uint8_t *_data, size_t _size, uint8_t _dataType) {
+      if(_dataType == SMT_DATA_QOI) {
+        QOIInfo info;
+        if(!qoiReadHeader(_data, _size, info)) {
+          std::cerr << "Invalid QOI asset" << std::endl;
+          return nullptr;
+        }
+        SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, (int) info.width, (int) info.height, 32, SDL_PIXELFORMAT_ARGB8888);
+        if(!surface) {
+          std::cerr << "SDL_CreateRGBSurfaceWithFormat Error: " << SDL_GetError() << std::endl;
+          return nullptr;
+        }
+        if(!qoiDecodeARGB(_data, _size, (uint32_t *) surface->pixels, surface->pitch)) {
+          std::cerr << "Truncated QOI asset" << std::endl;
+        }
+        return surface;
+      }
+
+      SDL_RWops* rw = SDL_RWFromConstMem(_data, (int) _size);
       if(!rw) {
         std::cerr << "SDL_RWFromConstMem Error: " << SDL_GetError() << std::endl;
         return nullptr;
@@ -213,23 +732,60 @@ public:
         return nullptr;
       }
 
-      SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+      SDL_Surface* converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
       SDL_FreeSurface(surface);
-
-      return texture;
+      if(!converted) {
+        std::cerr << "SDL_ConvertSurfaceFormat Error: " << SDL_GetError() << std::endl;
+        return nullptr;
+      }
+      premultiplySurface(converted);
+      return converted;
     }
 
   protected:
     EssenceBlock *EABlock_ = nullptr;
     nlohmann::json EAPayload_;
     int programIndex_ = -1;
+    int64_t smtTimestampOffset_ = 0;   // EA timestamp_offset of the program, 90 kHz
     int videoStreamIndex_ = -1;
     int audioStreamIndex_ = -1;
+    AVRational videoTimeBase_ = { 0, 1 };   // announced stream time_base, for the source PTS
+    AVRational audioTimeBase_ = { 0, 1 };
+    int64_t ptsOffset_ = AV_NOPTS_VALUE;     // program PTS (90 kHz) + ptsOffset_ = muxer clock
+    bool videoStarted_ = false;   // a picture has been decoded; join bursts are ignored from then on
+    int joinRemaining_ = 0;       // join burst blocks still expected
+    bool waitKey_ = true;         // skip video until a random access point (start, after a gap)
+    bool haveSequence_ = false;
+    uint16_t expectedSequence_ = 0;
+    bool overloaded_ = false;
+    VideoResyncStats resyncStats_;
+    LatencyHistogram &decodeLatency_ = globalMetrics().histogram("receiver_stage_seconds", "stage=\"decode\"");
+    LatencyHistogram &presentLatency_ = globalMetrics().histogram("receiver_stage_seconds", "stage=\"present\"");
     AVCodecContext *videoCodecCtx_ = nullptr;
     SwsContext *swsCtx_ = nullptr;
+    // presentation thread
+    struct PresentFrame {
+      AVFrame *frame;
+      bool join;
+    };
+    std::thread presentThread_;
+    std::mutex presentMutex_;
+    std::condition_variable presentReady_;
+    std::deque<PresentFrame> presentQueue_;
+    bool presentStop_ = false;
     SDL_Window *window_ = nullptr;
     SDL_Texture *texture_ = nullptr;
     SDL_Renderer *renderer_ = nullptr;
-    SDL_Texture *imageTexture_ = nullptr;
-    uint64_t actionId_ = -1;
+    int textureWidth_ = 0;
+    int textureHeight_ = 0;
+    // overlays: actions are scheduled by the parsing thread, applied and drawn by the presentation thread
+    std::mutex overlayMutex_;
+    GlyphAtlas glyphs_;
+    OverlayManager overlays_;
+    SMTTimeline timeline_;
+    std::map<uint64_t, SMTAction> awaitingAsset_;   // due add_image actions by layer id, waiting for their asset
+    OverlayAssetCache assets_;
+    int outputWidth_ = 0;
+    int outputHeight_ = 0;
+    AudioPlayer audio_;
 };
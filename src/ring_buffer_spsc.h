@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+#include <memory>
+
+// Single producer / single consumer lock-free ring buffer.
+// Storage is allocated once at construction; read() and write() never lock or allocate,
+// so the consumer side is safe to call from real-time callbacks (e.g. the SDL audio callback).
+template<typename T>
+class SPSCRingBuffer {
+public:
+  explicit SPSCRingBuffer(size_t _capacity) {
+    capacity_ = 1;
+    while(capacity_ < _capacity) {
+      capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+    buffer_.reset(new T[capacity_]);
+  }
+
+  // Producer side. Returns the number of elements written
+  size_t write(const T *_data, size_t _count) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t count = capacity_ - (head - tail);
+    if(_count < count) {
+      count = _count;
+    }
+
+    size_t offset = head & mask_;
+    size_t first = (capacity_ - offset < count) ? capacity_ - offset : count;
+    std::memcpy(buffer_.get() + offset, _data, first * sizeof(T));
+    std::memcpy(buffer_.get(), _data + first, (count - first) * sizeof(T));
+
+    head_.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer side. Returns the number of elements read
+  size_t read(T *_data, size_t _count) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t count = head - tail;
+    if(_count < count) {
+      count = _count;
+    }
+
+    size_t offset = tail & mask_;
+    size_t first = (capacity_ - offset < count) ? capacity_ - offset : count;
+    std::memcpy(_data, buffer_.get() + offset, first * sizeof(T));
+    std::memcpy(_data + first, buffer_.get(), (count - first) * sizeof(T));
+
+    tail_.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  // Elements ready to be read
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+protected:
+  size_t capacity_ = 0;
+  size_t mask_ = 0;
+  std::unique_ptr<T[]> buffer_;
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) std::atomic<size_t> tail_ = 0;
+};
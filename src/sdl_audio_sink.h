@@ -0,0 +1,75 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cstring>
+#include <SDL.h>
+#include "audio_sink_base.h"
+
+// SDL audio device sink. The callback only copies from the lock-free ring: no locks, no allocations
+class SDLAudioSink : public AudioSinkBase {
+public:
+  ~SDLAudioSink() {
+    close();
+  }
+
+  bool open(SPSCRingBuffer<int16_t> *_ring, int _sampleRate, int _channels, int _bufferFrames) {
+    ring_ = _ring;
+
+    SDL_AudioSpec want = {};
+    want.freq = _sampleRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = (Uint8) _channels;
+    want.samples = (Uint16) _bufferFrames;
+    want.callback = audioCallback;
+    want.userdata = this;
+
+    // No ALLOW_*_CHANGE flags: SDL converts internally if the device differs, so the ring format never changes
+    SDL_AudioSpec have = {};
+    deviceId_ = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if(deviceId_ == 0) {
+      std::cerr << "SDL_OpenAudioDevice Error: " << SDL_GetError() << std::endl;
+      return false;
+    }
+    deviceFrames_ = have.samples;
+
+    SDL_PauseAudioDevice(deviceId_, 0);
+
+    return true;
+  }
+
+  bool close() {
+    if(deviceId_) {
+      SDL_CloseAudioDevice(deviceId_);
+      deviceId_ = 0;
+    }
+
+    return true;
+  }
+
+  int latencyFrames() {
+    return deviceFrames_;
+  }
+
+  uint64_t underruns() {
+    return underruns_.load(std::memory_order_relaxed);
+  }
+
+protected:
+  static void audioCallback(void *_userdata, Uint8 *_stream, int _len) {
+    SDLAudioSink *sink = (SDLAudioSink *) _userdata;
+    size_t samples = _len / sizeof(int16_t);
+    size_t read = sink->ring_->read((int16_t *) _stream, samples);
+    if(read < samples) {
+      // silence the rest
+      std::memset(_stream + read * sizeof(int16_t), 0, (samples - read) * sizeof(int16_t));
+      sink->underruns_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+protected:
+  SPSCRingBuffer<int16_t> *ring_ = nullptr;
+  SDL_AudioDeviceID deviceId_ = 0;
+  int deviceFrames_ = 0;
+  std::atomic<uint64_t> underruns_ = 0;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include "essence_block.h"
+#include "parser_base.h"
+#include "reader_base.h"
+#include "shm_ring.h"
+#include "metrics_registry.h"
+#include "thread_placement.h"
+
+struct ShmReaderParams {
+  int waitTimeoutMs = 100;     // futex / semaphore wait, bounds close() latency
+  int attachRetryMs = 100;     // no writer yet (or it went away): retry period
+};
+
+// Shared memory reader (shm://<name>). Any number of readers follow one writer, each with its own
+// cursor; blocks are handed to the parser in place, no copy and no sync word scan. A reader more
+// than half a ring behind skips to the newest record rather than slowing the writer down
+class ShmReader : public ReaderBase {
+public:
+  ShmReader(ParserBase *_parser, const std::string &_name, const ShmReaderParams &_params = ShmReaderParams())
+  :parser_(_parser)
+  ,name_(_name)
+  ,params_(_params)
+  ,blocks_(globalMetrics().counter("shm_reader_blocks_total", metricLabel("ring", _name), "Blocks read from a shared memory ring"))
+  ,skips_(globalMetrics().counter("shm_reader_skips_total", metricLabel("ring", _name), "Times a reader fell half a ring behind and skipped ahead"))
+  ,skippedBytes_(globalMetrics().counter("shm_reader_skipped_bytes_total", metricLabel("ring", _name), "Ring bytes skipped by lagging readers"))
+  ,overruns_(globalMetrics().counter("shm_reader_overruns_total", metricLabel("ring", _name), "Records overwritten by the writer while in use"))
+  ,invalidBlocks_(globalMetrics().counter("shm_reader_invalid_blocks_total", metricLabel("ring", _name), "Ring records without a valid block"))
+  {
+  }
+
+  // The ring is attached from the reader thread, so readers can start before the writer
+  bool open() {
+    stopFlag_ = false;
+    workerThread_ = std::thread(&ShmReader::readerLoop, this);
+    return true;
+  }
+
+  bool close() {
+    stopFlag_ = true;
+    if(workerThread_.joinable()) {
+      workerThread_.join();
+    }
+    ring_.close();
+    attached_ = false;
+    return true;
+  }
+
+  // Following a writer
+  bool attached() const {
+    return attached_;
+  }
+
+protected:
+  void readerLoop() {
+    placeThread(THREAD_ROLE_READER);
+    while(!stopFlag_) {
+      ShmRingHeader *header = ring_.header();
+      if(!header) {
+        if(!ring_.attach(name_)) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(params_.attachRetryMs));
+          continue;
+        }
+        header = ring_.header();
+        capacity_ = header->capacity;
+        cursor_ = header->writePos.load(std::memory_order_acquire);
+        attached_ = true;
+        std::cerr << "Attached to shared memory ring " << name_ << " (" << capacity_ / (1024 * 1024) << " MB)" << std::endl;
+      }
+
+      uint32_t seen = header->wake.load(std::memory_order_acquire);
+      uint64_t end = header->writePos.load(std::memory_order_acquire);
+      if(end == cursor_) {
+        // writer closed or restarted with another size, once everything it published was read
+        if(!header->open.load(std::memory_order_acquire) || header->capacity != capacity_) {
+          std::cerr << "Shared memory ring " << name_ << " closed" << std::endl;
+          ring_.close();
+          attached_ = false;
+          continue;
+        }
+        header->waiters.fetch_add(1, std::memory_order_seq_cst);
+        if(header->writePos.load(std::memory_order_seq_cst) == cursor_) {
+          ring_.wait(seen, params_.waitTimeoutMs);
+        }
+        header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+        continue;
+      }
+
+      while(cursor_ != end && !stopFlag_) {
+        // too far behind (or the writer started over): drop what is left and follow the writer
+        uint64_t reserved = header->reservePos.load(std::memory_order_acquire);
+        if(reserved - cursor_ > capacity_ / 2) {
+          skips_++;
+          uint64_t latest = header->writePos.load(std::memory_order_acquire);
+          if(latest > cursor_) {
+            skippedBytes_ += latest - cursor_;
+          }
+          cursor_ = latest;
+          break;
+        }
+        if(!readRecord(header, end)) {
+          break;
+        }
+      }
+    }
+  }
+
+  // Parse the record at the cursor and move past it. False if the ring was overrun
+  bool readRecord(ShmRingHeader *_header, uint64_t _end) {
+    uint8_t *data = ring_.data();
+    uint64_t offset = cursor_ & (capacity_ - 1);
+    const ShmRecordHeader *record = (const ShmRecordHeader *) (data + offset);
+    uint32_t size = record->size;
+    if(size == SHM_RECORD_PAD) {
+      cursor_ += capacity_ - offset;
+      return true;
+    }
+    uint64_t next = cursor_ + shmRecordSize(size);
+    if(size > capacity_ / 4 || next > _end) {
+      overruns_++;
+      cursor_ = _header->writePos.load(std::memory_order_acquire);
+      return false;
+    }
+
+    EssenceBlock *block = readEssenceBlock((uint8_t *) (record + 1), size, legacyBlock_);
+    if(block) {
+      uint64_t parseStart = traceNow();
+      parser_->parse(block);
+      parseLatency_.record(traceNow() - parseStart);
+      blocks_++;
+    }
+    else {
+      invalidBlocks_++;
+    }
+
+    // the writer claimed these bytes again while the parser was using them
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(_header->reservePos.load(std::memory_order_relaxed) - cursor_ > capacity_) {
+      overruns_++;
+    }
+    cursor_ = next;
+    return true;
+  }
+
+protected:
+  ParserBase *parser_ = nullptr;
+  std::string name_;
+  ShmReaderParams params_;
+  ShmRing ring_;
+  uint64_t capacity_ = 0;
+  uint64_t cursor_ = 0;
+  std::vector<uint8_t> legacyBlock_;
+  std::thread workerThread_;
+  std::atomic<bool> stopFlag_ = false;
+  std::atomic<bool> attached_ = false;
+  // metrics
+  Counter &blocks_;
+  Counter &skips_;
+  Counter &skippedBytes_;
+  Counter &overruns_;
+  Counter &invalidBlocks_;
+  LatencyHistogram &parseLatency_ = globalMetrics().histogram("receiver_stage_seconds", "stage=\"parse\"", "Time spent in receiver stages");
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <climits>
+#include <atomic>
+#include <string>
+#include <iostream>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <time.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+  #endif
+#endif
+
+#define SHM_URL_PREFIX "shm://"
+#define SHM_RING_MAGIC 0x524d4853        // "SHMR"
+#define SHM_RING_VERSION 1
+#define SHM_RING_DEFAULT_CAPACITY 64 * 1024 * 1024
+#define SHM_RECORD_ALIGN 8
+#define SHM_RECORD_PAD 0xffffffff        // rest of the ring is unused, the next record is at offset 0
+
+// Control block at the start of the segment. Positions are byte counts since the writer started
+// (offset = position & (capacity - 1)), so readers tell how far behind they are by subtraction
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;                  // data bytes after the header, power of two
+  std::atomic<uint32_t> open;         // writer attached; readers detach and retry once it drops to 0
+  std::atomic<uint32_t> wake;         // bumped on every publish, futex word
+  std::atomic<uint32_t> waiters;      // readers sleeping on wake
+  uint32_t reserved;
+  std::atomic<uint64_t> reservePos;   // end of the record being written, set before its bytes are touched
+  std::atomic<uint64_t> writePos;     // end of the last complete record
+  uint8_t padding[80];
+};
+
+// Record in the ring: header + one essence block, padded to SHM_RECORD_ALIGN. Never wraps; a
+// SHM_RECORD_PAD header skips to the start of the ring instead
+struct ShmRecordHeader {
+  uint32_t size;                      // block bytes or SHM_RECORD_PAD
+  uint32_t reserved;
+};
+
+static_assert(sizeof(ShmRingHeader) == 128, "ShmRingHeader layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared ring positions must be lock free");
+
+__inline bool isShmUrl(const std::string &_url) {
+  return _url.compare(0, strlen(SHM_URL_PREFIX), SHM_URL_PREFIX) == 0;
+}
+
+__inline uint64_t shmRecordSize(uint32_t _blockSize) {
+  return ((uint64_t) sizeof(ShmRecordHeader) + _blockSize + SHM_RECORD_ALIGN - 1) & ~(uint64_t) (SHM_RECORD_ALIGN - 1);
+}
+
+// Named shared memory segment holding a ring (shm_open on POSIX, a named file mapping on Windows)
+// and its wakeup primitive (futex on the wake word on Linux, a named semaphore on Windows)
+class ShmRing {
+public:
+  ShmRing() = default;
+  ShmRing(const ShmRing &) = delete;
+  ShmRing &operator=(const ShmRing &) = delete;
+
+  ~ShmRing() {
+    close();
+  }
+
+  // Writer side: create (or take over) the segment and reset the ring
+  bool create(const std::string &_name, uint64_t _capacity) {
+    close();
+    if(!_capacity || (_capacity & (_capacity - 1))) {
+      std::cerr << "Error: shm ring capacity must be a power of two" << std::endl;
+      return false;
+    }
+    if(!map(_name, sizeof(ShmRingHeader) + _capacity, true)) {
+      return false;
+    }
+    owner_ = true;
+    header_->magic = SHM_RING_MAGIC;
+    header_->version = SHM_RING_VERSION;
+    header_->capacity = _capacity;
+    header_->waiters = 0;
+    header_->reservePos = 0;
+    header_->writePos = 0;
+    header_->wake.fetch_add(1, std::memory_order_release);
+    header_->open.store(1, std::memory_order_release);
+    return true;
+  }
+
+  // Reader side: map an existing segment. Fails quietly until a writer has created it
+  bool attach(const std::string &_name) {
+    close();
+    if(!map(_name, sizeof(ShmRingHeader), false)) {
+      return false;
+    }
+    if(header_->magic != SHM_RING_MAGIC || header_->version != SHM_RING_VERSION || !header_->open.load(std::memory_order_acquire)) {
+      close();
+      return false;
+    }
+    // remap with the data area
+    uint64_t capacity = header_->capacity;
+    close();
+    if(!map(_name, sizeof(ShmRingHeader) + capacity, false)) {
+      return false;
+    }
+    if(header_->capacity != capacity) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if(owner_ && header_) {
+      header_->open.store(0, std::memory_order_release);
+      header_->wake.fetch_add(1, std::memory_order_release);
+      wakeAll();
+    }
+#ifdef _WIN32
+    if(header_) UnmapViewOfFile(header_);
+    if(mapping_) CloseHandle(mapping_);
+    if(semaphore_) CloseHandle(semaphore_);
+    mapping_ = nullptr;
+    semaphore_ = nullptr;
+#else
+    if(header_) munmap(header_, size_);
+    if(fd_ >= 0) ::close(fd_);
+    if(owner_) shm_unlink(shmName(name_).c_str());
+    fd_ = -1;
+#endif
+    header_ = nullptr;
+    size_ = 0;
+    owner_ = false;
+  }
+
+  ShmRingHeader *header() const {
+    return header_;
+  }
+
+  uint8_t *data() const {
+    return header_ ? (uint8_t *) (header_ + 1) : nullptr;
+  }
+
+  // Sleep until the wake word moves away from _seen or _timeoutMs passes
+  void wait(uint32_t _seen, int _timeoutMs) {
+#ifdef _WIN32
+    (void) _seen;
+    WaitForSingleObject(semaphore_, (DWORD) _timeoutMs);
+#elif defined(__linux__)
+    struct timespec timeout;
+    timeout.tv_sec = _timeoutMs / 1000;
+    timeout.tv_nsec = (long) (_timeoutMs % 1000) * 1000000;
+    syscall(SYS_futex, (uint32_t *) &header_->wake, FUTEX_WAIT, _seen, &timeout, nullptr, 0);
+#else
+    (void) _seen;
+    struct timespec timeout = { 0, 1000000 };
+    nanosleep(&timeout, nullptr);
+#endif
+  }
+
+  // Wake every sleeping reader
+  void wakeAll() {
+#ifdef _WIN32
+    LONG waiters = (LONG) header_->waiters.load(std::memory_order_acquire);
+    if(waiters > 0) {
+      ReleaseSemaphore(semaphore_, waiters, nullptr);
+    }
+#elif defined(__linux__)
+    syscall(SYS_futex, (uint32_t *) &header_->wake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+
+protected:
+  bool map(const std::string &_name, uint64_t _size, bool _create) {
+    name_ = _name;
+#ifdef _WIN32
+    std::string mappingName = "Local\\" + _name + "_ring";
+    if(_create) {
+      mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD) (_size >> 32), (DWORD) _size, mappingName.c_str());
+    }
+    else {
+      mapping_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mappingName.c_str());
+    }
+    if(!mapping_) {
+      if(_create) {
+        std::cerr << "Error: Couldn't create shared memory " << _name << std::endl;
+      }
+      return false;
+    }
+    header_ = (ShmRingHeader *) MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T) _size);
+    std::string semaphoreName = "Local\\" + _name + "_wake";
+    semaphore_ = CreateSemaphoreA(nullptr, 0, LONG_MAX, semaphoreName.c_str());
+    if(!header_ || !semaphore_) {
+      std::cerr << "Error: Couldn't map shared memory " << _name << std::endl;
+      close();
+      return false;
+    }
+#else
+    fd_ = shm_open(shmName(_name).c_str(), _create ? (O_CREAT | O_RDWR) : O_RDWR, 0660);
+    if(fd_ < 0) {
+      if(_create) {
+        std::cerr << "Error: Couldn't create shared memory " << _name << std::endl;
+      }
+      return false;
+    }
+    struct stat st;
+    if(_create ? ftruncate(fd_, (off_t) _size) != 0 : (fstat(fd_, &st) != 0 || (uint64_t) st.st_size < _size)) {
+      if(_create) {
+        std::cerr << "Error: Couldn't size shared memory " << _name << std::endl;
+      }
+      close();
+      return false;
+    }
+    void *memory = mmap(nullptr, (size_t) _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(memory == MAP_FAILED) {
+      std::cerr << "Error: Couldn't map shared memory " << _name << std::endl;
+      close();
+      return false;
+    }
+    header_ = (ShmRingHeader *) memory;
+#endif
+    size_ = (size_t) _size;
+    return true;
+  }
+
+#ifndef _WIN32
+  static std::string shmName(const std::string &_name) {
+    return "/" + _name;
+  }
+#endif
+
+protected:
+  std::string name_;
+  ShmRingHeader *header_ = nullptr;
+  size_t size_ = 0;
+  bool owner_ = false;
+#ifdef _WIN32
+  HANDLE mapping_ = nullptr;
+  HANDLE semaphore_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include "writer_base.h"
+#include "shm_ring.h"
+
+// Shared memory writer (shm://<name>): every write() is one record of the ring, published whole,
+// so same host readers use the blocks in place instead of reassembling datagrams. Never waits for
+// readers; the oldest records are overwritten and a reader that falls behind skips ahead
+class ShmWriter : public WriterBase {
+public:
+  ShmWriter(const std::string &_name, uint64_t _capacity = SHM_RING_DEFAULT_CAPACITY)
+  :name_(_name)
+  ,capacity_(_capacity)
+  {
+  }
+
+  bool open() {
+    return ring_.create(name_, capacity_);
+  }
+
+  bool close() {
+    ring_.close();
+    return true;
+  }
+
+  int write(const unsigned char *_packet, int _packetSize) {
+    ShmRingHeader *header = ring_.header();
+    if(!header || _packetSize <= 0) {
+      return 0;
+    }
+    // a record has to stay intact while readers up to half a ring behind use it
+    uint64_t recordSize = shmRecordSize((uint32_t) _packetSize);
+    if(recordSize > capacity_ / 4) {
+      std::cerr << "Block of " << _packetSize << " bytes too large for shared memory ring " << name_ << std::endl;
+      return 0;
+    }
+
+    uint8_t *data = ring_.data();
+    uint64_t position = header->writePos.load(std::memory_order_relaxed);
+    uint64_t offset = position & (capacity_ - 1);
+    uint64_t padding = (offset + recordSize > capacity_) ? capacity_ - offset : 0;
+
+    // claim the bytes first, so readers can tell a record was overwritten under them
+    header->reservePos.store(position + padding + recordSize, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if(padding) {
+      ((ShmRecordHeader *) (data + offset))->size = SHM_RECORD_PAD;
+      position += padding;
+      offset = 0;
+    }
+    ShmRecordHeader *record = (ShmRecordHeader *) (data + offset);
+    record->size = (uint32_t) _packetSize;
+    record->reserved = 0;
+    memcpy(record + 1, _packet, (size_t) _packetSize);
+
+    // publish and wake the readers
+    header->writePos.store(position + recordSize, std::memory_order_release);
+    header->wake.fetch_add(1, std::memory_order_seq_cst);
+    if(header->waiters.load(std::memory_order_seq_cst)) {
+      ring_.wakeAll();
+    }
+    return _packetSize;
+  }
+
+protected:
+  std::string name_;
+  uint64_t capacity_ = SHM_RING_DEFAULT_CAPACITY;
+  ShmRing ring_;
+};
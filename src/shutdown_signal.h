@@ -0,0 +1,106 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <signal.h>
+#endif
+#include "event_loop.h"
+
+// Stops an EventLoop on Ctrl+C / SIGINT / SIGTERM, so main can shut the pipeline down in order; a
+// second signal exits right away, in case the shutdown hangs.
+// Signal handlers can't take the loop's lock, so on POSIX the signals are blocked and a thread
+// receives them with sigwait; open() must come before any other thread starts, as threads inherit
+// the signal mask. Windows runs console handlers on a thread of their own
+class ShutdownSignal {
+public:
+  ~ShutdownSignal() {
+    close();
+  }
+
+  bool open(EventLoop &_loop) {
+    loop_ = &_loop;
+#ifdef _WIN32
+    activeLoop() = &_loop;
+    return SetConsoleCtrlHandler(consoleHandler, TRUE) != 0;
+#else
+    sigset_t signals;
+    shutdownSignals(signals);
+    if(pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0) {
+      std::cerr << "Couldn't block shutdown signals" << std::endl;
+      return false;
+    }
+    closing_ = false;
+    thread_ = std::thread(&ShutdownSignal::waitLoop, this);
+    return true;
+#endif
+  }
+
+  void close() {
+#ifdef _WIN32
+    if(loop_) {
+      SetConsoleCtrlHandler(consoleHandler, FALSE);
+      activeLoop() = nullptr;
+    }
+#else
+    if(thread_.joinable()) {
+      closing_ = true;
+      pthread_kill(thread_.native_handle(), SIGTERM);
+      thread_.join();
+    }
+#endif
+    loop_ = nullptr;
+  }
+
+protected:
+  static void requestStop(EventLoop &_loop) {
+    static std::atomic<int> requests = 0;
+    if(requests++ > 0) {
+      std::cerr << "Exiting" << std::endl;
+      std::_Exit(1);
+    }
+    std::cout << "Shutting down" << std::endl;
+    _loop.stop();
+  }
+
+#ifdef _WIN32
+  static std::atomic<EventLoop *> &activeLoop() {
+    static std::atomic<EventLoop *> loop = nullptr;
+    return loop;
+  }
+
+  static BOOL WINAPI consoleHandler(DWORD _type) {
+    EventLoop *loop = activeLoop().load();
+    if(!loop || (_type != CTRL_C_EVENT && _type != CTRL_BREAK_EVENT && _type != CTRL_CLOSE_EVENT)) {
+      return FALSE;
+    }
+    requestStop(*loop);
+    return TRUE;
+  }
+#else
+  static void shutdownSignals(sigset_t &_signals) {
+    sigemptyset(&_signals);
+    sigaddset(&_signals, SIGINT);
+    sigaddset(&_signals, SIGTERM);
+  }
+
+  void waitLoop() {
+    sigset_t signals;
+    shutdownSignals(signals);
+    int signal = 0;
+    while(sigwait(&signals, &signal) == 0 && !closing_) {
+      requestStop(*loop_);
+    }
+  }
+#endif
+
+protected:
+  EventLoop *loop_ = nullptr;
+  std::thread thread_;
+  std::atomic<bool> closing_ = false;
+};
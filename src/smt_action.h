@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <nlohmann/json.hpp>
+
+struct SDL_Surface;
+
+// Overlay position and size as percentages of the output, plus stacking and blending
+struct OverlayPlacement {
+  double xPercentage = 0.0;
+  double yPercentage = 0.0;
+  double widthPercentage = 0.0;
+  double heightPercentage = 0.0;
+  int zOrder = 0;           // higher is on top
+  uint8_t opacity = 255;
+};
+
+enum SMTActionType {
+  SMT_ACTION_UNKNOWN = 0,
+  SMT_ACTION_ADD_IMAGE = 1,
+  SMT_ACTION_REMOVE_IMAGE = 2,
+  SMT_ACTION_UPDATE_IMAGE = 3,
+  SMT_ACTION_ADD_TEXT = 4,      // text layer; remove_image removes it like any other layer
+  SMT_ACTION_UPDATE_TEXT = 5,
+};
+
+// Optional fields present in an action (SMTAction::fields)
+#define SMT_FIELD_X        0x0001
+#define SMT_FIELD_Y        0x0002
+#define SMT_FIELD_WIDTH    0x0004
+#define SMT_FIELD_HEIGHT   0x0008
+#define SMT_FIELD_Z_ORDER  0x0010
+#define SMT_FIELD_OPACITY  0x0020
+#define SMT_FIELD_VISIBLE  0x0040
+#define SMT_FIELD_TEXT     0x0080
+#define SMT_FIELD_FONT     0x0100
+#define SMT_FIELD_COLOR    0x0200
+#define SMT_FIELD_SCROLL   0x0400
+
+#define SMT_TEXT_MAX_SIZE 4096
+
+// Text layer content: only the string and its style travel, receivers rasterize the glyphs.
+// The line height is the layer height (height_percentage)
+struct SMTText {
+  std::string text;                 // UTF-8
+  uint16_t fontId = 0;              // receiver font table, 0 = default font
+  uint32_t color = 0xffffffff;      // ARGB, straight alpha
+  float scrollSpeed = 0.0f;         // ticker, right to left in percent of the output width per second. 0 = static
+};
+
+// Receiver side SMT action. Payloads are decoded on arrival, so applying an action is cheap
+struct SMTAction {
+  SMTActionType type = SMT_ACTION_UNKNOWN;
+  uint64_t id = 0;
+  uint64_t timestamp = 0;             // block timestamp (90 kHz) of the first frame it applies to, 0 = ASAP
+  uint32_t fields = 0;
+  OverlayPlacement placement;
+  bool visible = true;
+  SMTText text;                             // text actions
+  uint64_t contentHash = 0;                 // asset content hash, 0 if unknown
+  std::shared_ptr<SDL_Surface> surface;     // decoded (and scaled) content ready for the layer
+};
+
+__inline SMTActionType getSMTActionType(const std::string &_action) {
+  if(_action == "add_image") {
+    return SMT_ACTION_ADD_IMAGE;
+  }
+  else if(_action == "remove_image") {
+    return SMT_ACTION_REMOVE_IMAGE;
+  }
+  else if(_action == "update_image") {
+    return SMT_ACTION_UPDATE_IMAGE;
+  }
+  else if(_action == "add_text") {
+    return SMT_ACTION_ADD_TEXT;
+  }
+  else if(_action == "update_text") {
+    return SMT_ACTION_UPDATE_TEXT;
+  }
+  return SMT_ACTION_UNKNOWN;
+}
+
+// "#RRGGBB" or "#AARRGGBB" (leading '#' optional) to ARGB
+__inline bool parseSMTColor(const std::string &_text, uint32_t &_color) {
+  size_t start = (!_text.empty() && _text[0] == '#') ? 1 : 0;
+  size_t digits = _text.size() - start;
+  if((digits != 6 && digits != 8) || _text.find_first_not_of("0123456789abcdefABCDEF", start) != std::string::npos) {
+    return false;
+  }
+  _color = (uint32_t) strtoul(_text.c_str() + start, nullptr, 16);
+  if(digits == 6) {
+    _color |= 0xff000000;
+  }
+  return true;
+}
+
+__inline std::string smtColorToString(uint32_t _color) {
+  char text[10];
+  snprintf(text, sizeof(text), "#%08x", _color);
+  return text;
+}
+
+// Fill _action from a JSON action. The payload ("data") is left to the caller
+__inline bool parseSMTAction(const nlohmann::json &_json, SMTAction &_action) {
+  _action.type = getSMTActionType(_json.value("action", ""));
+  if(_action.type == SMT_ACTION_UNKNOWN || !_json.contains("id")) {
+    return false;
+  }
+  _action.id = _json["id"];
+  _action.timestamp = _json.value("timestamp", (uint64_t) 0);
+
+  struct { const char *name; uint32_t field; double *value; } percentages[] = {
+    { "x_percentage", SMT_FIELD_X, &_action.placement.xPercentage },
+    { "y_percentage", SMT_FIELD_Y, &_action.placement.yPercentage },
+    { "width_percentage", SMT_FIELD_WIDTH, &_action.placement.widthPercentage },
+    { "height_percentage", SMT_FIELD_HEIGHT, &_action.placement.heightPercentage },
+  };
+  for(auto &percentage : percentages) {
+    if(_json.contains(percentage.name)) {
+      *percentage.value = _json[percentage.name];
+      _action.fields |= percentage.field;
+    }
+  }
+  if(_json.contains("z_order")) {
+    _action.placement.zOrder = _json["z_order"];
+    _action.fields |= SMT_FIELD_Z_ORDER;
+  }
+  if(_json.contains("opacity")) {
+    double opacity = _json["opacity"];
+    _action.placement.opacity = (uint8_t) (std::clamp(opacity, 0.0, 1.0) * 255.0 + 0.5);
+    _action.fields |= SMT_FIELD_OPACITY;
+  }
+  if(_json.contains("visible")) {
+    _action.visible = _json["visible"];
+    _action.fields |= SMT_FIELD_VISIBLE;
+  }
+  if(_json.contains("text")) {
+    _action.text.text = _json["text"];
+    _action.fields |= SMT_FIELD_TEXT;
+  }
+  if(_json.contains("font")) {
+    _action.text.fontId = _json["font"];
+    _action.fields |= SMT_FIELD_FONT;
+  }
+  if(_json.contains("color") && parseSMTColor(_json["color"].get<std::string>(), _action.text.color)) {
+    _action.fields |= SMT_FIELD_COLOR;
+  }
+  if(_json.contains("scroll_speed")) {
+    _action.text.scrollSpeed = _json["scroll_speed"];
+    _action.fields |= SMT_FIELD_SCROLL;
+  }
+
+  return true;
+}
+
+// Placement after applying the fields present in _action over _current
+__inline OverlayPlacement mergePlacement(const SMTAction &_action, const OverlayPlacement &_current) {
+  OverlayPlacement placement = _current;
+  if(_action.fields & SMT_FIELD_X) placement.xPercentage = _action.placement.xPercentage;
+  if(_action.fields & SMT_FIELD_Y) placement.yPercentage = _action.placement.yPercentage;
+  if(_action.fields & SMT_FIELD_WIDTH) placement.widthPercentage = _action.placement.widthPercentage;
+  if(_action.fields & SMT_FIELD_HEIGHT) placement.heightPercentage = _action.placement.heightPercentage;
+  if(_action.fields & SMT_FIELD_Z_ORDER) placement.zOrder = _action.placement.zOrder;
+  if(_action.fields & SMT_FIELD_OPACITY) placement.opacity = _action.placement.opacity;
+  return placement;
+}
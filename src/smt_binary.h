@@ -0,0 +1,244 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "smt_action.h"
+
+// Binary SMT encoding.
+// Payload = SMTBinaryHeader followed by action_count records. Every record is an SMTBinaryAction
+// with fixed-width fields followed by data_size bytes of raw (not base64) asset data.
+// record_size covers the record and its data, so receivers can skip record types they don't know.
+#define SMT_BINARY_MAGIC 0x42544d53    // "SMTB"
+#define SMT_BINARY_VERSION 1
+
+// SMT encodings announced in the Essence Announcement ("smt_encoding")
+#define SMT_ENCODING_BINARY "binary"
+#define SMT_ENCODING_JSON "json"
+
+enum SMTDataType {
+  SMT_DATA_NONE = 0,
+  SMT_DATA_JPEG = 1,
+  SMT_DATA_PNG = 2,
+  SMT_DATA_QOI = 3,     // rasterized by the sender: premultiplied RGBA at display size, QOI compressed
+  SMT_DATA_TEXT = 4,    // SMTBinaryText + UTF-8, for text actions
+};
+
+// MIME style names of the data types in the JSON encoding ("data_type")
+__inline const char *smtDataTypeName(uint8_t _dataType) {
+  switch(_dataType) {
+    case SMT_DATA_JPEG: return "image/jpeg";
+    case SMT_DATA_PNG: return "image/png";
+    case SMT_DATA_QOI: return "image/x-qoi-premultiplied";
+    default: return "";
+  }
+}
+
+__inline uint8_t smtDataTypeFromName(const std::string &_name) {
+  if(_name == "image/jpeg") return SMT_DATA_JPEG;
+  if(_name == "image/png") return SMT_DATA_PNG;
+  if(_name == "image/x-qoi-premultiplied") return SMT_DATA_QOI;
+  return SMT_DATA_NONE;
+}
+
+#pragma pack(push, 1)
+
+struct SMTBinaryHeader {
+  uint32_t magic;           // SMT_BINARY_MAGIC
+  uint8_t version;          // SMT_BINARY_VERSION
+  uint8_t reserved;
+  uint16_t action_count;
+};
+
+struct SMTBinaryAction {
+  uint32_t record_size;     // sizeof(SMTBinaryAction) + data_size
+  uint8_t action;           // SMTActionType
+  uint8_t data_type;        // SMTDataType
+  uint16_t reserved;
+  uint32_t fields;          // SMT_FIELD_* present in this record
+  uint64_t id;
+  uint64_t timestamp;       // 90 kHz block timestamp, 0 = ASAP
+  uint64_t asset_hash;      // content hash of the asset, 0 if none
+  float x_percentage;
+  float y_percentage;
+  float width_percentage;
+  float height_percentage;
+  int16_t z_order;
+  uint8_t opacity;
+  uint8_t visible;
+  uint32_t data_size;       // raw asset bytes following the record
+};
+
+// Data of a text action (SMT_DATA_TEXT), followed by text_size bytes of UTF-8.
+// Style fields are only meaningful when flagged in the record fields
+struct SMTBinaryText {
+  uint32_t color;           // ARGB
+  uint16_t font_id;
+  uint16_t text_size;
+  float scroll_speed;       // percent of the output width per second
+};
+
+#pragma pack(pop)
+
+__inline bool isSMTBinary(const uint8_t *_payload, size_t _size) {
+  return _size >= sizeof(SMTBinaryHeader) && ((const SMTBinaryHeader *) _payload)->magic == SMT_BINARY_MAGIC;
+}
+
+// Writes the action fields of a record, leaving its size and data untouched.
+// Lets a record already in place (asset payload written) be re-targeted to another action
+__inline void patchSMTBinaryAction(SMTBinaryAction &_record, const SMTAction &_action) {
+  _record.action = (uint8_t) _action.type;
+  _record.fields = _action.fields;
+  _record.id = _action.id;
+  _record.timestamp = _action.timestamp;
+  _record.asset_hash = _action.contentHash;
+  _record.x_percentage = (float) _action.placement.xPercentage;
+  _record.y_percentage = (float) _action.placement.yPercentage;
+  _record.width_percentage = (float) _action.placement.widthPercentage;
+  _record.height_percentage = (float) _action.placement.heightPercentage;
+  _record.z_order = (int16_t) _action.placement.zOrder;
+  _record.opacity = _action.placement.opacity;
+  _record.visible = _action.visible ? 1 : 0;
+}
+
+// Builds a binary SMT payload in a caller provided buffer
+class SMTBinaryWriter {
+public:
+  SMTBinaryWriter(uint8_t *_buffer, size_t _capacity)
+  :buffer_(_buffer)
+  ,capacity_(_capacity)
+  {
+    SMTBinaryHeader *header = (SMTBinaryHeader *) buffer_;
+    header->magic = SMT_BINARY_MAGIC;
+    header->version = SMT_BINARY_VERSION;
+    header->reserved = 0;
+    header->action_count = 0;
+    size_ = sizeof(SMTBinaryHeader);
+  }
+
+  // Append a text action, its SMTBinaryText data built from _action.text
+  SMTBinaryAction *addTextAction(const SMTAction &_action) {
+    size_t textSize = std::min(_action.text.text.size(), (size_t) SMT_TEXT_MAX_SIZE);
+    uint32_t dataSize = (uint32_t) (sizeof(SMTBinaryText) + textSize);
+    SMTBinaryAction *record = addAction(_action, SMT_DATA_TEXT, nullptr, dataSize);
+    if(record) {
+      SMTBinaryText *text = (SMTBinaryText *) (record + 1);
+      text->color = _action.text.color;
+      text->font_id = _action.text.fontId;
+      text->text_size = (uint16_t) textSize;
+      text->scroll_speed = _action.text.scrollSpeed;
+      memcpy(text + 1, _action.text.text.data(), textSize);
+    }
+    return record;
+  }
+
+  // Append an action. Returns the record so callers can patch fields, or nullptr if it doesn't fit.
+  // A null _data leaves the _dataSize bytes for the caller to fill
+  SMTBinaryAction *addAction(const SMTAction &_action, uint8_t _dataType = SMT_DATA_NONE, const uint8_t *_data = nullptr, uint32_t _dataSize = 0) {
+    if(size_ + sizeof(SMTBinaryAction) + _dataSize > capacity_) {
+      return nullptr;
+    }
+
+    SMTBinaryAction *record = (SMTBinaryAction *) (buffer_ + size_);
+    memset(record, 0, sizeof(SMTBinaryAction));
+    record->record_size = (uint32_t) sizeof(SMTBinaryAction) + _dataSize;
+    record->data_type = _dataType;
+    record->data_size = _dataSize;
+    patchSMTBinaryAction(*record, _action);
+    if(_dataSize && _data) {
+      memcpy(record + 1, _data, _dataSize);
+    }
+
+    size_ += record->record_size;
+    ((SMTBinaryHeader *) buffer_)->action_count++;
+    return record;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+protected:
+  uint8_t *buffer_ = nullptr;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+};
+
+// Walks a binary SMT payload in place. No copies, no allocations
+class SMTBinaryReader {
+public:
+  bool open(const uint8_t *_payload, size_t _size) {
+    if(!isSMTBinary(_payload, _size)) {
+      return false;
+    }
+    const SMTBinaryHeader *header = (const SMTBinaryHeader *) _payload;
+    if(header->version != SMT_BINARY_VERSION) {
+      return false;
+    }
+    payload_ = _payload;
+    size_ = _size;
+    offset_ = sizeof(SMTBinaryHeader);
+    remaining_ = header->action_count;
+    return true;
+  }
+
+  // Next record and its data. Returns false at the end or on a malformed record
+  bool next(const SMTBinaryAction *&_action, const uint8_t *&_data) {
+    if(remaining_ == 0 || offset_ + sizeof(SMTBinaryAction) > size_) {
+      return false;
+    }
+    const SMTBinaryAction *record = (const SMTBinaryAction *) (payload_ + offset_);
+    if(record->record_size < sizeof(SMTBinaryAction) || offset_ + record->record_size > size_ || record->data_size > record->record_size - sizeof(SMTBinaryAction)) {
+      return false;
+    }
+
+    _action = record;
+    _data = (const uint8_t *) (record + 1);
+    offset_ += record->record_size;
+    remaining_--;
+    return true;
+  }
+
+protected:
+  const uint8_t *payload_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  uint32_t remaining_ = 0;
+};
+
+// Receiver side action from a binary record
+__inline bool parseSMTAction(const SMTBinaryAction &_record, SMTAction &_action) {
+  _action.type = (SMTActionType) _record.action;
+  if(_action.type < SMT_ACTION_ADD_IMAGE || _action.type > SMT_ACTION_UPDATE_TEXT) {
+    return false;
+  }
+  _action.id = _record.id;
+  _action.timestamp = _record.timestamp;
+  _action.fields = _record.fields;
+  _action.contentHash = _record.asset_hash;
+  _action.placement.xPercentage = _record.x_percentage;
+  _action.placement.yPercentage = _record.y_percentage;
+  _action.placement.widthPercentage = _record.width_percentage;
+  _action.placement.heightPercentage = _record.height_percentage;
+  _action.placement.zOrder = _record.z_order;
+  _action.placement.opacity = _record.opacity;
+  _action.visible = _record.visible != 0;
+  return true;
+}
+
+// Text and style of a text action record (SMT_DATA_TEXT). Records of other data types are left alone
+__inline bool parseSMTText(const SMTBinaryAction &_record, const uint8_t *_data, SMTAction &_action) {
+  if(_record.data_type != SMT_DATA_TEXT) {
+    return true;
+  }
+  const SMTBinaryText *text = (const SMTBinaryText *) _data;
+  if(_record.data_size < sizeof(SMTBinaryText) || text->text_size > _record.data_size - sizeof(SMTBinaryText)) {
+    return false;
+  }
+  _action.text.color = text->color;
+  _action.text.fontId = text->font_id;
+  _action.text.scrollSpeed = text->scroll_speed;
+  _action.text.text.assign((const char *) (text + 1), text->text_size);
+  return true;
+}
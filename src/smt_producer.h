@@ -2,97 +2,282 @@
 
 #include "essence_block.h"
 #include "queue_thread_safe.h"
+#include "muxer_timestamp.h"
 #include <nlohmann/json.hpp>
-#include <fstream>
+#include <map>
+#include <vector>
+#include <chrono>
 #include "base64_simple.h"
+#include "content_hash.h"
+#include "smt_binary.h"
+#include "asset_registry.h"
+#include "control_channel.h"
+#include "event_loop.h"
 
-#define MAX_MANIPULATION_TABLE_PAYLOAD_SIZE 1024 * 1024
-
-void setStreamManipulaitonTableBlock(EssenceBlock *_block, nlohmann::json &_jsonInfo) {
-  std::string serialized_json = _jsonInfo.dump();
-  std::vector<uint8_t> data(serialized_json.begin(), serialized_json.end());
+#define ACTION_ADD_IMAGE "add_image"
+#define ACTION_REMOVE_IMAGE "remove_image"
+#define ACTION_UPDATE_IMAGE "update_image"
+#define ACTION_ADD_TEXT "add_text"
+#define ACTION_UPDATE_TEXT "update_text"
 
-  // Set block metadata
-  _block->payload_size = (uint32_t) data.size();
+__inline const char *smtActionName(SMTActionType _type) {
+  switch(_type) {
+    case SMT_ACTION_ADD_IMAGE: return ACTION_ADD_IMAGE;
+    case SMT_ACTION_REMOVE_IMAGE: return ACTION_REMOVE_IMAGE;
+    case SMT_ACTION_ADD_TEXT: return ACTION_ADD_TEXT;
+    case SMT_ACTION_UPDATE_TEXT: return ACTION_UPDATE_TEXT;
+    default: return ACTION_UPDATE_IMAGE;
+  }
+}
 
-  // payload
-  uint8_t* payload = (uint8_t*)(_block + 1);
-  std::memcpy(payload, &(data[0]), data.size());
+// JSON form of an action (debug / compatibility encoding). _encodedData is the base64 asset, if sent
+nlohmann::json buildSMTActionJson(const SMTAction &_action, const std::string *_encodedData, uint8_t _dataType) {
+  nlohmann::json action_json;
+  action_json["action"] = smtActionName(_action.type);
+  action_json["id"] = _action.id;
+  action_json["timestamp"] = _action.timestamp;
+  if(_action.contentHash) {
+    action_json["asset_hash"] = contentHashToString(_action.contentHash);
+  }
+  if(_encodedData) {
+    action_json["data"] = *_encodedData;
+    action_json["data_type"] = smtDataTypeName(_dataType);
+  }
+  if(_action.fields & SMT_FIELD_X) action_json["x_percentage"] = _action.placement.xPercentage;
+  if(_action.fields & SMT_FIELD_Y) action_json["y_percentage"] = _action.placement.yPercentage;
+  if(_action.fields & SMT_FIELD_WIDTH) action_json["width_percentage"] = _action.placement.widthPercentage;
+  if(_action.fields & SMT_FIELD_HEIGHT) action_json["height_percentage"] = _action.placement.heightPercentage;
+  if(_action.fields & SMT_FIELD_Z_ORDER) action_json["z_order"] = _action.placement.zOrder;
+  if(_action.fields & SMT_FIELD_OPACITY) action_json["opacity"] = _action.placement.opacity / 255.0;
+  if(_action.fields & SMT_FIELD_VISIBLE) action_json["visible"] = _action.visible;
+  if(_action.fields & SMT_FIELD_TEXT) action_json["text"] = _action.text.text;
+  if(_action.fields & SMT_FIELD_FONT) action_json["font"] = _action.text.fontId;
+  if(_action.fields & SMT_FIELD_COLOR) action_json["color"] = smtColorToString(_action.text.color);
+  if(_action.fields & SMT_FIELD_SCROLL) action_json["scroll_speed"] = _action.text.scrollSpeed;
+  return action_json;
 }
 
-#define ACTION_ADD_IMAGE "add_image"
-#define ACTION_REMOVE_IMAGE "remove_image"
+// SMT block sized to its payload
+__inline EssenceBlock *createSMTBlock(size_t _payloadSize) {
+  EssenceBlock *block = createEssenceBlock((int) _payloadSize);
+  block->essence_type = EssenceType::ESSENCE_TYPE_SMT;
+  block->program_index = 0;
+  block->stream_type = 0xff;
+  block->stream_index = 0xff;
+  block->timestamp = 0;
+  block->payload_size = (uint32_t) _payloadSize;
+  return block;
+}
 
-// Function to read binary file into a vector
-std::vector<uint8_t> read_binary_file(const std::string& filepath) {
-  std::ifstream file(filepath, std::ios::binary);
-  if(!file) {
-    throw std::runtime_error("Failed to open file: " + filepath);
+// Encodes one action. _asset != nullptr attaches the asset payload: copied straight from the asset's
+// mapping (binary) or taken from its precomputed encoding (JSON)
+EssenceBlock *buildSMTBlock(const SMTAction &_action, const OverlayAsset *_asset, const std::string &_encoding) {
+  if(_encoding == SMT_ENCODING_BINARY) {
+    if(_asset) {
+      EssenceBlock *block = createSMTBlock(sizeof(SMTBinaryHeader) + sizeof(SMTBinaryAction) + _asset->size());
+      SMTBinaryWriter writer((uint8_t *) (block + 1), block->payload_size);
+      writer.addAction(_action, _asset->dataType, _asset->data(), (uint32_t) _asset->size());
+      return block;
+    }
+    // text actions carry their string and style, a few bytes instead of an image
+    if(_action.type == SMT_ACTION_ADD_TEXT || _action.type == SMT_ACTION_UPDATE_TEXT) {
+      EssenceBlock *block = createSMTBlock(sizeof(SMTBinaryHeader) + sizeof(SMTBinaryAction) + sizeof(SMTBinaryText) + std::min(_action.text.text.size(), (size_t) SMT_TEXT_MAX_SIZE));
+      SMTBinaryWriter writer((uint8_t *) (block + 1), block->payload_size);
+      writer.addTextAction(_action);
+      return block;
+    }
+    EssenceBlock *block = createSMTBlock(sizeof(SMTBinaryHeader) + sizeof(SMTBinaryAction));
+    SMTBinaryWriter writer((uint8_t *) (block + 1), block->payload_size);
+    writer.addAction(_action);
+    return block;
   }
-  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+
+  nlohmann::json smt_info;
+  smt_info["actions"].push_back(buildSMTActionJson(_action, _asset ? &_asset->encodedData : nullptr, _asset ? _asset->dataType : (uint8_t) SMT_DATA_NONE));
+  std::string serialized_json = smt_info.dump();
+  EssenceBlock *block = createSMTBlock(serialized_json.size());
+  memcpy(block + 1, serialized_json.data(), serialized_json.size());
+  return block;
 }
 
-void smt_producer(ThreadSafeQueue<EssenceBlock*>& _queue) {
-  auto startTime = std::chrono::steady_clock::now();
-  bool drawImage = true;
-  uint64_t actionId = 1001;
-
-  while(true) {
-    // now
-    auto now = std::chrono::steady_clock::now();
-    // elapsed
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
-    if(elapsed >= 5000) {
-      // block
-      EssenceBlock* block = createEssenceBlock(MAX_MANIPULATION_TABLE_PAYLOAD_SIZE);
-      block->essence_type = EssenceType::ESSENCE_TYPE_SMT;
-      block->program_index = 0;
-      block->stream_type = 0xff;
-      block->stream_index = 0xff;
-      block->timestamp = 0;
-
-      // build json
-      nlohmann::json smt_info;
-
-      if(drawImage) {
-        // Path to the image
-        std::string image_path = actionId%2==0? "example_image.jpg" : "example_image.png";
-
-        // Read binary image data
-        std::vector<uint8_t> image_data = read_binary_file(image_path);
-
-        // Encode the image in Base64
-        std::string base64_image = base64_encode(image_data);
-
-        nlohmann::json action_json;
-        action_json["action"] = ACTION_ADD_IMAGE;
-        action_json["id"] = actionId;
-        action_json["timestamp"] = 0; // ASAP
-        action_json["data"] = base64_image;
-        action_json["data_type"] = actionId%2==0? "image/jpeg" : "image/png";
-        action_json["x_percentage"] = 10.0;
-        action_json["y_percentage"] = 20.0;
-        action_json["width_percentage"] = 15.0;
-        action_json["height_percentage"] = 10.0;
-        smt_info["actions"].push_back(action_json);
+struct SMTAssetParams {
+  std::string name;
+  std::string path;
+};
+
+struct SMTProducerParams {
+  int periodMs = 5000;          // demo add/remove toggle, 0 = driven by the control channel only
+  int leadTimeMs = 1000;        // actions are sent this long before they must be applied
+  int repeatCount = 3;          // carousel repeats for receivers that missed the first copy
+  int repeatPeriodMs = 200;
+  int assetRefreshMs = 30000;   // assets are referenced by hash; their payload is re-sent at most this often
+  std::string encoding = SMT_ENCODING_BINARY;
+  std::vector<SMTAssetParams> assets = { { "jpg", "example_image.jpg" }, { "png", "example_image.png" } };
+  std::vector<AssetRasterParams> rasterSizes;      // empty = assets sent as JPEG / PNG for the receivers to decode
+  AssetRasterizer rasterizer = nullptr;            // required with rasterSizes
+  std::string controlPath = "smt_control.sock";   // empty = no control channel
+  JoinBurstRequests *joinRequests = nullptr;      // forwarded "join" commands
+};
+
+// SMT producer on the sender's event loop. Assets are loaded into the registry once; actions come
+// from the control channel (or the demo toggle), and carousel repeats and the demo toggle are timers.
+class SMTProducer {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  SMTProducer(SMTProducerParams &_params, ThreadSafeQueue<EssenceBlock*> &_queue, const MuxerTimestamp &_clock)
+  :params_(_params)
+  ,queue_(_queue)
+  ,clock_(_clock)
+  ,assets_(_params.rasterizer)
+  ,control_(_params.controlPath, assets_, commands_, _params.joinRequests)
+  {
+  }
+
+  ~SMTProducer() {
+    close();
+  }
+
+  bool open(EventLoop &_loop) {
+    loop_ = &_loop;
+    for(const SMTAssetParams &asset : params_.assets) {
+      if(params_.rasterSizes.empty()) {
+        assets_.load(asset.name, asset.path, params_.encoding);
+        continue;
+      }
+      // rasterized: the asset at its native size, plus <name>@<width>x<height> per target size
+      AssetRasterParams native;
+      native.enabled = true;
+      assets_.load(asset.name, asset.path, params_.encoding, native);
+      for(const AssetRasterParams &size : params_.rasterSizes) {
+        if(size.width > 0) {
+          assets_.load(asset.name + "@" + std::to_string(size.width) + "x" + std::to_string(size.height), asset.path, params_.encoding, size);
+        }
+      }
+    }
+
+    if(!params_.controlPath.empty()) {
+      control_.open();
+    }
+    _loop.addQueue<SMTCommand>(commands_, [this](SMTCommand &_command) { emit(_command); });
+    if(params_.periodMs > 0) {
+      demoTimer_ = _loop.addTimer(std::chrono::milliseconds(params_.periodMs), [this]() { toggleDemo(); }, std::chrono::milliseconds(params_.periodMs));
+    }
+    return true;
+  }
+
+  // Carousel copies not sent yet are dropped
+  void close() {
+    control_.close();
+    if(!loop_) {
+      return;
+    }
+    loop_->cancelTimer(demoTimer_);
+    for(auto &repeat : repeats_) {
+      loop_->cancelTimer(repeat.second.timer);
+      destroyEssenceBlock(&repeat.second.block);
+    }
+    repeats_.clear();
+    loop_ = nullptr;
+  }
+
+protected:
+  // carousel copies still to be sent
+  struct Repeat {
+    EssenceBlock *block;
+    int remaining;
+    TimerId timer;
+  };
+
+  void emit(SMTCommand &_command) {
+    auto now = clock::now();
+    SMTAction &action = _command.action;
+    // activation time on the muxer clock (block timestamps), far enough ahead for the payload to arrive and decode.
+    // Scheduled against the send clock, not the media PTS: the frame it lands on is the one the muxer
+    // sends then, so demux jitter or queueing of the programs moves it by as much
+    action.timestamp = clock_.getCurrentTimestamp() + (uint64_t) (params_.leadTimeMs + _command.delayMs) * 90;
+
+    // Receivers cache assets by content hash. Send the payload only when it has not gone out recently
+    const OverlayAsset *asset = nullptr;
+    const OverlayAsset *payload = nullptr;
+    if(action.type == SMT_ACTION_ADD_IMAGE) {
+      asset = assets_.find(_command.asset);
+      if(!asset) {
+        std::cerr << "SMT asset not loaded: " << _command.asset << std::endl;
+        return;
       }
-      else {
-        nlohmann::json action_json;
-        action_json["action"] = ACTION_REMOVE_IMAGE;
-        action_json["id"] = actionId++;
-        action_json["timestamp"] = 0; // ASAP
-        smt_info["actions"].push_back(action_json);
+      action.contentHash = asset->hash;
+      auto sent = assetSentTime_.find(asset->hash);
+      if(sent == assetSentTime_.end() || now - sent->second >= std::chrono::milliseconds(params_.assetRefreshMs)) {
+        payload = asset;
+        assetSentTime_[asset->hash] = now;
       }
+    }
 
-      drawImage = !drawImage;
-      setStreamManipulaitonTableBlock(block, smt_info);
+    EssenceBlock *block = buildSMTBlock(action, payload, params_.encoding);
+    if(params_.repeatCount > 0) {
+      uint64_t key = nextRepeat_++;
+      Repeat &repeat = repeats_[key];
+      // the carousel copies always carry the asset, for receivers that joined late or lost it
+      repeat.block = payload || !asset ? cloneEssenceBlock(block) : buildSMTBlock(action, asset, params_.encoding);
+      repeat.remaining = params_.repeatCount;
+      repeat.timer = loop_->addTimer(std::chrono::milliseconds(params_.repeatPeriodMs), [this, key]() { sendRepeat(key); }, std::chrono::milliseconds(params_.repeatPeriodMs));
+    }
+    traceStamp(block, TRACE_STAGE_ENQUEUE);
+    queue_.push(block);
+  }
 
-      // register
-      _queue.push(block);
-      
-      startTime = now;
+  void sendRepeat(uint64_t _key) {
+    auto it = repeats_.find(_key);
+    if(it == repeats_.end()) {
+      return;
     }
+    Repeat &repeat = it->second;
+    queue_.push(cloneEssenceBlock(repeat.block));
+    if(--repeat.remaining == 0) {
+      loop_->cancelTimer(repeat.timer);
+      destroyEssenceBlock(&repeat.block);
+      repeats_.erase(it);
+    }
+  }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  // demo toggle: alternate jpg / png logos, removing each one before the next
+  void toggleDemo() {
+    SMTCommand demo;
+    if(drawImage_) {
+      demo.asset = demoId_%2==0? "jpg" : "png";
+      demo.action.type = SMT_ACTION_ADD_IMAGE;
+      demo.action.id = demoId_;
+      demo.action.fields = SMT_FIELD_X | SMT_FIELD_Y | SMT_FIELD_WIDTH | SMT_FIELD_HEIGHT | SMT_FIELD_Z_ORDER | SMT_FIELD_OPACITY;
+      demo.action.placement.xPercentage = 10.0;
+      demo.action.placement.yPercentage = 20.0;
+      demo.action.placement.widthPercentage = 15.0;
+      demo.action.placement.heightPercentage = 10.0;
+      demo.action.placement.zOrder = 0;
+      demo.action.placement.opacity = 255;
+    }
+    else {
+      demo.action.type = SMT_ACTION_REMOVE_IMAGE;
+      demo.action.id = demoId_++;
+    }
+    drawImage_ = !drawImage_;
+    emit(demo);
   }
-}
\ No newline at end of file
+
+protected:
+  SMTProducerParams &params_;
+  ThreadSafeQueue<EssenceBlock*> &queue_;
+  const MuxerTimestamp &clock_;
+  AssetRegistry assets_;
+  ThreadSafeQueue<SMTCommand> commands_;
+  ControlChannel control_;
+  EventLoop *loop_ = nullptr;
+  std::map<uint64_t, Repeat> repeats_;
+  uint64_t nextRepeat_ = 0;
+  // last time each asset payload went out
+  std::map<uint64_t, clock::time_point> assetSentTime_;
+  // demo toggle state
+  TimerId demoTimer_ = 0;
+  bool drawImage_ = true;
+  uint64_t demoId_ = 1001;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include <queue>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+#include "smt_action.h"
+
+#define SMT_TIMELINE_HISTORY_SIZE 4096
+
+// Pending SMT actions ordered by block timestamp. That is the muxer clock at send time, not the
+// source PTS: an action applies from the first frame sent at or after its timestamp.
+// Carousel repeats of an action (same type, id and timestamp) are recognised in constant time
+// and dropped before their payload is decoded again.
+class SMTTimeline {
+public:
+  ~SMTTimeline() {
+    clear();
+  }
+
+  // True if this action was already scheduled (or applied recently)
+  bool contains(const SMTAction &_action) const {
+    return seen_.find(makeKey(_action)) != seen_.end();
+  }
+
+  // Returns false for duplicates
+  bool schedule(const SMTAction &_action) {
+    Key key = makeKey(_action);
+    if(!seen_.insert(key).second) {
+      return false;
+    }
+    seenOrder_.push_back(key);
+    if(seenOrder_.size() > SMT_TIMELINE_HISTORY_SIZE) {
+      seen_.erase(seenOrder_.front());
+      seenOrder_.pop_front();
+    }
+
+    pending_.push(Entry{ _action, sequence_++ });
+    return true;
+  }
+
+  // Pop the next action due at _pts, in timestamp order (arrival order for equal timestamps)
+  bool popDue(uint64_t _pts, SMTAction &_action) {
+    if(pending_.empty() || pending_.top().action.timestamp > _pts) {
+      return false;
+    }
+    _action = pending_.top().action;
+    pending_.pop();
+    return true;
+  }
+
+  size_t size() const {
+    return pending_.size();
+  }
+
+  void clear() {
+    while(!pending_.empty()) {
+      pending_.pop();
+    }
+    seen_.clear();
+    seenOrder_.clear();
+  }
+
+protected:
+  struct Key {
+    uint64_t id;
+    uint64_t timestamp;
+    int type;
+    bool operator==(const Key &_other) const {
+      return id == _other.id && timestamp == _other.timestamp && type == _other.type;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &_key) const {
+      uint64_t hash = _key.id * 0x9e3779b97f4a7c15ULL;
+      hash ^= _key.timestamp + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+      hash ^= (uint64_t) _key.type + (hash << 6) + (hash >> 2);
+      return (size_t) hash;
+    }
+  };
+
+  struct Entry {
+    SMTAction action;
+    uint64_t sequence;
+  };
+
+  struct Later {
+    bool operator()(const Entry &_a, const Entry &_b) const {
+      if(_a.action.timestamp != _b.action.timestamp) {
+        return _a.action.timestamp > _b.action.timestamp;
+      }
+      return _a.sequence > _b.sequence;
+    }
+  };
+
+  static Key makeKey(const SMTAction &_action) {
+    return Key{ _action.id, _action.timestamp, (int) _action.type };
+  }
+
+protected:
+  std::priority_queue<Entry, std::vector<Entry>, Later> pending_;
+  std::unordered_set<Key, KeyHash> seen_;
+  std::deque<Key> seenOrder_;
+  uint64_t sequence_ = 0;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+// Winsock names for POSIX sockets, so the UDP reader/writer build on Linux as well
+#ifdef _WIN32
+  #include <winsock2.h>
+  #include <Ws2tcpip.h>
+  #pragma comment(lib, "ws2_32.lib")
+#else
+  #include <errno.h>
+  #include <unistd.h>
+  #include <sys/ioctl.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <arpa/inet.h>
+
+  typedef int SOCKET;
+  typedef int BOOL;
+  typedef unsigned long u_long;
+  #ifndef TRUE
+    #define TRUE 1
+  #endif
+  #define INVALID_SOCKET -1
+  #define SOCKET_ERROR -1
+
+  __inline int ioctlsocket(SOCKET _socket, unsigned long _command, u_long *_arg) {
+    int arg = (int) *_arg;
+    return ioctl(_socket, _command, &arg);
+  }
+
+  __inline int closesocket(SOCKET _socket) {
+    return ::close(_socket);
+  }
+
+  __inline int WSAGetLastError() {
+    return errno;
+  }
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include "essence_block.h"
+#include "parser_base.h"
+#include "metrics_registry.h"
+
+#define ANALYZER_TIMESTAMP_JUMP 90000    // 1 s at 90 kHz: larger steps either way are discontinuities (pts reorder stays below)
+
+// Stream monitoring without decoding: per program stream blocks, bytes, lost and reordered blocks
+// (from the sequence numbers of current senders), keyframes, GOP length and timestamp
+// discontinuities, plus the SMT / announcement rate. Everything goes to the metrics registry
+class StreamAnalyzerParser : public ParserBase {
+public:
+  int parse(EssenceBlock *_block) {
+    switch(_block->essence_type) {
+      case ESSENCE_TYPE_ED:
+        analyze(_block);
+        break;
+      case ESSENCE_TYPE_SMT:
+        smtTables_++;
+        break;
+      case ESSENCE_TYPE_EA:
+        announcements_++;
+        break;
+      case ESSENCE_TYPE_JOIN:
+        joinBlocks_++;
+        break;
+      default:
+        break;
+    }
+    return (int) (_block->size + _block->payload_size);
+  }
+
+protected:
+  struct Stream {
+    Stream(uint8_t _program, uint8_t _stream)
+    :labels(metricLabel("program", std::to_string(_program)) + "," + metricLabel("stream", std::to_string(_stream)))
+    ,blocks(globalMetrics().counter("analyzer_blocks_total", labels, "Essence blocks per program stream"))
+    ,bytes(globalMetrics().counter("analyzer_bytes_total", labels, "Essence payload bytes per program stream"))
+    ,lost(globalMetrics().counter("analyzer_lost_blocks_total", labels, "Blocks missing from the sequence"))
+    ,reordered(globalMetrics().counter("analyzer_reordered_blocks_total", labels, "Blocks older than the last one received"))
+    ,keyframes(globalMetrics().counter("analyzer_keyframes_total", labels, "Random access points"))
+    ,discontinuities(globalMetrics().counter("analyzer_timestamp_discontinuities_total", labels, "Timestamps stepping back or ahead by more than a second"))
+    ,gopBlocks(globalMetrics().gauge("analyzer_gop_blocks", labels, "Blocks between the last two random access points"))
+    {
+    }
+
+    std::string labels;
+    bool started = false;
+    uint16_t sequence = 0;
+    uint64_t timestamp = 0;
+    int64_t sinceKey = -1;
+    Counter &blocks;
+    Counter &bytes;
+    Counter &lost;
+    Counter &reordered;
+    Counter &keyframes;
+    Counter &discontinuities;
+    Gauge &gopBlocks;
+  };
+
+  void analyze(EssenceBlock *_block) {
+    uint16_t key = (uint16_t) ((_block->program_index << 8) | _block->stream_index);
+    auto it = streams_.find(key);
+    if(it == streams_.end()) {
+      it = streams_.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(_block->program_index, _block->stream_index)).first;
+    }
+    Stream &stream = it->second;
+    stream.blocks++;
+    stream.bytes += _block->payload_size;
+
+    if(_block->flags & ESSENCE_FLAG_SEQUENCED) {
+      if(stream.started) {
+        uint16_t gap = (uint16_t) (_block->sequence - stream.sequence);
+        if(gap == 0 || gap >= 0x8000) {
+          stream.reordered++;
+          return;
+        }
+        stream.lost += gap - 1;
+      }
+      stream.sequence = _block->sequence;
+
+      if(_block->flags & ESSENCE_FLAG_KEY) {
+        stream.keyframes++;
+        if(stream.sinceKey >= 0) {
+          stream.gopBlocks.set(stream.sinceKey);
+        }
+        stream.sinceKey = 0;
+      }
+      if(stream.sinceKey >= 0) {
+        stream.sinceKey++;
+      }
+    }
+
+    if(stream.started && (_block->timestamp + ANALYZER_TIMESTAMP_JUMP < stream.timestamp || _block->timestamp > stream.timestamp + ANALYZER_TIMESTAMP_JUMP)) {
+      stream.discontinuities++;
+    }
+    stream.timestamp = _block->timestamp;
+    stream.started = true;
+  }
+
+protected:
+  std::unordered_map<uint16_t, Stream> streams_;
+  // metrics
+  Counter &smtTables_ = globalMetrics().counter("analyzer_tables_total", "type=\"smt\"", "SMT tables and essence announcements received");
+  Counter &announcements_ = globalMetrics().counter("analyzer_tables_total", "type=\"ea\"");
+  Counter &joinBlocks_ = globalMetrics().counter("analyzer_join_blocks_total", "", "Join burst blocks received");
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cctype>
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// One stream selection rule:
+//   v a s d          every video / audio / subtitle / data stream
+//   v:0 a:1          nth stream of that type (input order)
+//   a:eng            streams of that type with that language tag
+//   codec:aac        streams with that codec
+//   #3 or 3          input stream index
+struct StreamRule {
+  AVMediaType type = AVMEDIA_TYPE_UNKNOWN;   // UNKNOWN = any type
+  int nth = -1;
+  std::string language;
+  std::string codec;
+  int index = -1;
+};
+
+// Selection of input streams for a program, evaluated once the input is probed and before any
+// essence block is built. A stream is selected if any rule matches it; no rules selects every stream
+class StreamSelector {
+public:
+  // '+' separated rules, e.g. "v:0+a:eng+a:spa"
+  bool parse(const std::string &_rules) {
+    rules_.clear();
+    std::stringstream rules(_rules);
+    std::string text;
+    while(std::getline(rules, text, '+')) {
+      StreamRule rule;
+      if(!parseRule(text, rule)) {
+        std::cerr << "Invalid stream rule: " << text << std::endl;
+        return false;
+      }
+      rules_.push_back(rule);
+    }
+    return true;
+  }
+
+  bool empty() const {
+    return rules_.empty();
+  }
+
+  // Selected flag per input stream
+  std::vector<bool> select(AVFormatContext *_formatContext) const {
+    std::vector<bool> selected(_formatContext->nb_streams, rules_.empty());
+    for(const StreamRule &rule : rules_) {
+      int nth = 0;
+      for(unsigned int i = 0; i < _formatContext->nb_streams; i++) {
+        AVStream *stream = _formatContext->streams[i];
+        AVCodecParameters *codecParams = stream->codecpar;
+        if(rule.index >= 0) {
+          if((int) i == rule.index) {
+            selected[i] = true;
+          }
+          continue;
+        }
+        if(rule.type != AVMEDIA_TYPE_UNKNOWN && codecParams->codec_type != rule.type) {
+          continue;
+        }
+        if(!rule.codec.empty() && rule.codec != avcodec_get_name(codecParams->codec_id)) {
+          continue;
+        }
+        if(!rule.language.empty()) {
+          AVDictionaryEntry *language = av_dict_get(stream->metadata, "language", nullptr, 0);
+          if(!language || rule.language != language->value) {
+            continue;
+          }
+        }
+        if(rule.nth >= 0 && nth++ != rule.nth) {
+          continue;
+        }
+        selected[i] = true;
+      }
+    }
+    return selected;
+  }
+
+protected:
+  static bool parseRule(const std::string &_text, StreamRule &_rule) {
+    if(_text.empty()) {
+      return false;
+    }
+    std::string text = (_text[0] == '#') ? _text.substr(1) : _text;
+    if(isNumber(text)) {
+      _rule.index = atoi(text.c_str());
+      return true;
+    }
+    if(_text[0] == '#') {
+      return false;
+    }
+
+    size_t colon = text.find(':');
+    std::string key = text.substr(0, colon);
+    std::string value = (colon == std::string::npos) ? "" : text.substr(colon + 1);
+    if(key == "codec") {
+      _rule.codec = value;
+      return !value.empty();
+    }
+    if(key == "v") _rule.type = AVMEDIA_TYPE_VIDEO;
+    else if(key == "a") _rule.type = AVMEDIA_TYPE_AUDIO;
+    else if(key == "s") _rule.type = AVMEDIA_TYPE_SUBTITLE;
+    else if(key == "d") _rule.type = AVMEDIA_TYPE_DATA;
+    else return false;
+
+    if(colon == std::string::npos) {
+      return true;
+    }
+    if(isNumber(value)) {
+      _rule.nth = atoi(value.c_str());
+    }
+    else {
+      _rule.language = value;
+    }
+    return !value.empty();
+  }
+
+  static bool isNumber(const std::string &_text) {
+    if(_text.empty()) {
+      return false;
+    }
+    for(char c : _text) {
+      if(!isdigit((unsigned char) c)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+protected:
+  std::vector<StreamRule> rules_;
+};
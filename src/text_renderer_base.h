@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+struct SDL_Renderer;
+struct SDL_Rect;
+
+// Text layer rasterization. Lines are drawn glyph by glyph from cached glyph images, so the per
+// frame cost depends on the visible glyphs only
+class TextRendererBase {
+public:
+  virtual ~TextRendererBase() = default;
+  // Width in pixels of _text in font _fontId with a line height of _lineHeight pixels
+  virtual int measure(int _fontId, int _lineHeight, const std::u32string &_text) = 0;
+  // Draw one line with its top left corner at _x, _y. Glyphs outside _clip are skipped.
+  // _color is ARGB (straight alpha), _opacity the layer opacity
+  virtual void draw(SDL_Renderer *_renderer, int _fontId, int _lineHeight, const std::u32string &_text, int _x, int _y, const SDL_Rect &_clip, uint32_t _color, uint8_t _opacity) = 0;
+};
+
+// UTF-8 to code points. Invalid sequences become U+FFFD
+__inline void decodeUTF8(const std::string &_text, std::u32string &_codepoints) {
+  _codepoints.clear();
+  const uint8_t *p = (const uint8_t *) _text.data();
+  const uint8_t *end = p + _text.size();
+  while(p < end) {
+    uint32_t c = *p++;
+    int extra = (c >= 0xf8) ? -1 : (c >= 0xf0) ? 3 : (c >= 0xe0) ? 2 : (c >= 0xc0) ? 1 : (c < 0x80) ? 0 : -1;
+    if(extra < 0) {
+      _codepoints.push_back(0xfffd);
+      continue;
+    }
+    c &= (extra == 0) ? 0x7f : (0x3f >> extra);
+    int i = 0;
+    for(; i < extra && p < end && (*p & 0xc0) == 0x80; i++) {
+      c = (c << 6) | (*p++ & 0x3f);
+    }
+    // F5..F7 leads decode past U+10FFFF
+    _codepoints.push_back(i == extra && c <= 0x10ffff ? c : 0xfffd);
+  }
+}
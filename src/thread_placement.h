@@ -0,0 +1,248 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <sched.h>
+  #include <unistd.h>
+  #ifdef __linux__
+    #include <sys/syscall.h>
+  #endif
+#endif
+#include "latency_histogram.h"
+#include "metrics_registry.h"
+
+// Threads that can be placed
+enum ThreadRole {
+  THREAD_ROLE_DEMUX = 0,   // sender input demux and block building
+  THREAD_ROLE_MUXER,       // sender pacing and network writes
+  THREAD_ROLE_SMT,         // sender event loop: SMT producer, metrics
+  THREAD_ROLE_READER,      // receiver network / shm read, reassembly, video decode
+  THREAD_ROLE_AUDIO,       // receiver audio decoder
+  THREAD_ROLE_CONSUMER,    // receiver fan-out consumers (render, record, analyze)
+  THREAD_ROLE_PRESENT,     // receiver video presentation: A/V sync wait, overlays, SDL rendering
+  THREAD_ROLES
+};
+
+__inline const char *threadRoleName(ThreadRole _role) {
+  static const char *names[THREAD_ROLES] = { "demux", "muxer", "smt", "reader", "audio", "consumer", "present" };
+  return _role < THREAD_ROLES ? names[_role] : "unknown";
+}
+
+struct ThreadPlacementRule {
+  bool configured = false;
+  std::vector<int> cpus;       // empty = any
+  bool realtime = false;       // SCHED_FIFO (Windows: time critical priority)
+  int priority = 50;           // SCHED_FIFO priority
+};
+
+// NUMA node the calling thread runs on, -1 if unknown
+__inline int currentNumaNode() {
+#ifdef _WIN32
+  USHORT node = 0;
+  PROCESSOR_NUMBER processor;
+  GetCurrentProcessorNumberEx(&processor);
+  return GetNumaProcessorNodeEx(&processor, &node) ? (int) node : -1;
+#elif defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu = 0, node = 0;
+  return syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? (int) node : -1;
+#else
+  return -1;
+#endif
+}
+
+// Per role CPU affinity and scheduling class. Spec: <role>=<cpus>[/rt[:<priority>]] separated by
+// ';', cpus as a list of cpus and ranges, e.g. "muxer=2/rt;demux=4-7;reader=3,5/rt:80". Roles are
+// placed by their thread entry (placeThread), so the memory a role touches first lands on its NUMA
+// node: the reader's reassembly buffer (prefaulted by the reader thread) does. Essence blocks don't:
+// the demux thread allocates and fills them, so the muxer reads them from the demux node. Keep demux
+// and muxer on one node where that hand-off matters. Real time only for threads that block, or on a
+// dedicated cpu
+class ThreadPlacement {
+public:
+  bool parse(const std::string &_spec) {
+    std::stringstream entries(_spec);
+    std::string entry;
+    while(std::getline(entries, entry, ';')) {
+      if(entry.empty()) {
+        continue;
+      }
+      size_t equals = entry.find('=');
+      if(equals == std::string::npos) {
+        return false;
+      }
+      ThreadRole role = roleOf(entry.substr(0, equals));
+      if(role == THREAD_ROLES) {
+        std::cerr << "Unknown thread role: " << entry.substr(0, equals) << std::endl;
+        return false;
+      }
+      ThreadPlacementRule rule;
+      rule.configured = true;
+      std::string value = entry.substr(equals + 1);
+      size_t slash = value.find('/');
+      if(slash != std::string::npos) {
+        std::string scheduling = value.substr(slash + 1);
+        value = value.substr(0, slash);
+        if(scheduling.compare(0, 2, "rt") != 0) {
+          return false;
+        }
+        rule.realtime = true;
+        if(scheduling.size() > 3 && scheduling[2] == ':') {
+          rule.priority = atoi(scheduling.c_str() + 3);
+        }
+      }
+      if(!parseCpus(value, rule.cpus)) {
+        return false;
+      }
+      rules_[role] = rule;
+    }
+    return true;
+  }
+
+  const ThreadPlacementRule &rule(ThreadRole _role) const {
+    return rules_[_role];
+  }
+
+  // Place the calling thread. Failures (e.g. no permission for real time) are reported, not fatal
+  bool apply(ThreadRole _role) const {
+    const ThreadPlacementRule &rule = rules_[_role];
+    if(!rule.configured) {
+      return true;
+    }
+    bool ok = true;
+#ifdef _WIN32
+    if(!rule.cpus.empty()) {
+      DWORD_PTR mask = 0;
+      for(int cpu : rule.cpus) {
+        if(cpu < (int) (sizeof(DWORD_PTR) * 8)) {
+          mask |= (DWORD_PTR) 1 << cpu;
+        }
+      }
+      ok &= SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+    }
+    if(rule.realtime) {
+      ok &= SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+    }
+#elif defined(__linux__)
+    if(!rule.cpus.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for(int cpu : rule.cpus) {
+        CPU_SET(cpu, &set);
+      }
+      ok &= pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+    if(rule.realtime) {
+      sched_param param;
+      param.sched_priority = rule.priority;
+      ok &= pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+    }
+#endif
+    if(!ok) {
+      std::cerr << "Couldn't place " << threadRoleName(_role) << " thread as configured (" << describe(_role) << ")" << std::endl;
+    }
+    return ok;
+  }
+
+  std::string describe(ThreadRole _role) const {
+    const ThreadPlacementRule &rule = rules_[_role];
+    std::string text = "cpus ";
+    if(rule.cpus.empty()) {
+      text += "any";
+    }
+    for(size_t i = 0; i < rule.cpus.size(); i++) {
+      text += (i ? "," : "") + std::to_string(rule.cpus[i]);
+    }
+    if(rule.realtime) {
+      text += ", rt " + std::to_string(rule.priority);
+    }
+    return text;
+  }
+
+protected:
+  static ThreadRole roleOf(const std::string &_name) {
+    for(int role = 0; role < THREAD_ROLES; role++) {
+      if(_name == threadRoleName((ThreadRole) role)) {
+        return (ThreadRole) role;
+      }
+    }
+    return THREAD_ROLES;
+  }
+
+  static bool parseCpus(const std::string &_list, std::vector<int> &_cpus) {
+    std::stringstream ranges(_list);
+    std::string range;
+    while(std::getline(ranges, range, ',')) {
+      if(range.empty() || range.find_first_not_of("0123456789-") != std::string::npos) {
+        return false;
+      }
+      size_t dash = range.find('-');
+      int first = atoi(range.c_str());
+      int last = (dash == std::string::npos) ? first : atoi(range.c_str() + dash + 1);
+      if(last < first || last >= 1024) {
+        return false;
+      }
+      for(int cpu = first; cpu <= last; cpu++) {
+        if(std::find(_cpus.begin(), _cpus.end(), cpu) == _cpus.end()) {
+          _cpus.push_back(cpu);
+        }
+      }
+    }
+    return true;
+  }
+
+protected:
+  ThreadPlacementRule rules_[THREAD_ROLES];
+};
+
+// Placement of the process, configured from the command line before threads start
+__inline ThreadPlacement &threadPlacement() {
+  static ThreadPlacement placement;
+  return placement;
+}
+
+// Thread entry hook
+__inline void placeThread(ThreadRole _role) {
+  threadPlacement().apply(_role);
+}
+
+// Lateness of timed wakeups of a role (sleep / timed wait overshoot), exported at runtime
+__inline LatencyHistogram &wakeupDelayHistogram(ThreadRole _role) {
+  return globalMetrics().histogram("thread_wakeup_delay_seconds", metricLabel("role", threadRoleName(_role)), "Lateness of timed thread wakeups");
+}
+
+// Startup check: per role, a placed probe thread sleeps _samples times for _periodUs
+// and the oversleep quantiles are printed with the cpus, scheduling class and NUMA node
+__inline void reportThreadPlacement(const ThreadRole *_roles, int _count, int _samples = 200, int _periodUs = 1000) {
+  for(int i = 0; i < _count; i++) {
+    ThreadRole role = _roles[i];
+    LatencyHistogram delays;
+    int node = -1;
+    bool placed = true;
+    std::thread probe([&]() {
+      placed = threadPlacement().apply(role);
+      node = currentNumaNode();
+      auto wakeup = std::chrono::steady_clock::now();
+      for(int sample = 0; sample < _samples; sample++) {
+        wakeup += std::chrono::microseconds(_periodUs);
+        std::this_thread::sleep_until(wakeup);
+        int64_t late = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wakeup).count();
+        delays.record(late > 0 ? (uint64_t) late : 0);
+      }
+    });
+    probe.join();
+    std::cerr << "Thread " << threadRoleName(role) << ": " << threadPlacement().describe(role) << (placed ? "" : " (not applied)")
+              << ", node " << node << ", wakeup delay p50 " << delays.quantile(0.5) / 1000.0 << " us, p99 " << delays.quantile(0.99) / 1000.0
+              << " us, max " << delays.quantile(1.0) / 1000.0 << " us" << std::endl;
+  }
+}
@@ -1,28 +1,27 @@
 #pragma once
 
 #include <iostream>
-#ifdef _WIN32
-  #include <winsock2.h>
-  #include <Ws2tcpip.h>
-  #pragma comment(lib, "ws2_32.lib")
-#endif
 #include <thread>
 #include <array>
-#include <vector>
+#include <atomic>
+#include "socket_compat.h"
 #include "essence_block.h"
-#include "smt_producer.h"
-#include "base64_simple.h"
+#include "block_reassembler.h"
 #include "parser_base.h"
+#include "reader_base.h"
+#include "thread_placement.h"
 
-#define MAX_AV_PACKET_SIZE 1024 * 1024 * 4
+// Socket receive buffer: a burst of datagrams the reader thread has not picked up yet
+// (Linux caps it to net.core.rmem_max)
+#define UDP_RECEIVE_BUFFER_SIZE (8 * 1024 * 1024)
 
 // UDP reader
-class UDPReader {
+class UDPReader : public ReaderBase {
 public:
   UDPReader(ParserBase *_parser, const char *_server, int _port)
   :server_(_server)
   ,port_(_port)
-  ,parser_(_parser)
+  ,reassembler_(_parser)
   {
   }
 
@@ -41,6 +40,11 @@ public:
       return false;
     }
 
+    int receiveBuffer = UDP_RECEIVE_BUFFER_SIZE;
+    if(setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, (char*)&receiveBuffer, sizeof(receiveBuffer)) == SOCKET_ERROR) {
+      std::cerr << "setsockopt SO_RCVBUF failed with error: " << WSAGetLastError() << std::endl;
+    }
+
     // Bind to the specified port
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
@@ -51,7 +55,7 @@ public:
       return false;
     }
 
-    // Join the multicast group
+    // Join the multicast group (unicast addresses, e.g. 127.0.0.1, just receive on the port)
     ip_mreq mreq{};
     // Convert IP address from text to binary format
     if(inet_pton(AF_INET, server_.c_str(), &mreq.imr_multiaddr.s_addr) <= 0) {
@@ -59,7 +63,7 @@ public:
       return false;
     }
     mreq.imr_interface.s_addr = htonl(INADDR_ANY);
-    if(setsockopt(sockfd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&mreq, sizeof(mreq)) == SOCKET_ERROR) {
+    if(IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr)) && setsockopt(sockfd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&mreq, sizeof(mreq)) == SOCKET_ERROR) {
       std::cerr << "Failed to join multicast group with error: " << WSAGetLastError() << std::endl;
       return false;
     }
@@ -72,15 +76,19 @@ public:
 
   bool close() {
     stopFlag_ = true;
+    // wake up a blocked recv
+#ifdef _WIN32
+    closesocket(sockfd_);
+#else
+    shutdown(sockfd_, SHUT_RDWR);
+#endif
     if(workerThread_.joinable()) {
       workerThread_.join();
     }
 
+#ifndef _WIN32
     // Close the socket
-#ifdef _WIN32
-    closesocket(sockfd_);  // On Windows
-#else 
-    close(sockfd_);        // On Linux
+    closesocket(sockfd_);
 #endif
 
     return true;
@@ -88,52 +96,24 @@ public:
 
 protected:
   void readerLoop() { 
+    placeThread(THREAD_ROLE_READER);
+    reassembler_.prefault(RECEIVE_BUFFER_PREFAULT);
     std::array<uint8_t, 1500> buffer; // Typical UDP packet size
-    size_t current_size = 0;
 
     while(!stopFlag_) {
       int received = recv(sockfd_, reinterpret_cast<char*>(buffer.data()), (int) buffer.size(), 0);
       if(received <= 0) {
         continue;
       }
-
-      size_t i = 0;
-      while(i < received) {
-        accumulatedData_.push_back(buffer[i]);
-
-        // Search for sync word
-        if(accumulatedData_.size() >= 4) {
-          uint32_t last_word = *reinterpret_cast<uint32_t*>(&accumulatedData_[accumulatedData_.size() - 4]);
-          if(last_word == SYNC_MAGIC_NUMBER) {
-            // Sync word found, process the block         
-            if(accumulatedData_.size() >= sizeof(EssenceBlock)) {
-              EssenceBlock *block = reinterpret_cast<EssenceBlock *>(accumulatedData_.data());
-              parser_->parse(block);
-              accumulatedData_.erase(accumulatedData_.begin(), accumulatedData_.end() - 4);
-            }
-          }
-        }
-
-        if(accumulatedData_.size() > MAX_AV_PACKET_SIZE) {
-          std::cerr << "Buffer overflow prevented. Dropping data." << std::endl;
-          accumulatedData_.clear();
-        }
-
-        ++i;
-      }
+      reassembler_.consume(buffer.data(), (size_t) received, traceNow());
     }
   }
 
 protected:
   std::string server_;
   int port_ = 0;
-#ifdef _WIN32
   SOCKET sockfd_ = 0;
-#else
-  int sockfd_ = 0;
-#endif
   std::thread workerThread_;
   std::atomic<bool> stopFlag_ = false;
-  std::vector<uint8_t> accumulatedData_;
-  ParserBase *parser_ = nullptr;
+  BlockReassembler reassembler_;
 };
@@ -1,20 +1,33 @@
 #pragma once
 
 #include <iostream>
-#ifdef _WIN32
-  #include <winsock2.h>
-  #include <Ws2tcpip.h>
-  #pragma comment(lib, "ws2_32.lib")
-#endif
+#include <string>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include "socket_compat.h"
 #include "writer_base.h"
+#include "metrics_registry.h"
 
-// UDP writer
+// One Ethernet frame: 1500 bytes MTU less the IP and UDP headers (the receive buffer of UDPReader is 1500)
+#define CHUNK_SIZE 1472
+
+struct UDPWriterParams {
+  int datagramSize = CHUNK_SIZE;  // bytes per datagram, no more than CHUNK_SIZE
+  int coalesceDelayUs = 1000;   // blocks share datagrams, a partial one is held back at most this long; 0 = off
+};
+
+// UDP writer. The stream is cut into datagramSize datagrams regardless of block boundaries (the
+// receiver frames blocks by their header length), so small blocks (audio, SMT) are packed together
+// instead of taking a datagram each
 class UDPWriter : public WriterBase {
 public:
-  UDPWriter(const char *_server, int _port)
+  UDPWriter(const char *_server, int _port, const UDPWriterParams &_params = UDPWriterParams())
   :server_(_server)
   ,port_(_port)
+  ,params_(_params)
   {
+    pending_.reserve(params_.datagramSize);
   }
 
   bool open() {
@@ -61,29 +74,82 @@ public:
   }
 
   bool close() {
+    flush();
+
     // Close the socket
-#ifdef _WIN32
-    closesocket(sockfd_);  // On Windows
-#else 
-    close(sockfd_);        // On Linux
-#endif
+    closesocket(sockfd_);
 
     return true;
   }
 
-  #define CHUNK_SIZE 1024 
-
   int write(const unsigned char *_packet, int _packetSize) {
-    const uint8_t* message = _packet;
-    size_t bytesSent = 0;
-    int numPackets = 0;
+    size_t size = (size_t) _packetSize;
+    size_t datagramSize = (size_t) params_.datagramSize;
+    size_t offset = 0;
+
+    if(params_.coalesceDelayUs <= 0) {
+      while(offset < size) {
+        size_t chunkSize = (size - offset > datagramSize) ? datagramSize : size - offset;
+        if(!send(_packet + offset, chunkSize)) {
+          return (int) offset;
+        }
+        offset += chunkSize;
+      }
+      return (int) size;
+    }
+
+    // complete the datagram held back
+    if(!pending_.empty()) {
+      size_t take = datagramSize - pending_.size();
+      if(take > size) {
+        take = size;
+      }
+      pending_.insert(pending_.end(), _packet, _packet + take);
+      offset = take;
+      if(pending_.size() == datagramSize && !flush()) {
+        return 0;
+      }
+    }
+    // whole datagrams straight from the block
+    while(size - offset >= datagramSize) {
+      if(!send(_packet + offset, datagramSize)) {
+        return (int) offset;
+      }
+      offset += datagramSize;
+    }
+    // hold the tail back for the blocks that follow
+    if(offset < size) {
+      if(pending_.empty()) {
+        pendingSince_ = std::chrono::steady_clock::now();
+      }
+      pending_.insert(pending_.end(), _packet + offset, _packet + size);
+    }
+
+    return (int) size;
+  }
+
+  int flush() {
+    if(pending_.empty()) {
+      return 0;
+    }
+    int size = (int) pending_.size();
+    bool sent = send(pending_.data(), pending_.size());
+    pending_.clear();
+    return sent ? size : 0;
+  }
 
-    while(bytesSent < _packetSize) {
-      size_t remaining = _packetSize - bytesSent;
-      size_t chunkSize = (remaining > CHUNK_SIZE) ? CHUNK_SIZE : remaining;
+  std::chrono::steady_clock::time_point flushDeadline() const {
+    if(pending_.empty()) {
+      return std::chrono::steady_clock::time_point::max();
+    }
+    return pendingSince_ + std::chrono::microseconds(params_.coalesceDelayUs);
+  }
 
+protected:
+  bool send(const uint8_t *_data, size_t _size) {
+    while(true) {
       // Send the message
-      int sentBytes = sendto(sockfd_, (const char*) message + bytesSent, (int) chunkSize, 0, (struct sockaddr*) &serverAddr_, sizeof(serverAddr_));
+      int sentBytes = sendto(sockfd_, (const char*) _data, (int) _size, 0, (struct sockaddr*) &serverAddr_, sizeof(serverAddr_));
       if(sentBytes == SOCKET_ERROR) {
         // never returns EWOULDBLOCK after setup socket to non-nlocking. I'm forcing to send huge blocks
         if(errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -91,29 +157,23 @@ public:
           continue;
         }
         else {
-          std::cerr << "Error sending message " << WSAGetLastError() << " " << chunkSize << std::endl;
+          std::cerr << "Error sending message " << WSAGetLastError() << " " << _size << std::endl;
           return false;
         }
       }
-      bytesSent += sentBytes;
-
-      // Problems sending PNG into SMT. Tests sleeping because EWOULDBLOCK never is returned case send buffer is full
-      numPackets++;
-      if(numPackets % 50 == 0) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-      }
+      datagrams_++;
+      break;
     }
-
-    return (int) bytesSent;
+    return true;
   }
 
 protected:
   std::string server_;
   int port_ = 0;
-#ifdef _WIN32
   SOCKET sockfd_ = 0;
-#else
-  int sockfd_ = 0;
-#endif
   struct sockaddr_in serverAddr_ = {};
+  UDPWriterParams params_;
+  std::vector<uint8_t> pending_;
+  std::chrono::steady_clock::time_point pendingSince_;
+  Counter &datagrams_ = globalMetrics().counter("sender_datagrams_total", "", "Datagrams sent");
 };
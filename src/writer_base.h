@@ -1,9 +1,19 @@
 #pragma once
 
+#include <chrono>
+
 class WriterBase {
 public:
   virtual ~WriterBase() = default;
   virtual bool open() = 0;
   virtual bool close() = 0;
   virtual int write(const unsigned char *_packet, int _packetSize) = 0;
+
+  // Writers that hold data back to coalesce it send it on flush(), called once flushDeadline() passes
+  virtual int flush() {
+    return 0;
+  }
+  virtual std::chrono::steady_clock::time_point flushDeadline() const {
+    return std::chrono::steady_clock::time_point::max();
+  }
 };